@@ -0,0 +1,278 @@
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kMaxArgs = 4;
+constexpr uint32_t kSketchDepth = 4;
+constexpr uint32_t kSketchWidth = 1024;
+constexpr uint32_t kTopTuples = 8;
+constexpr uint32_t kTopValues = 4;
+constexpr uint32_t kMaxFrames = 256;
+
+struct TupleEntry {
+    uint64_t args[kMaxArgs];
+    uint64_t count;
+};
+
+struct ValueEntry {
+    uint64_t value;
+    uint64_t count;
+};
+
+struct FunctionValues {
+    const char* name{nullptr};
+    uint32_t num_args{0};
+    uint64_t calls{0};
+    uint64_t repeats{0};
+    uint64_t hits{0};         /* Repeats that are not inside another repeat */
+    uint64_t total_ns{0};     /* Outermost frames of the function only */
+    uint64_t saved_ns{0};     /* Time of the hits, what memoization would have skipped */
+    uint32_t sketch[kSketchDepth][kSketchWidth]{};
+    TupleEntry top_tuples[kTopTuples]{};
+    ValueEntry top_values[kMaxArgs][kTopValues]{};
+    std::mutex mutex;
+};
+
+struct Frame {
+    const char* func;
+    FunctionValues* values;
+    uint64_t enter_ns;
+    bool repeat;
+    bool under_repeat;
+    bool outermost;
+};
+
+thread_local Frame frames[kMaxFrames];
+thread_local uint32_t frames_num = 0;
+
+std::vector<FunctionValues*>& AllFunctions() {
+    static auto* functions = new std::vector<FunctionValues*>();
+    return *functions;
+}
+
+std::mutex& FunctionsMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+uint64_t HashTuple(const uint64_t* args, uint32_t num_args) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull * (num_args + 1);
+    for (uint32_t i = 0; i < num_args; i++) {
+        hash ^= args[i] + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+        hash *= 0xFF51AFD7ED558CCDull;
+    }
+    return hash ^ (hash >> 33);
+}
+
+/* Count-min sketch update, returns the estimate before the update */
+uint64_t SketchAdd(FunctionValues& values, uint64_t hash) {
+    uint32_t low = static_cast<uint32_t>(hash);
+    uint32_t high = static_cast<uint32_t>(hash >> 32) | 1;
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t row = 0; row < kSketchDepth; row++) {
+        uint32_t& counter = values.sketch[row][(low + row * high) % kSketchWidth];
+        estimate = std::min<uint64_t>(estimate, counter);
+        if (counter != UINT32_MAX) {
+            counter++;
+        }
+    }
+    return estimate;
+}
+
+/* Heavy hitters ranked by their sketch estimate */
+void UpdateTopTuples(FunctionValues& values, const uint64_t* args, uint64_t estimate) {
+    TupleEntry* min_entry = &values.top_tuples[0];
+    for (TupleEntry& entry : values.top_tuples) {
+        if (entry.count != 0 && std::equal(args, args + values.num_args, entry.args)) {
+            entry.count = estimate;
+            return;
+        }
+        if (entry.count < min_entry->count) {
+            min_entry = &entry;
+        }
+    }
+    if (estimate > min_entry->count) {
+        std::copy(args, args + kMaxArgs, min_entry->args);
+        min_entry->count = estimate;
+    }
+}
+
+/* Space-saving top values of every argument, the constant specialization candidates */
+void UpdateTopValues(ValueEntry* entries, uint64_t value) {
+    ValueEntry* min_entry = &entries[0];
+    for (uint32_t i = 0; i < kTopValues; i++) {
+        if (entries[i].count != 0 && entries[i].value == value) {
+            entries[i].count++;
+            return;
+        }
+        if (entries[i].count < min_entry->count) {
+            min_entry = &entries[i];
+        }
+    }
+    min_entry->value = value;
+    min_entry->count++;
+}
+
+double Ms(uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+}
+
+void WriteMemoReport() {
+    std::lock_guard<std::mutex> lock(FunctionsMutex());
+    std::vector<FunctionValues*> functions = AllFunctions();
+    if (functions.empty()) {
+        return;
+    }
+
+    uint64_t lookup_ns = static_cast<uint64_t>(GetEnvLong("VISUAL_DUMP_MEMO_LOOKUP_NS", 20));
+    auto saved = [lookup_ns](const FunctionValues* values) {
+        uint64_t lookups = values->hits * lookup_ns;
+        return values->saved_ns > lookups ? values->saved_ns - lookups : 0;
+    };
+    std::stable_sort(functions.begin(), functions.end(), [&](const FunctionValues* lhs, const FunctionValues* rhs) {
+        return saved(lhs) != saved(rhs) ? saved(lhs) > saved(rhs) : lhs->repeats > rhs->repeats;
+    });
+
+    FILE* file = fopen(OutputPath("memo.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+
+    fprintf(file, "# Memoization candidates, ranked by the estimated time saved\n");
+    fprintf(file, "# Saved time is the time of the repeated calls minus %" PRIu64 " ns per table lookup\n",
+            lookup_ns);
+    fprintf(file, "%-32s %12s %12s %8s %12s %12s\n", "function", "calls", "repeats", "repeat%", "total ms",
+            "saved ms");
+    for (const FunctionValues* values : functions) {
+        fprintf(file, "%-32s %12" PRIu64 " %12" PRIu64 " %7.2f%% %12.3f %12.3f\n", values->name, values->calls,
+                values->repeats, 100.0 * static_cast<double>(values->repeats) / static_cast<double>(values->calls),
+                Ms(values->total_ns), Ms(saved(values)));
+
+        std::vector<TupleEntry> tuples(values->top_tuples, values->top_tuples + kTopTuples);
+        std::stable_sort(tuples.begin(), tuples.end(), [](const TupleEntry& lhs, const TupleEntry& rhs) {
+            return lhs.count > rhs.count;
+        });
+        for (const TupleEntry& tuple : tuples) {
+            if (tuple.count < 2) {
+                continue;
+            }
+            fprintf(file, "    (");
+            for (uint32_t arg = 0; arg < values->num_args; arg++) {
+                fprintf(file, arg == 0 ? "%" PRId64 : ", %" PRId64, static_cast<int64_t>(tuple.args[arg]));
+            }
+            fprintf(file, ") ~%" PRIu64 " calls\n", tuple.count);
+        }
+
+        /* Specialization on one argument pays off when a single value dominates it */
+        for (uint32_t arg = 0; arg < values->num_args; arg++) {
+            const ValueEntry* top = std::max_element(
+                values->top_values[arg], values->top_values[arg] + kTopValues,
+                [](const ValueEntry& lhs, const ValueEntry& rhs) { return lhs.count < rhs.count; });
+            double share = static_cast<double>(top->count) / static_cast<double>(values->calls);
+            if (share >= 0.5) {
+                fprintf(file, "    arg %u is %" PRId64 " in %.1f%% of the calls, ~%.3f ms if specialized\n", arg,
+                        static_cast<int64_t>(top->value), 100.0 * share, Ms(values->total_ns) * share);
+            }
+        }
+    }
+    fclose(file);
+}
+
+/* Forked child: the threads that held the per function mutexes are gone */
+void ResetFunctionMutexes() {
+    for (FunctionValues* values : AllFunctions()) {
+        new (&values->mutex) std::mutex();
+    }
+}
+
+FunctionValues* GetValues(void** state, const char* func_name, uint32_t num_args) {
+    std::lock_guard<std::mutex> lock(FunctionsMutex());
+    if (*state == nullptr) {
+        auto* values = new FunctionValues();
+        values->name = func_name;
+        values->num_args = num_args < kMaxArgs ? num_args : kMaxArgs;
+        if (AllFunctions().empty()) {
+            OnExit(WriteMemoReport);
+            OnFork(ResetFunctionMutexes);
+        }
+        AllFunctions().push_back(values);
+        __atomic_store_n(state, values, __ATOMIC_RELEASE);
+    }
+    return static_cast<FunctionValues*>(*state);
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+using visual_dump::FunctionValues;
+
+extern "C" void ProfileArguments__(void** state, const char* func_name, uint32_t num_args, uint64_t arg0,
+                                   uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+    using namespace visual_dump;
+
+    FunctionValues* values = __atomic_load_n(state, __ATOMIC_ACQUIRE) != nullptr
+                                 ? static_cast<FunctionValues*>(*state)
+                                 : GetValues(state, func_name, num_args);
+    uint64_t args[kMaxArgs] = {arg0, arg1, arg2, arg3};
+    bool repeat = false;
+    {
+        std::lock_guard<std::mutex> lock(values->mutex);
+        uint64_t estimate = SketchAdd(*values, HashTuple(args, values->num_args));
+        repeat = estimate != 0;
+        values->calls++;
+        values->repeats += repeat ? 1 : 0;
+        UpdateTopTuples(*values, args, estimate + 1);
+        for (uint32_t arg = 0; arg < values->num_args; arg++) {
+            UpdateTopValues(values->top_values[arg], args[arg]);
+        }
+    }
+
+    if (frames_num < kMaxFrames) {
+        bool under_repeat = frames_num > 0 && (frames[frames_num - 1].repeat || frames[frames_num - 1].under_repeat);
+        bool outermost = true;
+        for (uint32_t i = 0; i < frames_num && outermost; i++) {
+            outermost = frames[i].values != values;
+        }
+        frames[frames_num] = Frame{func_name, values, NowNs(), repeat, under_repeat, outermost};
+    }
+    frames_num++;
+}
+
+extern "C" void ProfileArgumentsEnd__(const char* func_name) {
+    using namespace visual_dump;
+
+    uint64_t now = NowNs();
+    if (frames_num > kMaxFrames) {
+        frames_num--;
+        return;
+    }
+
+    /* Frames skipped by unwinding are dropped */
+    while (frames_num > 0 && frames[frames_num - 1].func != func_name) {
+        frames_num--;
+    }
+    if (frames_num == 0) {
+        return;
+    }
+
+    const Frame& frame = frames[--frames_num];
+    uint64_t elapsed = now - frame.enter_ns;
+    std::lock_guard<std::mutex> lock(frame.values->mutex);
+    if (frame.outermost) {
+        frame.values->total_ns += elapsed;
+    }
+    if (frame.repeat && !frame.under_repeat) {
+        frame.values->hits++;
+        frame.values->saved_ns += elapsed;
+    }
+}
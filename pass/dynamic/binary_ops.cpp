@@ -0,0 +1,279 @@
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kRingSize = 4096;
+constexpr uint32_t kMagnitudeBuckets = 65;
+
+/* One execution of a binary operator, typed by its site */
+struct Record {
+    const SiteInfo* site;
+    uint64_t lhs;
+    uint64_t rhs;
+    uint64_t result;
+};
+
+struct OperandHistogram {
+    uint64_t zeros{0};
+    uint64_t ones{0};
+    uint64_t powers_of_two{0};
+    int64_t min{INT64_MAX};
+    int64_t max{INT64_MIN};
+    double min_float{HUGE_VAL};
+    double max_float{-HUGE_VAL};
+    uint64_t magnitudes[kMagnitudeBuckets]{}; /* Bucket b holds |value| in [2^(b-1), 2^b), 0 holds zero */
+};
+
+struct SiteHistogram {
+    uint64_t executions{0};
+    OperandHistogram operands[3]; /* lhs, rhs, result */
+};
+
+using SiteHistograms = std::unordered_map<const SiteInfo*, SiteHistogram>;
+
+/*
+ * Per thread buffer of records, drained into the thread's own histograms
+ * when it wraps around. Only the owner writes either, the report merges
+ * the threads at exit, so the hook never takes a lock. Never destroyed:
+ * the report runs from atexit, possibly after the thread is gone.
+ */
+struct Ring {
+    Record records[kRingSize];
+    uint32_t head{0};
+    SiteHistograms histograms;
+    Ring* next{nullptr};
+};
+
+const char* const kOperandNames[] = {"lhs", "rhs", "result"};
+
+std::atomic<Ring*> rings{nullptr};
+thread_local Ring* current_ring = nullptr;
+
+int64_t SignExtend(uint64_t value, uint32_t bits) {
+    if (bits >= 64) {
+        return static_cast<int64_t>(value);
+    }
+    uint64_t sign = 1ull << (bits - 1);
+    return static_cast<int64_t>((value ^ sign) - sign);
+}
+
+double ToDouble(uint64_t value, uint32_t bits) {
+    if (bits == 32) {
+        float float_value;
+        uint32_t float_bits = static_cast<uint32_t>(value);
+        memcpy(&float_value, &float_bits, sizeof(float_value));
+        return float_value;
+    }
+    double double_value;
+    memcpy(&double_value, &value, sizeof(double_value));
+    return double_value;
+}
+
+void AddValue(OperandHistogram& histogram, uint64_t value, uint32_t attributes) {
+    uint32_t bits = attributes & kOperandBitsMask;
+    if ((attributes & kFloatOperands) != 0) {
+        double float_value = ToDouble(value, bits);
+        int exponent = 0;
+        double mantissa = std::frexp(std::fabs(float_value), &exponent);
+        histogram.zeros += float_value == 0.0 ? 1 : 0;
+        histogram.ones += float_value == 1.0 ? 1 : 0;
+        histogram.powers_of_two += mantissa == 0.5 ? 1 : 0;
+        histogram.min_float = std::min(histogram.min_float, float_value);
+        histogram.max_float = std::max(histogram.max_float, float_value);
+        return;
+    }
+
+    int64_t signed_value = SignExtend(value, bits);
+    uint64_t magnitude = signed_value < 0 ? 0 - static_cast<uint64_t>(signed_value) : value;
+    histogram.zeros += value == 0 ? 1 : 0;
+    histogram.ones += value == 1 ? 1 : 0;
+    histogram.powers_of_two += value != 0 && (value & (value - 1)) == 0 ? 1 : 0;
+    histogram.min = std::min(histogram.min, signed_value);
+    histogram.max = std::max(histogram.max, signed_value);
+    histogram.magnitudes[magnitude == 0 ? 0 : 64 - __builtin_clzll(magnitude)]++;
+}
+
+/* Runs on the ring's thread, or at exit */
+void Drain(Ring& ring) {
+    SiteHistograms& histograms = ring.histograms;
+    for (uint32_t i = 0; i < ring.head; i++) {
+        const Record& record = ring.records[i];
+        SiteHistogram& histogram = histograms[record.site];
+        histogram.executions++;
+        AddValue(histogram.operands[0], record.lhs, record.site->attributes);
+        AddValue(histogram.operands[1], record.rhs, record.site->attributes);
+        AddValue(histogram.operands[2], record.result, record.site->attributes);
+    }
+    ring.head = 0;
+}
+
+void Merge(OperandHistogram& into, const OperandHistogram& from) {
+    into.zeros += from.zeros;
+    into.ones += from.ones;
+    into.powers_of_two += from.powers_of_two;
+    into.min = std::min(into.min, from.min);
+    into.max = std::max(into.max, from.max);
+    into.min_float = std::min(into.min_float, from.min_float);
+    into.max_float = std::max(into.max_float, from.max_float);
+    for (uint32_t bucket = 0; bucket < kMagnitudeBuckets; bucket++) {
+        into.magnitudes[bucket] += from.magnitudes[bucket];
+    }
+}
+
+double Percent(uint64_t count, uint64_t total) {
+    return 100.0 * static_cast<double>(count) / static_cast<double>(total);
+}
+
+/* Smallest of 8/16/32 bits that holds the operand's whole range, 0 if none is smaller than the type */
+uint32_t NarrowBits(const OperandHistogram& histogram, uint32_t bits) {
+    for (uint32_t narrow : {8u, 16u, 32u}) {
+        int64_t limit = 1ll << (narrow - 1);
+        if (narrow < bits && histogram.min >= -limit && histogram.max < limit) {
+            return narrow;
+        }
+    }
+    return 0;
+}
+
+void WriteHints(FILE* file, const SiteInfo& site, const SiteHistogram& histogram) {
+    const OperandHistogram& rhs = histogram.operands[1];
+    uint64_t executions = histogram.executions;
+    std::string opcode{site.text, strcspn(site.text, " ")};
+    bool is_float = (site.attributes & kFloatOperands) != 0;
+
+    if (!is_float && (opcode == "mul" || opcode == "udiv" || opcode == "sdiv" || opcode == "urem") &&
+        Percent(rhs.powers_of_two, executions) >= 95.0) {
+        fprintf(file, "    hint: rhs is a power of two in %.1f%% of the executions, a shift or mask would do\n",
+                Percent(rhs.powers_of_two, executions));
+    }
+    if (opcode == "mul" || opcode == "fmul" || opcode == "udiv" || opcode == "sdiv" || opcode == "fdiv") {
+        uint64_t identities = rhs.ones + (opcode == "mul" || opcode == "fmul" ? histogram.operands[0].ones : 0);
+        if (Percent(identities, executions) >= 50.0) {
+            fprintf(file, "    hint: an operand is one in %.1f%% of the executions, specialize the identity\n",
+                    Percent(identities, executions));
+        }
+    }
+    if (Percent(histogram.operands[2].zeros, executions) >= 50.0) {
+        fprintf(file, "    hint: the result is zero in %.1f%% of the executions\n",
+                Percent(histogram.operands[2].zeros, executions));
+    }
+    if (!is_float) {
+        uint32_t bits = site.attributes & kOperandBitsMask;
+        uint32_t narrow = 0;
+        for (const OperandHistogram& operand : histogram.operands) {
+            uint32_t operand_bits = NarrowBits(operand, bits);
+            narrow = operand_bits == 0 ? bits : std::max(narrow, operand_bits);
+        }
+        if (narrow < bits) {
+            fprintf(file, "    hint: all the values fit in i%u\n", narrow);
+        }
+    }
+}
+
+void WriteBinaryOpReport() {
+    SiteHistograms histograms;
+    for (Ring* ring = rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+        Drain(*ring);
+        for (const auto& site : ring->histograms) {
+            SiteHistogram& histogram = histograms[site.first];
+            histogram.executions += site.second.executions;
+            for (uint32_t operand = 0; operand < 3; operand++) {
+                Merge(histogram.operands[operand], site.second.operands[operand]);
+            }
+        }
+    }
+
+    std::vector<std::pair<const SiteInfo*, const SiteHistogram*>> sites;
+    for (const auto& site : histograms) {
+        sites.emplace_back(site.first, &site.second);
+    }
+    if (sites.empty()) {
+        return;
+    }
+    std::sort(sites.begin(), sites.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second->executions != rhs.second->executions ? lhs.second->executions > rhs.second->executions
+                                                                  : lhs.first->id < rhs.first->id;
+    });
+
+    FILE* file = fopen(OutputPath("binops.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+
+    fprintf(file, "# Binary operator value profile, sites are the node ids of dump.dot\n");
+    fprintf(file, "# Magnitudes: <bits of |value|>:<share>, 0 bits is zero\n");
+    for (const auto& site : sites) {
+        const SiteInfo& info = *site.first;
+        const SiteHistogram& histogram = *site.second;
+        bool is_float = (info.attributes & kFloatOperands) != 0;
+
+        fprintf(file, "node_%" PRIu64 " %s %s", info.id, info.function, info.text);
+        if (info.file != nullptr) {
+            fprintf(file, " %s:%u", info.file, info.line);
+        }
+        fprintf(file, " executions %" PRIu64 "\n", histogram.executions);
+
+        for (uint32_t operand = 0; operand < 3; operand++) {
+            const OperandHistogram& values = histogram.operands[operand];
+            fprintf(file, "    %-6s zero %6.2f%%  one %6.2f%%  pow2 %6.2f%%", kOperandNames[operand],
+                    Percent(values.zeros, histogram.executions), Percent(values.ones, histogram.executions),
+                    Percent(values.powers_of_two, histogram.executions));
+            if (is_float) {
+                fprintf(file, "  range [%g, %g]\n", values.min_float, values.max_float);
+                continue;
+            }
+            fprintf(file, "  range [%" PRId64 ", %" PRId64 "]  magnitudes", values.min, values.max);
+            for (uint32_t bucket = 0; bucket < kMagnitudeBuckets; bucket++) {
+                if (values.magnitudes[bucket] != 0) {
+                    fprintf(file, " %u:%.1f%%", bucket, Percent(values.magnitudes[bucket], histogram.executions));
+                }
+            }
+            fprintf(file, "\n");
+        }
+        WriteHints(file, info, histogram);
+    }
+    fclose(file);
+}
+
+/* Writes nothing when no thread ever ran the hook */
+const bool registered = (OnExit(WriteBinaryOpReport), true);
+
+Ring* CreateRing() {
+    auto* ring = new Ring();
+    Ring* head = rings.load(std::memory_order_relaxed);
+    do {
+        ring->next = head;
+    } while (!rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+    return ring;
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfileBinaryOp__(const visual_dump::SiteInfo* site, uint64_t lhs, uint64_t rhs, uint64_t result) {
+    using namespace visual_dump;
+
+    Ring* ring = current_ring;
+    if (ring == nullptr) {
+        ring = current_ring = CreateRing();
+    }
+
+    ring->records[ring->head++] = Record{site, lhs, rhs, result};
+    if (ring->head == kRingSize) {
+        Drain(*ring);
+    }
+}
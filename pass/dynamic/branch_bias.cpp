@@ -0,0 +1,119 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct BranchSite {
+    const std::string* function;
+    uint64_t node_id;
+    uint64_t line;
+    uint64_t flags;
+    uint64_t taken;
+    uint64_t not_taken;
+    uint64_t transitions;
+
+    uint64_t Executions() const {
+        return taken + not_taken;
+    }
+
+    /*
+     * A predictor that follows the last direction misses at every change,
+     * one that always guesses the majority misses the minority. Real ones
+     * are at least as good as the better of the two, history based ones
+     * also learn regular patterns like alternation, so this is an upper
+     * bound for those.
+     */
+    uint64_t Mispredictions() const {
+        return std::min(transitions, std::min(taken, not_taken));
+    }
+
+    /* Changes direction far more often than a random branch with the same bias, 2p(1-p) per execution */
+    bool IsRegular() const {
+        double p = static_cast<double>(taken) / static_cast<double>(Executions());
+        return static_cast<double>(transitions) > 1.5 * 2.0 * p * (1.0 - p) * static_cast<double>(Executions());
+    }
+};
+
+double Percent(uint64_t count, uint64_t total) {
+    return total != 0 ? 100.0 * static_cast<double>(count) / static_cast<double>(total) : 0.0;
+}
+
+} /* namespace */
+
+/*
+ * branches.txt ranks the conditional branches by estimated mispredictions,
+ * branches.overlay labels their terminators in dump.dot.
+ */
+void WriteBranchBias(const MergedTables& tables) {
+    std::vector<BranchSite> sites;
+    for (const auto& record : tables) {
+        if (std::get<0>(record.first) != static_cast<uint32_t>(CounterKind::BranchBias)) {
+            continue;
+        }
+        const std::vector<uint64_t>& counters = record.second.counters;
+        for (size_t site = 0; site < counters.size() / kBranchBiasSiteSize; site++) {
+            const uint64_t* values = &counters[site * kBranchBiasSiteSize];
+            const uint64_t* aux = &record.second.aux[site * kBranchBiasAuxSize];
+            if (values[0] + values[1] != 0) {
+                sites.push_back(BranchSite{&std::get<1>(record.first), aux[0], aux[1], aux[2], values[0], values[1],
+                                           values[2]});
+            }
+        }
+    }
+    if (sites.empty()) {
+        return;
+    }
+    std::stable_sort(sites.begin(), sites.end(), [](const BranchSite& lhs, const BranchSite& rhs) {
+        return lhs.Mispredictions() > rhs.Mispredictions();
+    });
+
+    FILE* report = fopen(OutputPath("branches.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("branches.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    long top = GetEnvLong("VISUAL_DUMP_TOP_BRANCHES", 50);
+    fprintf(report, "# Conditional branches ranked by estimated mispredictions\n");
+    fprintf(report, "# Estimate: min(direction changes, minority direction), history based predictors do better on\n");
+    fprintf(report, "# regular patterns, marked \"regular\" when the changes are far above those of a random branch.\n");
+    fprintf(report, "# \"select\" marks small side effect free arms that if-conversion can take\n");
+    fprintf(report, "%12s %7s %12s %7s %12s  %s\n", "mispredicts", "rate", "executions", "taken", "changes",
+            "function node [line]");
+    for (size_t i = 0; i < sites.size(); i++) {
+        const BranchSite& site = sites[i];
+        double rate = Percent(site.Mispredictions(), site.Executions());
+        if (static_cast<long>(i) < top) {
+            fprintf(report, "%12" PRIu64 " %6.2f%% %12" PRIu64 " %6.2f%% %12" PRIu64 "  %s node_%" PRIu64,
+                    site.Mispredictions(), rate, site.Executions(), Percent(site.taken, site.Executions()),
+                    site.transitions, site.function->c_str(), site.node_id);
+            if (site.line != 0) {
+                fprintf(report, " line %" PRIu64, site.line);
+            }
+            fputs(site.IsRegular() ? " regular" : "", report);
+            fputs((site.flags & kBranchSelectCandidate) != 0 ? " select\n" : "\n", report);
+        }
+
+        const char* color = rate >= 10.0 ? " color=\"#cc0000\" penwidth=3" : rate >= 2.0 ? " color=\"#e69138\"" : "";
+        fprintf(overlay, "node_%" PRIu64 " xlabel=\"taken %.1f%%, mispredicts ~%.1f%%\"%s\n", site.node_id,
+                Percent(site.taken, site.Executions()), rate, color);
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+} /* namespace visual_dump */
@@ -0,0 +1,473 @@
+#include <call_stacks.hpp>
+#include <dot_builder.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+/*
+ * Number of consecutive frames of a directly recursive function that get
+ * their own context. Deeper frames are folded into the last one, so that
+ * fact(20) shows up as "main;fact" instead of twenty nested fact frames.
+ * Zero disables folding.
+ */
+long RecursionDepth() {
+    static const long recursion_depth = GetEnvLong("VISUAL_DUMP_RECURSION_DEPTH", 1);
+    return recursion_depth;
+}
+
+constexpr int kCalibrationRounds = 7;
+
+/*
+ * Cost of one probe pair, the entry and exit hooks of a call, measured at
+ * startup. inside_ns is the part a frame times itself, between the clock
+ * reads of its own hooks, pair_ns the whole pair its caller sees. noise_ns
+ * is the spread of single pairs, scaled median absolute deviation.
+ */
+struct ProbeCost {
+    double inside_ns;
+    double pair_ns;
+    double noise_ns;
+};
+
+struct MergedNode {
+    std::string func;
+    uint32_t parent;
+    uint64_t calls;
+    uint64_t folded_calls;
+    uint64_t child_calls; /* Calls of the direct children, their probes run in this node's self time */
+    uint64_t inclusive_ns;
+    uint64_t children_ns;
+    uint64_t overhead_ns; /* Probe cost removed from the self time */
+    std::map<std::string, uint32_t> children;
+};
+
+void EnterFrame(ThreadState* thread, const char* func, uint64_t func_id) {
+    StackFrame* parent = thread->stack.Top();
+    StackFrame* frame = thread->stack.Push(func, func_id);
+    if (frame == nullptr) {
+        return;
+    }
+
+    bool recursive = parent != nullptr && parent->func == func;
+    frame->recursion = recursive ? parent->recursion + 1 : 1;
+    long recursion_depth = RecursionDepth();
+    frame->folded = recursive && recursion_depth > 0 && parent->recursion >= recursion_depth;
+    if (frame->folded) {
+        frame->node = parent->node;
+        frame->recursion = parent->recursion;
+    } else {
+        uint32_t parent_node = parent != nullptr ? parent->node : CallingContextTree::kRoot;
+        frame->node = thread->tree.Child(parent_node, func, func_id);
+    }
+    frame->untimed_ns = 0;
+    frame->enter_ns = NowNs();
+}
+
+void LeaveFrame(ThreadState* thread, const char* func) {
+    uint64_t now = NowNs();
+
+    /* Frames beyond the stack capacity are only counted */
+    StackFrame* top = thread->stack.Top();
+    if (top == nullptr) {
+        thread->stack.Pop();
+        return;
+    }
+
+    /* Frames skipped by unwinding are dropped without being accounted */
+    if (top->func != func && !thread->stack.UnwindTo(func)) {
+        return;
+    }
+
+    StackFrame* frame = thread->stack.Pop();
+    if (frame == nullptr) {
+        return;
+    }
+
+    /* The caller's clock reads enclose the untimed work too */
+    StackFrame* parent = thread->stack.Top();
+    if (parent != nullptr) {
+        parent->untimed_ns += frame->untimed_ns;
+    }
+
+    ContextNode& node = thread->tree.Node(frame->node);
+    uint64_t elapsed_ns = now - frame->enter_ns;
+    uint64_t inclusive_ns = frame->folded ? 0 : elapsed_ns - std::min(elapsed_ns, frame->untimed_ns);
+    node.calls++;
+    node.folded_calls += frame->folded ? 1 : 0;
+    node.inclusive_ns += inclusive_ns;
+    if (WindowCountersEnabled()) {
+        thread->window.Record(func, inclusive_ns);
+    }
+    if (TimelineCapacity() != 0) {
+        thread->timeline.Record(func, frame->enter_ns, now, thread->stack.Depth(), TimelineCapacity());
+    }
+}
+
+void ExcludeTime(ThreadState* thread, uint64_t start_ns) {
+    StackFrame* top = thread->stack.Top();
+    if (top != nullptr) {
+        top->untimed_ns += NowNs() - start_ns;
+    }
+}
+
+/*
+ * What the hooks of one call leave in the time of its caller, LogFunctionCall__,
+ * LogFuncEntry__ and LogFuncRet__ of logger.cpp without the excluded work
+ */
+void ProbePair(ThreadState* thread, const char* func) {
+    CurrentThread();
+    Mode();
+    ExcludeTime(thread, NowNs());
+
+    CurrentThread();
+    Mode();
+    EnterFrame(thread, func, 0);
+    ExcludeTime(thread, NowNs());
+
+    CurrentThread();
+    Mode();
+    ExcludeTime(thread, NowNs());
+    LeaveFrame(thread, func);
+    ExcludeTime(thread, NowNs());
+}
+
+double Median(std::vector<double> values) {
+    std::nth_element(values.begin(), values.begin() + static_cast<long>(values.size() / 2), values.end());
+    return values[values.size() / 2];
+}
+
+/*
+ * Times empty calls on a private thread state, VISUAL_DUMP_CALIBRATION_CALLS
+ * per round, the median round is the cost. Zero disables the compensation.
+ * The trace output and the counter reads are not part of the probe: their
+ * cost depends on where stdout goes and on the counters, the hooks time
+ * them on every call and leave them out of the frames instead.
+ */
+ProbeCost Calibrate() {
+    ProbeCost cost{0.0, 0.0, 0.0};
+    long calls = GetEnvLong("VISUAL_DUMP_CALIBRATION_CALLS", 10000);
+    if (calls <= 0 || Mode() != RuntimeMode::Trace) {
+        return cost;
+    }
+
+    /* The calls have a caller, like in a program the excluded time is taken off its frame */
+    const char* func = "<calibration>";
+    std::unique_ptr<ThreadState> scratch(new ThreadState());
+    EnterFrame(scratch.get(), "<calibration caller>", 0);
+    StackFrame* caller = scratch->stack.Top();
+    ContextNode& node = scratch->tree.Node(scratch->tree.Child(caller->node, func, 0));
+    std::vector<double> inside_ns;
+    std::vector<double> pair_ns;
+    for (int round = 0; round < kCalibrationRounds; round++) {
+        uint64_t inside_before = node.inclusive_ns;
+        uint64_t untimed_before = caller->untimed_ns;
+        uint64_t start = NowNs();
+        for (long i = 0; i < calls; i++) {
+            ProbePair(scratch.get(), func);
+        }
+        uint64_t elapsed = NowNs() - start - (caller->untimed_ns - untimed_before);
+        inside_ns.push_back(static_cast<double>(node.inclusive_ns - inside_before) / static_cast<double>(calls));
+        pair_ns.push_back(static_cast<double>(elapsed) / static_cast<double>(calls));
+    }
+
+    /* Single pairs also carry a clock read, which shifts them but not their deviation */
+    std::vector<double> single_ns;
+    for (long i = 0; i < calls; i++) {
+        uint64_t untimed_before = caller->untimed_ns;
+        uint64_t start = NowNs();
+        ProbePair(scratch.get(), func);
+        single_ns.push_back(static_cast<double>(NowNs() - start - (caller->untimed_ns - untimed_before)));
+    }
+    double median = Median(single_ns);
+    for (double& value : single_ns) {
+        value = std::fabs(value - median);
+    }
+
+    cost.inside_ns = Median(inside_ns);
+    cost.pair_ns = Median(pair_ns);
+    cost.noise_ns = 1.4826 * Median(single_ns);
+    return cost;
+}
+
+/* Calibrated by the first call, before any frame is timed */
+const ProbeCost& Probe() {
+    static const ProbeCost cost = Calibrate();
+    return cost;
+}
+
+/* What is left of the self time after compensation is within three deviations of the probes it contained */
+bool IsProbeBound(uint64_t calls, uint64_t child_calls, uint64_t self_ns) {
+    double probes = static_cast<double>(calls + child_calls);
+    return Probe().noise_ns > 0.0 && static_cast<double>(self_ns) < 3.0 * Probe().noise_ns * std::sqrt(probes);
+}
+
+/* Threads are merged by function names, the same inline function has a name per module. Only one if given */
+std::vector<MergedNode> MergeThreads(const ThreadState* only = nullptr) {
+    std::vector<MergedNode> merged(1, MergedNode{"<root>", 0, 0, 0, 0, 0, 0, 0, {}});
+
+    for (ThreadState* thread = FirstThread(); thread != nullptr; thread = thread->next) {
+        if (only != nullptr && thread != only) {
+            continue;
+        }
+        const CallingContextTree& tree = thread->tree;
+        std::vector<uint32_t> to_merged(tree.Size(), 0);
+
+        /* Children are always created after their parents */
+        for (uint32_t idx = 1; idx < tree.Size(); idx++) {
+            const ContextNode& node = tree.Node(idx);
+            uint32_t parent = to_merged[node.parent];
+
+            auto child = merged[parent].children.find(node.func);
+            uint32_t merged_idx = 0;
+            if (child == merged[parent].children.end()) {
+                merged_idx = static_cast<uint32_t>(merged.size());
+                merged[parent].children.emplace(node.func, merged_idx);
+                merged.push_back(MergedNode{node.func, parent, 0, 0, 0, 0, 0, 0, {}});
+            } else {
+                merged_idx = child->second;
+            }
+
+            merged[merged_idx].calls += node.calls;
+            merged[merged_idx].folded_calls += node.folded_calls;
+            merged[merged_idx].inclusive_ns += node.inclusive_ns;
+            merged[parent].child_calls += node.calls;
+            to_merged[idx] = merged_idx;
+        }
+    }
+
+    return merged;
+}
+
+uint64_t SelfTime(const MergedNode& node) {
+    return node.inclusive_ns > node.children_ns ? node.inclusive_ns - node.children_ns : 0;
+}
+
+/*
+ * Subtracts the probes from the times: a frame contains the inside part of
+ * its own probes and every probe pair of the calls below it, folded
+ * recursive calls included.
+ */
+void Compensate(std::vector<MergedNode>& merged) {
+    std::vector<uint64_t> raw_self(merged.size(), 0);
+    std::vector<uint64_t> descendant_calls(merged.size(), 0);
+    for (size_t idx = merged.size() - 1; idx >= 1; idx--) {
+        MergedNode& node = merged[idx];
+        merged[node.parent].children_ns += node.inclusive_ns;
+        descendant_calls[node.parent] += node.calls + descendant_calls[idx];
+    }
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        raw_self[idx] = SelfTime(merged[idx]);
+    }
+
+    const ProbeCost& probe = Probe();
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        MergedNode& node = merged[idx];
+        double overhead = static_cast<double>(node.calls - node.folded_calls) * probe.inside_ns +
+                          static_cast<double>(node.folded_calls + descendant_calls[idx]) * probe.pair_ns;
+        node.inclusive_ns -= std::min(node.inclusive_ns, static_cast<uint64_t>(overhead));
+        node.children_ns = 0;
+    }
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        merged[merged[idx].parent].children_ns += merged[idx].inclusive_ns;
+    }
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        merged[idx].overhead_ns = raw_self[idx] - std::min(raw_self[idx], SelfTime(merged[idx]));
+    }
+}
+
+/* Brendan Gregg's folded format: "main;fact;printf 1234" per unique stack */
+void WriteFoldedStacks(const std::vector<MergedNode>& merged) {
+    FILE* time_file = fopen(OutputPath("stacks.folded").c_str(), "w");
+    FILE* calls_file = fopen(OutputPath("stacks.calls.folded").c_str(), "w");
+
+    std::vector<std::string> paths(merged.size());
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        const MergedNode& node = merged[idx];
+        paths[idx] = node.parent == 0 ? node.func : paths[node.parent] + ";" + node.func;
+
+        if (time_file != nullptr && SelfTime(node) != 0) {
+            fprintf(time_file, "%s %lu\n", paths[idx].c_str(), SelfTime(node));
+        }
+        if (calls_file != nullptr && node.calls != 0) {
+            fprintf(calls_file, "%s %lu\n", paths[idx].c_str(), node.calls);
+        }
+    }
+
+    if (time_file != nullptr) {
+        fclose(time_file);
+    }
+    if (calls_file != nullptr) {
+        fclose(calls_file);
+    }
+}
+
+/* stacks.threads.folded: the tree of every thread on its own, rooted at "T<index>" like the trace log of the process */
+void WriteThreadStacks() {
+    FILE* file = fopen(OutputPath("stacks.threads.folded").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    for (ThreadState* thread = FirstThread(); thread != nullptr; thread = thread->next) {
+        std::vector<MergedNode> merged = MergeThreads(thread);
+        Compensate(merged);
+
+        std::vector<std::string> paths(merged.size(), "T" + std::to_string(thread->index));
+        for (size_t idx = 1; idx < merged.size(); idx++) {
+            const MergedNode& node = merged[idx];
+            paths[idx] = paths[node.parent] + ";" + node.func;
+            if (SelfTime(node) != 0) {
+                fprintf(file, "%s %lu\n", paths[idx].c_str(), SelfTime(node));
+            }
+        }
+    }
+    fclose(file);
+}
+
+void WriteContextTree(const std::vector<MergedNode>& merged) {
+    DotBuilder dot_builder(OutputPath("cct.dot"));
+    dot_builder.BeginGraph("CCT");
+    dot_builder.AddAttribute("shape=rect", AttributeType::Node);
+
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        const MergedNode& node = merged[idx];
+        char stats[128];
+        snprintf(stats, sizeof(stats), "\\ncalls: %lu\\ntotal: %.3f ms\\nself: %.3f ms",
+                 node.calls, static_cast<double>(node.inclusive_ns) / 1e6,
+                 static_cast<double>(SelfTime(node)) / 1e6);
+
+        dot_builder.CreateNode(std::to_string(idx));
+        if (IsProbeBound(node.calls, node.child_calls, SelfTime(node))) {
+            dot_builder.AddLabel("label=\"" + node.func + stats + "\\n~probe overhead\" style=dashed");
+        } else {
+            dot_builder.AddLabel("label=\"" + node.func + stats + "\"");
+        }
+        if (node.parent != 0) {
+            dot_builder.CreateEdge(std::to_string(node.parent), std::to_string(idx), EdgeType::NodeToNode);
+        }
+    }
+
+    dot_builder.EndGraph();
+}
+
+/*
+ * Dynamic call graph for tools/function_order:
+ *   function <name> <calls> <self ns>
+ *   edge <caller> <callee> <calls>
+ */
+void WriteCallGraph(const std::vector<MergedNode>& merged) {
+    std::map<std::string, std::pair<uint64_t, uint64_t>> functions;
+    std::map<std::pair<std::string, std::string>, uint64_t> edges;
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        const MergedNode& node = merged[idx];
+        functions[node.func].first += node.calls;
+        functions[node.func].second += SelfTime(node);
+        if (node.parent != 0) {
+            edges[std::make_pair(merged[node.parent].func, node.func)] += node.calls;
+        }
+    }
+
+    FILE* file = fopen(OutputPath("callgraph.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    for (const auto& function : functions) {
+        fprintf(file, "function %s %lu %lu\n", function.first.c_str(), function.second.first,
+                function.second.second);
+    }
+    for (const auto& edge : edges) {
+        fprintf(file, "edge %s %s %lu\n", edge.first.first.c_str(), edge.first.second.c_str(), edge.second);
+    }
+    fclose(file);
+}
+
+/*
+ * overhead.txt: the calibration and the probe cost removed per function,
+ * "probe-bound" functions are too short to time with these hooks.
+ */
+void WriteOverhead(const std::vector<MergedNode>& merged) {
+    struct Function {
+        uint64_t calls;
+        uint64_t child_calls;
+        uint64_t self_ns;
+        uint64_t overhead_ns;
+    };
+    std::map<std::string, Function> functions;
+    for (size_t idx = 1; idx < merged.size(); idx++) {
+        Function& function = functions[merged[idx].func];
+        function.calls += merged[idx].calls;
+        function.child_calls += merged[idx].child_calls;
+        function.self_ns += SelfTime(merged[idx]);
+        function.overhead_ns += merged[idx].overhead_ns;
+    }
+
+    FILE* file = fopen(OutputPath("overhead.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    const ProbeCost& probe = Probe();
+    fprintf(file, "# Probe pair %.1f ns, %.1f ns of it inside the timed frame, noise %.1f ns\n", probe.pair_ns,
+            probe.inside_ns, probe.noise_ns);
+    fprintf(file, "# Times in stacks.folded, cct.dot and callgraph.txt have the probes removed\n");
+    fprintf(file, "%12s %14s %14s %10s  %s\n", "calls", "self ns", "removed ns", "ns/call", "function");
+    for (const auto& function : functions) {
+        const Function& counts = function.second;
+        fprintf(file, "%12lu %14lu %14lu %10.1f  %s%s\n", counts.calls, counts.self_ns, counts.overhead_ns,
+                static_cast<double>(counts.self_ns) / static_cast<double>(std::max<uint64_t>(counts.calls, 1)),
+                function.first.c_str(),
+                IsProbeBound(counts.calls, counts.child_calls, counts.self_ns) ? " probe-bound" : "");
+    }
+    fclose(file);
+}
+
+void WriteCallStacks() {
+    std::vector<MergedNode> merged = MergeThreads();
+    if (merged.size() > 1) {
+        Compensate(merged);
+        WriteFoldedStacks(merged);
+        WriteThreadStacks();
+        WriteContextTree(merged);
+        WriteCallGraph(merged);
+        if (Probe().pair_ns > 0.0) {
+            WriteOverhead(merged);
+        }
+    }
+}
+
+const bool registered = (OnExit(WriteCallStacks), true);
+
+} /* namespace */
+
+void EnterFunction(ThreadState* thread, const char* func, uint64_t func_id) {
+    Probe();
+    EnterFrame(thread, func, func_id);
+}
+
+void LeaveFunction(ThreadState* thread, const char* func) {
+    LeaveFrame(thread, func);
+}
+
+void ExcludeHookTime(ThreadState* thread, uint64_t start_ns) {
+    ExcludeTime(thread, start_ns);
+}
+
+std::map<std::string, uint64_t> FunctionSelfTimes() {
+    std::map<std::string, uint64_t> self_times;
+    std::vector<MergedNode> merged = MergeThreads();
+    if (merged.size() > 1) {
+        Compensate(merged);
+        for (size_t idx = 1; idx < merged.size(); idx++) {
+            self_times[merged[idx].func] += SelfTime(merged[idx]);
+        }
+    }
+    return self_times;
+}
+
+} /* namespace visual_dump */
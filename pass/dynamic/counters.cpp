@@ -0,0 +1,234 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+/*
+ * Registration runs from module constructors, before this file's statics
+ * may be initialized, and the tables are written from atexit, after the
+ * static destructors may have run. So the list is created on demand and
+ * never destroyed.
+ */
+std::vector<const CounterTable*>& Tables() {
+    static auto* tables = new std::vector<const CounterTable*>();
+    return *tables;
+}
+
+/* The SourceLines table of the module of every LineCounts table */
+std::map<const CounterTable*, const SourceLine*>& ModuleLines() {
+    static auto* lines = new std::map<const CounterTable*, const SourceLine*>();
+    return *lines;
+}
+
+std::mutex& TablesMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::string Symbolize(const std::map<uint64_t, std::string>& functions, uint64_t address) {
+    auto function = functions.find(address);
+    if (function != functions.end()) {
+        return function->second;
+    }
+
+    /* Not registered by any instrumented module, try the dynamic symbols */
+    Dl_info info{};
+    if (dladdr(reinterpret_cast<void*>(address), &info) != 0 && info.dli_sname != nullptr &&
+        info.dli_saddr == reinterpret_cast<void*>(address)) {
+        return info.dli_sname;
+    }
+    return "?";
+}
+
+/* Targets of the same site from several modules are merged by name, the top ones are kept */
+void MergeIndirectCalls(const CounterTable* table, MergedTable& merged,
+                        const std::map<uint64_t, std::string>& functions) {
+    uint32_t sites_num = table->num_counters / kIndirectCallSiteSize;
+    merged.targets.resize(sites_num);
+
+    const uint64_t* sites = static_cast<const uint64_t*>(table->counters);
+    for (uint32_t site = 0; site < sites_num; site++) {
+        const uint64_t* values = &sites[site * kIndirectCallSiteSize];
+        merged.counters[site * kIndirectCallSiteSize] += values[0];
+        for (uint32_t i = 0; i < kIndirectCallTargets; i++) {
+            if (values[1 + 2 * i] != 0) {
+                merged.targets[site][Symbolize(functions, values[1 + 2 * i])] += values[2 + 2 * i];
+            }
+        }
+    }
+
+    for (uint32_t site = 0; site < sites_num; site++) {
+        std::vector<std::pair<std::string, uint64_t>> targets(merged.targets[site].begin(),
+                                                               merged.targets[site].end());
+        std::stable_sort(targets.begin(), targets.end(), [](const std::pair<std::string, uint64_t>& lhs,
+                                                            const std::pair<std::string, uint64_t>& rhs) {
+            return lhs.second > rhs.second;
+        });
+
+        for (uint32_t i = 0; i < kIndirectCallTargets; i++) {
+            uint32_t idx = site * kIndirectCallSiteSize + 1 + 2 * i;
+            merged.symbols[idx] = i < targets.size() ? targets[i].first : "";
+            merged.counters[idx + 1] = i < targets.size() ? targets[i].second : 0;
+        }
+    }
+}
+
+/* The max and ~min trips of a loop merge by max, everything else adds up */
+void MergeLoopTrips(const uint64_t* values, uint32_t num_counters, MergedTable& merged) {
+    for (uint32_t i = 0; i < num_counters; i++) {
+        uint32_t field = i % kLoopSiteSize;
+        if (field == 3 || field == 4) {
+            merged.counters[i] = std::max(merged.counters[i], values[i]);
+        } else {
+            merged.counters[i] += values[i];
+        }
+    }
+}
+
+void WriteCounters() {
+    MergedTables merged;
+
+    std::lock_guard<std::mutex> lock(TablesMutex());
+    std::map<uint64_t, std::string> functions;
+    for (const CounterTable* table : Tables()) {
+        if (table->kind == static_cast<uint32_t>(CounterKind::FunctionAddress)) {
+            functions[reinterpret_cast<uint64_t>(table->counters)] = table->function;
+        }
+    }
+
+    for (const CounterTable* table : Tables()) {
+        if (table->kind == static_cast<uint32_t>(CounterKind::FunctionAddress) ||
+            table->kind == static_cast<uint32_t>(CounterKind::SourceLines)) {
+            continue;
+        }
+
+        MergedTable& merged_table = merged[CounterKey(table->kind, table->function, table->hash)];
+        merged_table.counters.resize(table->num_counters, 0);
+        merged_table.symbols.resize(table->num_counters);
+        if (merged_table.aux == nullptr) {
+            merged_table.aux = table->aux;
+            merged_table.num_aux = table->num_aux;
+            auto lines = ModuleLines().find(table);
+            merged_table.lines = lines != ModuleLines().end() ? lines->second : nullptr;
+        }
+
+        if (table->kind == static_cast<uint32_t>(CounterKind::IndirectCalls)) {
+            MergeIndirectCalls(table, merged_table, functions);
+            continue;
+        }
+
+        if (table->kind == static_cast<uint32_t>(CounterKind::Coverage)) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(table->counters);
+            for (uint32_t i = 0; i < table->num_counters; i++) {
+                merged_table.counters[i] |= bytes[i] != 0 ? 1 : 0;
+            }
+            continue;
+        }
+
+        const uint64_t* values = static_cast<const uint64_t*>(table->counters);
+        if (table->kind == static_cast<uint32_t>(CounterKind::LoopTrips)) {
+            MergeLoopTrips(values, table->num_counters, merged_table);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < table->num_counters; i++) {
+            merged_table.counters[i] += values[i];
+        }
+    }
+
+    WriteCoverage(merged);
+    WriteBranchBias(merged);
+    WriteLoopTrips(merged);
+    WriteInstructionMix(merged);
+    WriteLineProfile(merged);
+
+    FILE* file = fopen(OutputPath("visual_dump.prof").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    fprintf(file, "# kind function hash counters...\n");
+    for (const auto& record : merged) {
+        const MergedTable& table = record.second;
+        fprintf(file, "%u %s %" PRIx64 " %zu", std::get<0>(record.first), std::get<1>(record.first).c_str(),
+                std::get<2>(record.first), table.counters.size());
+        for (size_t i = 0; i < table.counters.size(); i++) {
+            if (!table.symbols[i].empty()) {
+                fprintf(file, " %s", table.symbols[i].c_str());
+            } else {
+                fprintf(file, " %" PRIu64, table.counters[i]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+/* Forked child: counts from zero, like a process of its own */
+void ResetCounters() {
+    new (&TablesMutex()) std::mutex();
+    for (const CounterTable* table : Tables()) {
+        if (table->kind == static_cast<uint32_t>(CounterKind::FunctionAddress) ||
+            table->kind == static_cast<uint32_t>(CounterKind::SourceLines)) {
+            continue;
+        }
+        size_t width = table->kind == static_cast<uint32_t>(CounterKind::Coverage) ? 1 : sizeof(uint64_t);
+        memset(table->counters, 0, table->num_counters * width);
+    }
+}
+
+} /* namespace */
+
+std::map<std::string, FunctionExecutions> ReadExecutions() {
+    std::map<std::string, FunctionExecutions> executions;
+    std::lock_guard<std::mutex> lock(TablesMutex());
+    for (const CounterTable* table : Tables()) {
+        const uint64_t* values = static_cast<const uint64_t*>(table->counters);
+        if (table->kind == static_cast<uint32_t>(CounterKind::Branches) && table->num_counters != 0) {
+            executions[table->function].entries += values[0];
+        } else if (table->kind == static_cast<uint32_t>(CounterKind::InstructionMix)) {
+            FunctionExecutions& function = executions[table->function];
+            for (uint32_t i = 0; i < table->num_counters; i++) {
+                function.blocks += values[i];
+            }
+        }
+    }
+    return executions;
+}
+
+} /* namespace visual_dump */
+
+extern "C" void RegisterCounters__(const visual_dump::CounterTable* tables, uint64_t num_tables) {
+    using namespace visual_dump;
+
+    std::lock_guard<std::mutex> lock(TablesMutex());
+    if (Tables().empty()) {
+        OnExit(WriteCounters);
+        OnFork(ResetCounters);
+    }
+    const SourceLine* lines = nullptr;
+    for (uint64_t i = 0; i < num_tables; i++) {
+        Tables().push_back(&tables[i]);
+        if (tables[i].kind == static_cast<uint32_t>(CounterKind::SourceLines)) {
+            lines = static_cast<const SourceLine*>(tables[i].counters);
+        }
+    }
+    for (uint64_t i = 0; i < num_tables; i++) {
+        if (tables[i].kind == static_cast<uint32_t>(CounterKind::LineCounts)) {
+            ModuleLines()[&tables[i]] = lines;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace visual_dump {
+
+/*
+ * coverage.txt summarises the blocks per function, coverage.overlay marks
+ * the nodes of the uncovered ones for tools/dot_overlay.
+ */
+void WriteCoverage(const MergedTables& tables) {
+    FILE* summary = nullptr;
+    FILE* overlay = nullptr;
+    uint64_t total_covered = 0;
+    uint64_t total_blocks = 0;
+    for (const auto& record : tables) {
+        if (std::get<0>(record.first) != static_cast<uint32_t>(CounterKind::Coverage)) {
+            continue;
+        }
+        if (summary == nullptr) {
+            summary = fopen(OutputPath("coverage.txt").c_str(), "w");
+            overlay = fopen(OutputPath("coverage.overlay").c_str(), "w");
+            if (summary == nullptr || overlay == nullptr) {
+                break;
+            }
+            fprintf(summary, "# function <name> <covered blocks> <blocks>, then the uncovered blocks by index\n");
+        }
+
+        const std::string& function = std::get<1>(record.first);
+        const std::vector<uint64_t>& blocks = record.second.counters;
+        uint64_t covered = static_cast<uint64_t>(std::count(blocks.begin(), blocks.end(), 1));
+        total_covered += covered;
+        total_blocks += blocks.size();
+        fprintf(summary, "function %s %" PRIu64 " %zu\n", function.c_str(), covered, blocks.size());
+
+        /* Function id, then <instructions, ids...> per block */
+        const uint64_t* aux = record.second.aux;
+        fprintf(overlay, "cluster_%" PRIu64 " label=\"%s %" PRIu64 "/%zu blocks\"\n", aux[0], function.c_str(),
+                covered, blocks.size());
+        const uint64_t* block_ids = aux + 1;
+        for (size_t block = 0; block < blocks.size(); block++) {
+            uint64_t instructions = block_ids[0];
+            if (blocks[block] == 0) {
+                fprintf(summary, "    block %zu node_%" PRIu64 "\n", block, instructions != 0 ? block_ids[1] : 0);
+                for (uint64_t i = 0; i < instructions; i++) {
+                    fprintf(overlay, "node_%" PRIu64 " style=filled fillcolor=\"#f4cccc\"\n", block_ids[1 + i]);
+                }
+            }
+            block_ids += 1 + instructions;
+        }
+    }
+
+    if (summary != nullptr && overlay != nullptr) {
+        fprintf(summary, "total %" PRIu64 " %" PRIu64 "\n", total_covered, total_blocks);
+    }
+    if (summary != nullptr) {
+        fclose(summary);
+    }
+    if (overlay != nullptr) {
+        fclose(overlay);
+    }
+}
+
+} /* namespace visual_dump */
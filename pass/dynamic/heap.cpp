@@ -0,0 +1,229 @@
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kSizeBuckets = 48;
+
+/* Allocations of one site reached through one caller chain */
+struct HeapContext {
+    const SiteInfo* site;
+    std::vector<const char*> chain; /* Outermost first */
+    uint64_t allocations{0};
+    uint64_t frees{0};
+    uint64_t bytes{0};
+    uint64_t live_bytes{0};
+    uint64_t peak_live_bytes{0};
+    uint64_t sizes[kSizeBuckets]{}; /* Bucket b holds sizes in [2^(b-1), 2^b), 0 holds zero */
+};
+
+struct LiveBlock {
+    uint32_t context;
+    uint64_t size;
+};
+
+struct HeapState {
+    std::vector<HeapContext> contexts;
+    std::map<std::pair<const SiteInfo*, std::vector<const char*>>, uint32_t> context_ids;
+    std::unordered_map<uint64_t, LiveBlock> live_blocks;
+    uint64_t live_bytes{0};
+    uint64_t peak_live_bytes{0};
+};
+
+std::mutex& HeapMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+HeapState& Heap() {
+    static auto* heap = new HeapState();
+    return *heap;
+}
+
+double Ratio(uint64_t count, uint64_t total) {
+    return total != 0 ? static_cast<double>(count) / static_cast<double>(total) : 0.0;
+}
+
+std::string ChainName(const HeapContext& context) {
+    std::string name;
+    for (const char* func : context.chain) {
+        name += name.empty() ? func : std::string(";") + func;
+    }
+    return name;
+}
+
+void WriteHints(FILE* file, const HeapContext& context) {
+    if (context.allocations >= 1000) {
+        uint64_t dominant = *std::max_element(std::begin(context.sizes), std::end(context.sizes));
+        double average = Ratio(context.bytes, context.allocations);
+        if (Ratio(dominant, context.allocations) >= 0.9 && Ratio(context.frees, context.allocations) >= 0.9) {
+            fprintf(file, "    hint: short lived blocks of one size class, a fixed size pool or free list fits\n");
+        } else if (average <= 512.0) {
+            fprintf(file, "    hint: many small blocks, an arena freed at once would batch them\n");
+        }
+    }
+    if (context.frees == 0) {
+        fprintf(file, "    hint: never freed before exit, leaked or owned for the whole run\n");
+    }
+}
+
+/*
+ * heap.txt lists the allocation contexts by allocations, heap.folded has
+ * their allocated bytes per stack for flamegraph.pl, heap.overlay labels
+ * the allocating calls in dump.dot.
+ */
+void WriteHeapReport() {
+    std::lock_guard<std::mutex> lock(HeapMutex());
+    const HeapState& heap = Heap();
+    std::vector<const HeapContext*> contexts;
+    for (const HeapContext& context : heap.contexts) {
+        contexts.push_back(&context);
+    }
+    if (contexts.empty()) {
+        return;
+    }
+    std::stable_sort(contexts.begin(), contexts.end(), [](const HeapContext* lhs, const HeapContext* rhs) {
+        return lhs->allocations > rhs->allocations;
+    });
+
+    FILE* report = fopen(OutputPath("heap.txt").c_str(), "w");
+    FILE* folded = fopen(OutputPath("heap.folded").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("heap.overlay").c_str(), "w");
+    if (report == nullptr || folded == nullptr || overlay == nullptr) {
+        for (FILE* file : {report, folded, overlay}) {
+            if (file != nullptr) {
+                fclose(file);
+            }
+        }
+        return;
+    }
+
+    long top = GetEnvLong("VISUAL_DUMP_TOP_ALLOCATIONS", 30);
+    fprintf(report, "# Heap allocation contexts by allocations, frees and live bytes belong to the allocating context\n");
+    fprintf(report, "# Peak live bytes %" PRIu64 ", live at exit %" PRIu64 "\n", heap.peak_live_bytes, heap.live_bytes);
+    fprintf(report, "%12s %14s %10s %14s %14s  %s\n", "allocations", "bytes", "avg size", "peak live", "live at exit",
+            "chain, call");
+    std::map<const SiteInfo*, std::pair<uint64_t, uint64_t>> sites;
+    for (size_t i = 0; i < contexts.size(); i++) {
+        const HeapContext& context = *contexts[i];
+        const SiteInfo& site = *context.site;
+        sites[&site].first += context.allocations;
+        sites[&site].second += context.peak_live_bytes;
+        fprintf(folded, "%s;%s %" PRIu64 "\n", ChainName(context).c_str(), site.text, context.bytes);
+        if (static_cast<long>(i) >= top) {
+            continue;
+        }
+
+        fprintf(report, "%12" PRIu64 " %14" PRIu64 " %10.1f %14" PRIu64 " %14" PRIu64 "  %s node_%" PRIu64 " %s",
+                context.allocations, context.bytes, Ratio(context.bytes, context.allocations),
+                context.peak_live_bytes, context.live_bytes, ChainName(context).c_str(), site.id, site.text);
+        if (site.file != nullptr) {
+            fprintf(report, " %s:%u", site.file, site.line);
+        }
+        fprintf(report, "\n             sizes");
+        for (uint32_t bucket = 0; bucket < kSizeBuckets; bucket++) {
+            if (context.sizes[bucket] != 0) {
+                fprintf(report, " <%" PRIu64 ":%.1f%%", uint64_t{1} << bucket,
+                        100.0 * Ratio(context.sizes[bucket], context.allocations));
+            }
+        }
+        fprintf(report, "\n");
+        WriteHints(report, context);
+    }
+    for (const auto& site : sites) {
+        fprintf(overlay, "node_%" PRIu64 " xlabel=\"allocations %" PRIu64 ", peak live %" PRIu64 " B\"\n",
+                site.first->id, site.second.first, site.second.second);
+    }
+    fclose(report);
+    fclose(folded);
+    fclose(overlay);
+}
+
+/* Caller holds HeapMutex() */
+uint32_t FindContext(HeapState& heap, const SiteInfo* site) {
+    static const long depth = GetEnvLong("VISUAL_DUMP_HEAP_DEPTH", 6);
+
+    /* The innermost frames of the shadow stack, the site's function when the LogCalls hooks are off */
+    const ShadowStack& stack = CurrentThread()->stack;
+    uint32_t stack_depth = stack.Depth();
+    std::vector<const char*> chain;
+    for (uint32_t idx = stack_depth - std::min<uint32_t>(stack_depth, static_cast<uint32_t>(depth)); idx < stack_depth;
+         idx++) {
+        chain.push_back(stack.Frame(idx).func);
+    }
+    if (chain.empty()) {
+        chain.push_back(site->function);
+    }
+
+    auto context = heap.context_ids.emplace(std::make_pair(site, chain), static_cast<uint32_t>(heap.contexts.size()));
+    if (context.second) {
+        if (heap.contexts.empty()) {
+            OnExit(WriteHeapReport);
+        }
+        heap.contexts.push_back(HeapContext{site, chain});
+    }
+    return context.first->second;
+}
+
+/* Caller holds HeapMutex(). Blocks allocated outside the instrumented code are unknown and ignored */
+void Free(HeapState& heap, uint64_t pointer) {
+    auto block = heap.live_blocks.find(pointer);
+    if (block == heap.live_blocks.end()) {
+        return;
+    }
+    HeapContext& context = heap.contexts[block->second.context];
+    context.frees++;
+    context.live_bytes -= block->second.size;
+    heap.live_bytes -= block->second.size;
+    heap.live_blocks.erase(block);
+}
+
+/* Caller holds HeapMutex() */
+void Allocate(HeapState& heap, const SiteInfo* site, uint64_t pointer, uint64_t size) {
+    uint32_t context_id = FindContext(heap, site);
+    HeapContext& context = heap.contexts[context_id];
+    context.allocations++;
+    context.bytes += size;
+    context.live_bytes += size;
+    context.peak_live_bytes = std::max(context.peak_live_bytes, context.live_bytes);
+    context.sizes[std::min<uint32_t>(size == 0 ? 0 : 64 - __builtin_clzll(size), kSizeBuckets - 1)]++;
+
+    heap.live_bytes += size;
+    heap.peak_live_bytes = std::max(heap.peak_live_bytes, heap.live_bytes);
+    heap.live_blocks[pointer] = LiveBlock{context_id, size};
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfileHeap__(const visual_dump::SiteInfo* site, void* old_pointer, void* new_pointer, uint64_t size) {
+    using namespace visual_dump;
+
+    auto op = static_cast<HeapOp>(site->attributes);
+    /* A failed allocation, a failed realloc keeps the old block */
+    if (op != HeapOp::Free && new_pointer == nullptr && (op == HeapOp::Allocate || size != 0)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(HeapMutex());
+    HeapState& heap = Heap();
+    if (old_pointer != nullptr) {
+        Free(heap, reinterpret_cast<uint64_t>(old_pointer));
+    }
+    if (new_pointer != nullptr) {
+        Allocate(heap, site, reinterpret_cast<uint64_t>(new_pointer), size);
+    }
+}
@@ -0,0 +1,34 @@
+#include <profile_data.hpp>
+
+using visual_dump::kIndirectCallTargets;
+
+/*
+ * Site layout: total, then (target, calls) pairs. A new target replaces
+ * the least frequent one once the cache is full (space-saving), so the
+ * dominant targets survive without any allocation in the hook.
+ */
+extern "C" void ProfileIndirectCall__(uint64_t* site, void* target) {
+    uint64_t address = reinterpret_cast<uint64_t>(target);
+    uint64_t* entries = site + 1;
+    site[0]++;
+
+    uint32_t min_entry = 0;
+    for (uint32_t i = 0; i < kIndirectCallTargets; i++) {
+        uint64_t* entry = &entries[2 * i];
+        if (entry[0] == address) {
+            entry[1]++;
+            return;
+        }
+        if (entry[0] == 0) {
+            entry[0] = address;
+            entry[1] = 1;
+            return;
+        }
+        if (entry[1] < entries[2 * min_entry + 1]) {
+            min_entry = i;
+        }
+    }
+
+    entries[2 * min_entry] = address;
+    entries[2 * min_entry + 1]++;
+}
@@ -0,0 +1,114 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+const char* const kClassNames[kInstructionClasses] = {"int", "fp", "load", "store", "branch", "call", "vector"};
+
+struct FunctionMix {
+    const std::string* function;
+    uint64_t executed[kInstructionClasses];
+    uint64_t static_vector_ops;
+
+    uint64_t Total() const {
+        uint64_t total = 0;
+        for (uint64_t count : executed) {
+            total += count;
+        }
+        return total;
+    }
+
+    double Share(uint32_t instruction_class) const {
+        uint64_t total = Total();
+        return total != 0 ? 100.0 * static_cast<double>(executed[instruction_class]) / static_cast<double>(total)
+                          : 0.0;
+    }
+
+    /* Rough, the mix says nothing about cache misses or dependency chains */
+    const char* Bound() const {
+        if (Share(kLoads) + Share(kStores) >= 35.0) {
+            return "memory";
+        }
+        if (Share(kFloatOps) + Share(kVectorOps) >= 30.0) {
+            return "compute";
+        }
+        if (Share(kBranches) >= 25.0) {
+            return "control";
+        }
+        return Share(kIntegerOps) >= 50.0 ? "compute" : "mixed";
+    }
+};
+
+} /* namespace */
+
+/* mix.txt lists the functions by executed instructions with their share per class */
+void WriteInstructionMix(const MergedTables& tables) {
+    std::vector<FunctionMix> functions;
+    FunctionMix total{nullptr, {}, 0};
+    for (const auto& record : tables) {
+        if (std::get<0>(record.first) != static_cast<uint32_t>(CounterKind::InstructionMix)) {
+            continue;
+        }
+        FunctionMix mix{&std::get<1>(record.first), {}, 0};
+        const std::vector<uint64_t>& blocks = record.second.counters;
+        for (size_t block = 0; block < blocks.size(); block++) {
+            const uint64_t* block_mix = &record.second.aux[block * kInstructionClasses];
+            for (uint32_t instruction_class = 0; instruction_class < kInstructionClasses; instruction_class++) {
+                mix.executed[instruction_class] += blocks[block] * block_mix[instruction_class];
+            }
+            mix.static_vector_ops += block_mix[kVectorOps];
+        }
+        if (mix.Total() != 0) {
+            for (uint32_t instruction_class = 0; instruction_class < kInstructionClasses; instruction_class++) {
+                total.executed[instruction_class] += mix.executed[instruction_class];
+            }
+            functions.push_back(mix);
+        }
+    }
+    if (functions.empty()) {
+        return;
+    }
+    std::stable_sort(functions.begin(), functions.end(), [](const FunctionMix& lhs, const FunctionMix& rhs) {
+        return lhs.Total() > rhs.Total();
+    });
+
+    FILE* file = fopen(OutputPath("mix.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    fprintf(file, "# Executed instructions by class, block executions times the blocks' static mix\n");
+    fprintf(file, "# Bound: memory with 35%%+ loads and stores, compute with 30%%+ fp and vector or 50%%+ int,\n");
+    fprintf(file, "# control with 25%%+ branches\n");
+    fprintf(file, "%14s", "executed");
+    for (const char* name : kClassNames) {
+        fprintf(file, " %7s", name);
+    }
+    fprintf(file, "  %-8s %s\n", "bound", "function");
+
+    auto print_row = [file](const FunctionMix& mix, const char* function) {
+        fprintf(file, "%14" PRIu64, mix.Total());
+        for (uint32_t instruction_class = 0; instruction_class < kInstructionClasses; instruction_class++) {
+            fprintf(file, " %6.1f%%", mix.Share(instruction_class));
+        }
+        fprintf(file, "  %-8s %s", mix.Bound(), function);
+        if (mix.static_vector_ops != 0 && mix.executed[kVectorOps] == 0) {
+            fprintf(file, " (%" PRIu64 " vector instructions never ran)", mix.static_vector_ops);
+        }
+        fprintf(file, "\n");
+    };
+    for (const FunctionMix& mix : functions) {
+        print_row(mix, mix.function->c_str());
+    }
+    print_row(total, "<total>");
+    fclose(file);
+}
+
+} /* namespace visual_dump */
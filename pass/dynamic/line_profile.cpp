@@ -0,0 +1,89 @@
+#include <call_stacks.hpp>
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct LineCounts {
+    uint64_t executions;   /* Of the line's most executed block */
+    uint64_t instructions; /* Block executions times the block's instructions of the line */
+};
+
+/* Columns are folded, the listings show whole lines */
+using LineKey = std::tuple<std::string, uint32_t>;
+
+} /* namespace */
+
+/*
+ * lines.txt has the executions, executed instructions and time of every
+ * source line of the -visual-dump-line-profile functions, for
+ * tools/annotate. Only functions are timed, their self time is split over
+ * their lines by executed instructions, so the time of a line is an
+ * estimate that ignores what the instructions cost.
+ */
+void WriteLineProfile(const MergedTables& tables) {
+    std::map<std::string, std::map<LineKey, LineCounts>> functions;
+    for (const auto& record : tables) {
+        if (std::get<0>(record.first) != static_cast<uint32_t>(CounterKind::LineCounts) ||
+            record.second.lines == nullptr) {
+            continue;
+        }
+        std::map<LineKey, LineCounts>& lines = functions[std::get<1>(record.first)];
+        const std::vector<uint64_t>& blocks = record.second.counters;
+        const uint64_t* aux = record.second.aux;
+        for (size_t block = 0; block < blocks.size(); block++) {
+            uint64_t num_lines = *aux++;
+            for (uint64_t i = 0; i < num_lines; i++, aux += 2) {
+                const SourceLine& source_line = record.second.lines[aux[0]];
+                LineCounts& counts = lines[LineKey(source_line.file, source_line.line)];
+                counts.executions = std::max(counts.executions, blocks[block]);
+                counts.instructions += blocks[block] * aux[1];
+            }
+        }
+    }
+    if (functions.empty()) {
+        return;
+    }
+
+    FILE* file = fopen(OutputPath("lines.txt").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    std::map<std::string, uint64_t> self_times = FunctionSelfTimes();
+    fprintf(file, "# Executions and executed instructions per source line, the function's self time split\n");
+    fprintf(file, "# by executed instructions. \"tools/bin/annotate lines.txt\" prints the listings\n");
+    fprintf(file, "# function line executions instructions time_ns file\n");
+    for (const auto& function : functions) {
+        uint64_t total = 0;
+        for (const auto& line : function.second) {
+            total += line.second.instructions;
+        }
+        if (total == 0) {
+            continue;
+        }
+
+        auto self_time = self_times.find(function.first);
+        double ns_per_instruction = self_time != self_times.end()
+                                        ? static_cast<double>(self_time->second) / static_cast<double>(total)
+                                        : 0.0;
+        for (const auto& line : function.second) {
+            const LineCounts& counts = line.second;
+            fprintf(file, "%s %u %" PRIu64 " %" PRIu64 " %.0f %s\n", function.first.c_str(),
+                    std::get<1>(line.first), counts.executions, counts.instructions,
+                    ns_per_instruction * static_cast<double>(counts.instructions), std::get<0>(line.first).c_str());
+        }
+    }
+    fclose(file);
+}
+
+} /* namespace visual_dump */
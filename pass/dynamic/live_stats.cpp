@@ -0,0 +1,110 @@
+#include <live_stats.hpp>
+#include <runtime.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+namespace visual_dump {
+
+namespace {
+
+/* Not a std::string, the segment is unlinked at exit after the static destructors may have run */
+char segment_name[64];
+
+void UnlinkSegment() {
+    shm_unlink(segment_name);
+}
+
+/*
+ * Publishes the call totals every VISUAL_DUMP_LIVE_MS. Functions get a slot
+ * the first time they show up and keep it, those beyond the capacity are
+ * counted as dropped.
+ */
+void PublishLoop(LiveHeader* header) {
+    LiveSlot* slots = LiveSlots(header);
+    std::map<std::string, uint32_t> slot_of;
+    long interval_ms = GetEnvLong("VISUAL_DUMP_LIVE_MS", 500);
+    interval_ms = interval_ms < 10 ? 10 : interval_ms;
+
+    while (true) {
+        uint64_t dropped = 0;
+        uint64_t unpublished = 0;
+        for (const auto& function : CollectCallTotals(dropped)) {
+            auto slot = slot_of.find(function.first);
+            if (slot == slot_of.end()) {
+                uint32_t used = header->num_slots.load(std::memory_order_relaxed);
+                if (used == header->capacity) {
+                    unpublished += function.second.calls;
+                    continue;
+                }
+                strncpy(slots[used].func, function.first.c_str(), kLiveNameSize - 1);
+                header->num_slots.store(used + 1, std::memory_order_release);
+                slot = slot_of.emplace(function.first, used).first;
+            }
+            PublishSlot(slots[slot->second], function.second.calls, function.second.inclusive_ns);
+        }
+        header->dropped_calls.store(dropped + unpublished, std::memory_order_relaxed);
+        header->published_ns.store(NowNs(), std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+}
+
+/* The segment of this process, a forked child publishes in one of its own */
+bool OpenSegment() {
+    long capacity = GetEnvLong("VISUAL_DUMP_LIVE_SLOTS", 1024);
+    capacity = capacity < 1 ? 1 : capacity;
+    size_t size = LiveSegmentSize(static_cast<uint32_t>(capacity));
+    snprintf(segment_name, sizeof(segment_name), "%s", LiveSegmentName(getpid()).c_str());
+    int fd = shm_open(segment_name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("[visual_dump] shm_open");
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        perror("[visual_dump] ftruncate");
+        close(fd);
+        UnlinkSegment();
+        return false;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        perror("[visual_dump] mmap");
+        UnlinkSegment();
+        return false;
+    }
+
+    /* The segment is zero filled, zero is a valid state of every atomic */
+    auto* header = static_cast<LiveHeader*>(memory);
+    header->version = kLiveVersion;
+    header->capacity = static_cast<uint32_t>(capacity);
+    header->magic.store(kLiveMagic, std::memory_order_release);
+
+    std::thread(PublishLoop, header).detach();
+    return true;
+}
+
+void RestartLiveStats() {
+    OpenSegment();
+}
+
+bool StartLiveStats() {
+    if (GetEnvLong("VISUAL_DUMP_LIVE", 0) == 0 || !OpenSegment()) {
+        return false;
+    }
+    OnExit(UnlinkSegment);
+    OnFork(RestartLiveStats);
+    return true;
+}
+
+const bool started = StartLiveStats();
+
+} /* namespace */
+
+} /* namespace visual_dump */
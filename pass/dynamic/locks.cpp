@@ -0,0 +1,296 @@
+#include <dot_builder.hpp>
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct LockStats {
+    uint64_t acquisitions{0};
+    uint64_t contended{0}; /* Waited at least VISUAL_DUMP_LOCK_CONTENDED_NS, or a try lock that failed */
+    uint64_t failures{0};
+    uint64_t wait_ns{0};
+    uint64_t max_wait_ns{0};
+    uint64_t hold_ns{0};
+    uint64_t max_hold_ns{0};
+    uint64_t cond_waits{0};
+    uint64_t cond_wait_ns{0};
+
+    void Add(const LockStats& other) {
+        acquisitions += other.acquisitions;
+        contended += other.contended;
+        failures += other.failures;
+        wait_ns += other.wait_ns;
+        max_wait_ns = std::max(max_wait_ns, other.max_wait_ns);
+        hold_ns += other.hold_ns;
+        max_hold_ns = std::max(max_hold_ns, other.max_hold_ns);
+        cond_waits += other.cond_waits;
+        cond_wait_ns += other.cond_wait_ns;
+    }
+};
+
+struct HeldLock {
+    uint64_t lock;
+    const SiteInfo* site; /* Where it was acquired, the hold time goes there */
+    uint64_t acquired_ns;
+    uint64_t acquisition; /* The locks of a scoped_lock share one, it takes them without an order */
+};
+
+using LockSite = std::pair<uint64_t, const SiteInfo*>;
+using LockEdge = std::pair<uint64_t, uint64_t>;
+
+/*
+ * Per thread statistics. The owner takes the mutex on every probe, it is
+ * uncontended but for the report at exit, and a global lock would
+ * serialize exactly the code this mode is looking at.
+ */
+struct LockThread {
+    std::mutex mutex;
+    std::map<LockSite, LockStats> stats;
+    std::map<LockEdge, uint64_t> order; /* Held lock, then lock acquired while holding it */
+    std::vector<HeldLock> held;
+    uint64_t begin_ns{0};
+    uint64_t acquisition{0}; /* Of the thread, counts the begin probes */
+    LockThread* next{nullptr};
+};
+
+std::atomic<LockThread*> lock_threads{nullptr};
+thread_local LockThread* current_lock_thread = nullptr;
+
+std::mutex& ThreadsMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+double Milliseconds(uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+}
+
+double Percent(uint64_t count, uint64_t total) {
+    return total != 0 ? 100.0 * static_cast<double>(count) / static_cast<double>(total) : 0.0;
+}
+
+std::string LockName(uint64_t lock) {
+    char name[32];
+    snprintf(name, sizeof(name), "%" PRIx64, lock);
+    return name;
+}
+
+/* Nodes are the locks, an edge A -> B means B was acquired while holding A, red when B -> A happens too */
+void WriteLockGraph(const std::map<uint64_t, LockStats>& locks, const std::map<LockEdge, uint64_t>& order) {
+    DotBuilder dot_builder(OutputPath("locks.dot"));
+    dot_builder.BeginGraph("Locks");
+    dot_builder.AddAttribute("shape=ellipse style=filled fillcolor=white", AttributeType::Node);
+
+    for (const auto& lock : locks) {
+        const LockStats& stats = lock.second;
+        char label[160];
+        snprintf(label, sizeof(label), "label=\"0x%" PRIx64 "\\nwait %.3f ms\\ncontended %.1f%%\\nhold %.3f ms\"%s",
+                 lock.first, Milliseconds(stats.wait_ns), Percent(stats.contended, stats.acquisitions),
+                 Milliseconds(stats.hold_ns),
+                 Percent(stats.contended, stats.acquisitions) >= 10.0 ? " fillcolor=\"#f4cccc\"" : "");
+        dot_builder.CreateNode(LockName(lock.first));
+        dot_builder.AddLabel(label);
+    }
+    for (const auto& edge : order) {
+        bool inverted = order.count(LockEdge(edge.first.second, edge.first.first)) != 0;
+        dot_builder.CreateEdge(LockName(edge.first.first), LockName(edge.first.second), EdgeType::NodeToNode);
+        dot_builder.AddLabel("label=\"" + std::to_string(edge.second) + "\"" +
+                             (inverted ? " color=\"#cc0000\" penwidth=3" : ""));
+    }
+    dot_builder.EndGraph();
+}
+
+/*
+ * locks.txt ranks the locks by wait time, with their call sites, and
+ * flags the pairs acquired in both orders, locks.dot is the lock graph.
+ */
+void WriteLockReport() {
+    std::map<LockSite, LockStats> stats;
+    std::map<LockEdge, uint64_t> order;
+    {
+        std::lock_guard<std::mutex> threads_lock(ThreadsMutex());
+        for (LockThread* thread = lock_threads.load(std::memory_order_acquire); thread != nullptr;
+             thread = thread->next) {
+            std::lock_guard<std::mutex> lock(thread->mutex);
+            for (const auto& site : thread->stats) {
+                stats[site.first].Add(site.second);
+            }
+            for (const auto& edge : thread->order) {
+                order[edge.first] += edge.second;
+            }
+        }
+    }
+
+    std::map<uint64_t, LockStats> locks;
+    for (const auto& site : stats) {
+        locks[site.first.first].Add(site.second);
+    }
+    if (locks.empty()) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, LockStats>> ranked(locks.begin(), locks.end());
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.wait_ns > rhs.second.wait_ns;
+    });
+
+    FILE* report = fopen(OutputPath("locks.txt").c_str(), "w");
+    if (report == nullptr) {
+        return;
+    }
+    long top = GetEnvLong("VISUAL_DUMP_TOP_LOCKS", 20);
+    fprintf(report, "# Locks by total wait time. Contended: waited %ld+ ns, or a try lock that failed\n",
+            GetEnvLong("VISUAL_DUMP_LOCK_CONTENDED_NS", 1000));
+    fprintf(report, "# Hold times belong to the acquiring site, condition waits are not contention\n");
+    for (size_t i = 0; i < ranked.size() && static_cast<long>(i) < top; i++) {
+        uint64_t lock = ranked[i].first;
+        const LockStats& total = ranked[i].second;
+        fprintf(report, "lock 0x%" PRIx64 " acquisitions %" PRIu64 " contended %.1f%% wait %.3f ms hold %.3f ms\n",
+                lock, total.acquisitions, Percent(total.contended, total.acquisitions), Milliseconds(total.wait_ns),
+                Milliseconds(total.hold_ns));
+        for (auto site = stats.lower_bound(LockSite(lock, nullptr)); site != stats.end() && site->first.first == lock;
+             site++) {
+            const SiteInfo& info = *site->first.second;
+            const LockStats& values = site->second;
+            fprintf(report, "    node_%" PRIu64 " %s %s", info.id, info.function, info.text);
+            if (info.file != nullptr) {
+                fprintf(report, " %s:%u", info.file, info.line);
+            }
+            fprintf(report, "\n        acquisitions %" PRIu64 " contended %" PRIu64, values.acquisitions,
+                    values.contended);
+            if (values.failures != 0) {
+                fprintf(report, " failed %" PRIu64, values.failures);
+            }
+            fprintf(report, " wait %.3f ms (max %.3f) hold %.3f ms (max %.3f)", Milliseconds(values.wait_ns),
+                    Milliseconds(values.max_wait_ns), Milliseconds(values.hold_ns), Milliseconds(values.max_hold_ns));
+            if (values.cond_waits != 0) {
+                fprintf(report, " condition waits %" PRIu64 " for %.3f ms", values.cond_waits,
+                        Milliseconds(values.cond_wait_ns));
+            }
+            fprintf(report, "\n");
+        }
+    }
+    for (const auto& edge : order) {
+        if (edge.first.first < edge.first.second && order.count(LockEdge(edge.first.second, edge.first.first)) != 0) {
+            fprintf(report, "# order inversion: 0x%" PRIx64 " and 0x%" PRIx64 " are acquired in both orders, "
+                            "a possible deadlock\n", edge.first.first, edge.first.second);
+        }
+    }
+    fclose(report);
+
+    WriteLockGraph(locks, order);
+}
+
+/* Forked child: the threads that held the per thread mutexes are gone */
+void ResetLockThreads() {
+    for (LockThread* thread = lock_threads.load(std::memory_order_acquire); thread != nullptr; thread = thread->next) {
+        new (&thread->mutex) std::mutex();
+    }
+}
+
+LockThread* CurrentLockThread() {
+    LockThread* thread = current_lock_thread;
+    if (thread != nullptr) {
+        return thread;
+    }
+    thread = current_lock_thread = new LockThread();
+    std::lock_guard<std::mutex> lock(ThreadsMutex());
+    if (lock_threads.load(std::memory_order_relaxed) == nullptr) {
+        OnExit(WriteLockReport);
+        OnFork(ResetLockThreads);
+    }
+    thread->next = lock_threads.load(std::memory_order_relaxed);
+    lock_threads.store(thread, std::memory_order_release);
+    return thread;
+}
+
+/* Caller holds thread->mutex. The innermost hold of the lock ends */
+void Release(LockThread* thread, uint64_t lock, uint64_t now) {
+    for (size_t i = thread->held.size(); i > 0; i--) {
+        const HeldLock& held = thread->held[i - 1];
+        if (held.lock == lock) {
+            uint64_t hold_ns = now - held.acquired_ns;
+            LockStats& stats = thread->stats[LockSite(lock, held.site)];
+            stats.hold_ns += hold_ns;
+            stats.max_hold_ns = std::max(stats.max_hold_ns, hold_ns);
+            thread->held.erase(thread->held.begin() + static_cast<long>(i - 1));
+            return;
+        }
+    }
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfileLockBegin__(const visual_dump::SiteInfo* site, void* lock) {
+    using namespace visual_dump;
+
+    LockThread* thread = CurrentLockThread();
+    uint64_t now = NowNs();
+    if (static_cast<LockOp>(site->attributes) == LockOp::CondWait) {
+        std::lock_guard<std::mutex> guard(thread->mutex);
+        Release(thread, reinterpret_cast<uint64_t>(lock), now);
+    }
+    thread->begin_ns = now;
+    thread->acquisition++;
+}
+
+extern "C" void ProfileLockEnd__(const visual_dump::SiteInfo* site, void* lock, int32_t acquired) {
+    using namespace visual_dump;
+
+    static const auto contended_ns = static_cast<uint64_t>(GetEnvLong("VISUAL_DUMP_LOCK_CONTENDED_NS", 1000));
+    LockThread* thread = CurrentLockThread();
+    uint64_t now = NowNs();
+    uint64_t wait_ns = now - thread->begin_ns;
+    auto op = static_cast<LockOp>(site->attributes);
+    auto lock_id = reinterpret_cast<uint64_t>(lock);
+
+    std::lock_guard<std::mutex> guard(thread->mutex);
+    LockStats& stats = thread->stats[LockSite(lock_id, site)];
+    if (acquired == 0) {
+        stats.failures++;
+        stats.contended += op == LockOp::TryLock ? 1 : 0;
+        return;
+    }
+
+    /* Try locks never wait and cannot deadlock, they stay out of the order graph */
+    if (op == LockOp::CondWait) {
+        stats.cond_waits++;
+        stats.cond_wait_ns += wait_ns;
+    } else if (op == LockOp::TryLock) {
+        stats.acquisitions++;
+    } else {
+        stats.acquisitions++;
+        stats.wait_ns += wait_ns;
+        stats.max_wait_ns = std::max(stats.max_wait_ns, wait_ns);
+        stats.contended += wait_ns >= contended_ns ? 1 : 0;
+        for (const HeldLock& held : thread->held) {
+            if (held.lock != lock_id && held.acquisition != thread->acquisition) {
+                thread->order[LockEdge(held.lock, lock_id)]++;
+            }
+        }
+    }
+    thread->held.push_back(HeldLock{lock_id, site, now, thread->acquisition});
+}
+
+extern "C" void ProfileLockRelease__(const visual_dump::SiteInfo* /* site */, void* lock) {
+    using namespace visual_dump;
+
+    LockThread* thread = CurrentLockThread();
+    uint64_t now = NowNs();
+    std::lock_guard<std::mutex> guard(thread->mutex);
+    Release(thread, reinterpret_cast<uint64_t>(lock), now);
+}
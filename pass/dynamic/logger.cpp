@@ -1,10 +1,65 @@
 #include <dot_builder.hpp>
+#include <call_stacks.hpp>
+#include <perf_counters.hpp>
+#include <sampler.hpp>
+
+using visual_dump::RuntimeMode;
+
+namespace {
+
+/*
+ * Events are tagged "P<pid> T<thread index> <seconds since the runtime started>",
+ * forked children write to the same stdout and number their threads from 0 again
+ */
+double Seconds(uint64_t now_ns) {
+    return static_cast<double>(now_ns - visual_dump::StartNs()) / 1e9;
+}
+
+} /* namespace */
+
+/*
+ * The hooks time the trace output and the counter reads and take them off
+ * the frames, so that the probe cost calibrated in call_stacks.cpp is all
+ * they leave in the times. The counters are read within the shadow stack
+ * bookkeeping, which they do not count, the trace is written outside it.
+ */
 
 extern "C" void LogFunctionCall__(char* callee_name, char* caller_name, long int value_addr) {
-    printf("[LOG] CALL '%s' -> '%s' {%ld}\n", callee_name, caller_name, value_addr);
+    if (visual_dump::Mode() == RuntimeMode::Sample) {
+        return;
+    }
+    visual_dump::ThreadState* thread = visual_dump::CurrentThread();
+    uint64_t start = visual_dump::NowNs();
+    printf("[LOG] P%d T%u %.6f CALL '%s' -> '%s' {%ld}\n", visual_dump::ProcessId(), thread->index, Seconds(start),
+           callee_name, caller_name, value_addr);
+    visual_dump::ExcludeHookTime(thread, start);
 }
 
-extern "C" void LogFuncRet__(char* func_name, long int value_addr) {
-    printf("[LOG] End function '%s' {%ld}\n", func_name, value_addr);
+extern "C" void LogFuncEntry__(char* func_name, long int func_addr) {
+    visual_dump::ThreadState* thread = visual_dump::CurrentThread();
+    if (visual_dump::Mode() == RuntimeMode::Sample) {
+        visual_dump::SampleEnter(thread, func_name, static_cast<uint64_t>(func_addr));
+        return;
+    }
+    visual_dump::EnterFunction(thread, func_name, static_cast<uint64_t>(func_addr));
+    uint64_t start = visual_dump::NowNs();
+    visual_dump::PerfEnter(func_name, static_cast<uint64_t>(func_addr));
+    visual_dump::ExcludeHookTime(thread, start);
 }
 
+extern "C" void LogFuncRet__(char* func_name, long int value_addr) {
+    visual_dump::ThreadState* thread = visual_dump::CurrentThread();
+    if (visual_dump::Mode() == RuntimeMode::Sample) {
+        visual_dump::SampleLeave(thread, func_name);
+        return;
+    }
+    uint64_t start = visual_dump::NowNs();
+    visual_dump::PerfLeave(func_name);
+    visual_dump::ExcludeHookTime(thread, start);
+    visual_dump::LeaveFunction(thread, func_name);
+
+    start = visual_dump::NowNs();
+    printf("[LOG] P%d T%u %.6f End function '%s' {%ld}\n", visual_dump::ProcessId(), thread->index, Seconds(start),
+           func_name, value_addr);
+    visual_dump::ExcludeHookTime(thread, start);
+}
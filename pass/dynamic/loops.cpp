@@ -0,0 +1,107 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct LoopSite {
+    const std::string* function;
+    const uint64_t* aux;
+    const uint64_t* counters;
+
+    uint64_t Entries() const {
+        return counters[0];
+    }
+
+    uint64_t Exits() const {
+        return counters[1];
+    }
+
+    uint64_t Trips() const {
+        return counters[2];
+    }
+
+    double AverageTrips() const {
+        return Exits() != 0 ? static_cast<double>(Trips()) / static_cast<double>(Exits()) : 0.0;
+    }
+};
+
+} /* namespace */
+
+/*
+ * loops.txt lists the loops by the header executions of their finished
+ * entries, loops.overlay labels their headers in dump.dot.
+ */
+void WriteLoopTrips(const MergedTables& tables) {
+    std::vector<LoopSite> loops;
+    for (const auto& record : tables) {
+        if (std::get<0>(record.first) != static_cast<uint32_t>(CounterKind::LoopTrips)) {
+            continue;
+        }
+        const std::vector<uint64_t>& counters = record.second.counters;
+        for (size_t loop = 0; loop < counters.size() / kLoopSiteSize; loop++) {
+            if (counters[loop * kLoopSiteSize] != 0) {
+                loops.push_back(LoopSite{&std::get<1>(record.first), &record.second.aux[loop * kLoopAuxSize],
+                                         &counters[loop * kLoopSiteSize]});
+            }
+        }
+    }
+    if (loops.empty()) {
+        return;
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const LoopSite& lhs, const LoopSite& rhs) {
+        return lhs.Trips() > rhs.Trips();
+    });
+
+    FILE* report = fopen(OutputPath("loops.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("loops.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    fprintf(report, "# Loop trip counts, header executions per entry. Unfinished entries left the loop without\n");
+    fprintf(report, "# an exit edge (return, longjmp, exception) and are not in the statistics\n");
+    fprintf(report, "# The histogram counts the entries by log2 of the trip count: <min trips>: <entries>\n");
+    fprintf(report, "%12s %10s %10s %10s %10s %10s  %s\n", "iterations", "entries", "unfinished", "min", "avg",
+            "max", "function node [line]");
+    for (const LoopSite& loop : loops) {
+        uint64_t min = loop.Exits() != 0 ? ~loop.counters[4] : 0;
+        fprintf(report, "%12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10.1f %10" PRIu64 "  %s node_%" PRIu64,
+                loop.Trips(), loop.Entries(), loop.Entries() - std::min(loop.Entries(), loop.Exits()), min,
+                loop.AverageTrips(), loop.counters[3], loop.function->c_str(), loop.aux[0]);
+        if (loop.aux[1] != 0) {
+            fprintf(report, " line %" PRIu64, loop.aux[1]);
+        }
+        fputs("\n            ", report);
+        for (uint32_t bucket = 0; bucket < kLoopTripBuckets; bucket++) {
+            uint64_t entries = loop.counters[5 + bucket];
+            if (entries != 0) {
+                fprintf(report, " %" PRIu64 "%s: %" PRIu64, uint64_t{1} << bucket,
+                        bucket + 1 == kLoopTripBuckets ? "+" : "", entries);
+            }
+        }
+        fputs("\n", report);
+
+        if (loop.Exits() != 0) {
+            fprintf(overlay, "node_%" PRIu64 " xlabel=\"trips %" PRIu64 "..%" PRIu64 ", avg %.1f\"\n", loop.aux[0],
+                    min, loop.counters[3], loop.AverageTrips());
+        }
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+} /* namespace visual_dump */
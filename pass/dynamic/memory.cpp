@@ -0,0 +1,341 @@
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kBurstSize = 4096;
+constexpr uint64_t kLineBits = 6;
+constexpr uint64_t kPageBits = 12;
+constexpr uint32_t kReuseBuckets = 24;
+/* Reuses of a line further apart than this many distinct lines count as misses, 32 KiB of 64 byte lines */
+constexpr uint64_t kCacheLines = 512;
+
+enum StrideClass : uint32_t {
+    kSameAddress = 0,
+    kUnitStride = 1,  /* The access size, either direction */
+    kSameLine = 2,    /* Under a cache line */
+    kSamePage = 3,    /* Under a page */
+    kFar = 4,
+    kStrideClasses = 5,
+};
+
+const char* const kStrideNames[kStrideClasses] = {"zero", "unit", "line", "page", "far"};
+
+struct Record {
+    const SiteInfo* site;
+    uint64_t address;
+};
+
+/*
+ * Per thread buffer. A burst of kBurstSize consecutive accesses is
+ * recorded, analysed in one go, then the next (period - 1) bursts worth
+ * of accesses are skipped. Consecutive accesses keep strides and reuse
+ * distances meaningful at a fraction of the cost.
+ */
+struct Ring {
+    Record records[kBurstSize];
+    uint32_t head{0};
+    uint64_t skip{0};
+    Ring* next{nullptr};
+};
+
+struct SiteStats {
+    uint64_t samples{0};
+    uint64_t strides[kStrideClasses]{};
+    uint64_t repeated_strides{0}; /* Same stride as the previous access of the site */
+    int64_t majority_stride{0};   /* Boyer-Moore majority vote */
+    uint64_t majority_votes{0};
+    uint64_t cold{0};             /* First access to the line in the burst */
+    uint64_t reuses[kReuseBuckets]{}; /* Bucket b holds distances in [2^(b-1), 2^b) distinct lines */
+    uint64_t lines{0};            /* Distinct lines, summed over the bursts */
+    uint64_t pages{0};
+
+    uint64_t Misses() const {
+        uint64_t misses = cold;
+        for (uint32_t bucket = 0; bucket < kReuseBuckets; bucket++) {
+            if ((bucket == 0 ? 0 : uint64_t{1} << (bucket - 1)) >= kCacheLines) {
+                misses += reuses[bucket];
+            }
+        }
+        return misses;
+    }
+};
+
+/* Per site state within one burst */
+struct BurstState {
+    uint64_t last_address{0};
+    int64_t last_stride{0};
+    bool has_last{false};
+    std::unordered_set<uint64_t> lines;
+    std::unordered_set<uint64_t> pages;
+};
+
+std::mutex& StatsMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+std::unordered_map<const SiteInfo*, SiteStats>& Stats() {
+    static auto* stats = new std::unordered_map<const SiteInfo*, SiteStats>();
+    return *stats;
+}
+
+std::atomic<Ring*> rings{nullptr};
+thread_local Ring* current_ring = nullptr;
+uint64_t skip_period = 0;
+
+StrideClass ClassifyStride(int64_t stride, uint32_t size) {
+    uint64_t distance = stride < 0 ? 0 - static_cast<uint64_t>(stride) : static_cast<uint64_t>(stride);
+    if (distance == 0) {
+        return kSameAddress;
+    }
+    if (distance == size) {
+        return kUnitStride;
+    }
+    if (distance < (uint64_t{1} << kLineBits)) {
+        return kSameLine;
+    }
+    return distance < (uint64_t{1} << kPageBits) ? kSamePage : kFar;
+}
+
+/*
+ * Reuse distance: the distinct lines touched since the last access to the
+ * same line. A Fenwick tree over the burst marks the latest access of every
+ * line, the distance is the count of marks in between.
+ */
+class ReuseDistance {
+public:
+    explicit ReuseDistance(uint32_t size)
+        : tree_(size + 1, 0) {
+    }
+
+    /* UINT64_MAX for the first access to the line */
+    uint64_t Access(uint64_t line, uint32_t time) {
+        uint64_t distance = UINT64_MAX;
+        auto last = last_access_.find(line);
+        if (last != last_access_.end()) {
+            distance = Sum(time) - Sum(last->second + 1);
+            Add(last->second, -1);
+        }
+        last_access_[line] = time;
+        Add(time, 1);
+        return distance;
+    }
+
+private:
+    void Add(uint32_t time, int32_t delta) {
+        for (uint32_t i = time + 1; i < tree_.size(); i += i & (0 - i)) {
+            tree_[i] += delta;
+        }
+    }
+
+    /* Marks at times [0, end) */
+    uint64_t Sum(uint32_t end) const {
+        int64_t sum = 0;
+        for (uint32_t i = end; i > 0; i -= i & (0 - i)) {
+            sum += tree_[i];
+        }
+        return static_cast<uint64_t>(sum);
+    }
+
+private:
+    std::vector<int32_t> tree_;
+    std::unordered_map<uint64_t, uint32_t> last_access_;
+};
+
+/* Caller holds StatsMutex() */
+void Drain(Ring& ring) {
+    auto& stats = Stats();
+    std::unordered_map<const SiteInfo*, BurstState> bursts;
+    ReuseDistance reuse{ring.head};
+    for (uint32_t i = 0; i < ring.head; i++) {
+        const Record& record = ring.records[i];
+        SiteStats& site = stats[record.site];
+        BurstState& burst = bursts[record.site];
+        site.samples++;
+
+        if (burst.has_last) {
+            auto stride = static_cast<int64_t>(record.address - burst.last_address);
+            site.strides[ClassifyStride(stride, record.site->attributes & kAccessSizeMask)]++;
+            site.repeated_strides += stride == burst.last_stride ? 1 : 0;
+            if (site.majority_votes == 0) {
+                site.majority_stride = stride;
+            }
+            site.majority_votes = stride == site.majority_stride ? site.majority_votes + 1 : site.majority_votes - 1;
+            burst.last_stride = stride;
+        }
+        burst.last_address = record.address;
+        burst.has_last = true;
+        burst.lines.insert(record.address >> kLineBits);
+        burst.pages.insert(record.address >> kPageBits);
+
+        uint64_t distance = reuse.Access(record.address >> kLineBits, i);
+        if (distance == UINT64_MAX) {
+            site.cold++;
+        } else {
+            site.reuses[std::min<uint32_t>(distance == 0 ? 0 : 64 - __builtin_clzll(distance), kReuseBuckets - 1)]++;
+        }
+    }
+    for (const auto& burst : bursts) {
+        stats[burst.first].lines += burst.second.lines.size();
+        stats[burst.first].pages += burst.second.pages.size();
+    }
+    ring.head = 0;
+}
+
+double Ratio(uint64_t count, uint64_t total) {
+    return total != 0 ? static_cast<double>(count) / static_cast<double>(total) : 0.0;
+}
+
+double Percent(uint64_t count, uint64_t total) {
+    return 100.0 * Ratio(count, total);
+}
+
+void WriteHints(FILE* file, const SiteInfo& site, const SiteStats& stats) {
+    uint64_t strides = 0;
+    for (uint64_t count : stats.strides) {
+        strides += count;
+    }
+    uint64_t majority = stats.majority_stride < 0 ? 0 - static_cast<uint64_t>(stats.majority_stride)
+                                                  : static_cast<uint64_t>(stats.majority_stride);
+    if (Percent(stats.repeated_strides, strides) >= 80.0 && majority >= (uint64_t{1} << kLineBits)) {
+        fprintf(file, "    hint: constant stride of %" PRId64 " bytes for %u byte accesses, a new line every time;"
+                      " split the hot field out (AoS to SoA) or interchange the loops\n",
+                stats.majority_stride, site.attributes & kAccessSizeMask);
+    } else if (Percent(stats.strides[kFar], strides) >= 50.0 && Percent(stats.repeated_strides, strides) < 20.0) {
+        fprintf(file, "    hint: irregular accesses across pages, pointer chasing or hashing;"
+                      " a contiguous or pooled layout would help\n");
+    }
+    if (Percent(stats.pages, stats.samples) >= 50.0) {
+        fprintf(file, "    hint: a new page on %.0f%% of the accesses, TLB bound; consider huge pages or a denser layout\n",
+                Percent(stats.pages, stats.samples));
+    }
+}
+
+/*
+ * memory.txt ranks the instructions by estimated misses, memory.overlay
+ * labels them in dump.dot.
+ */
+void WriteMemoryReport() {
+    std::lock_guard<std::mutex> lock(StatsMutex());
+    for (Ring* ring = rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+        Drain(*ring);
+    }
+
+    std::vector<std::pair<const SiteInfo*, const SiteStats*>> sites;
+    for (const auto& site : Stats()) {
+        sites.emplace_back(site.first, &site.second);
+    }
+    if (sites.empty()) {
+        return;
+    }
+    std::sort(sites.begin(), sites.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second->Misses() != rhs.second->Misses() ? lhs.second->Misses() > rhs.second->Misses()
+                                                            : lhs.first->id < rhs.first->id;
+    });
+
+    FILE* report = fopen(OutputPath("memory.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("memory.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    long top = GetEnvLong("VISUAL_DUMP_TOP_ACCESSES", 50);
+    fprintf(report, "# Loads and stores ranked by estimated misses, bursts of %u accesses per thread, 1 in %" PRIu64
+                    " sampled\n", kBurstSize, skip_period);
+    fprintf(report, "# Misses: first touch of a line in the burst or reuse after %" PRIu64 "+ distinct lines\n",
+            kCacheLines);
+    fprintf(report, "# Strides to the previous access of the same instruction: zero, unit (the access size),\n");
+    fprintf(report, "# line (< 64 B), page (< 4 KiB), far. Lines and pages: distinct ones per access\n");
+    for (size_t i = 0; i < sites.size() && static_cast<long>(i) < top; i++) {
+        const SiteInfo& info = *sites[i].first;
+        const SiteStats& stats = *sites[i].second;
+        double miss_rate = Percent(stats.Misses(), stats.samples);
+
+        fprintf(report, "node_%" PRIu64 " %s %s", info.id, info.function, info.text);
+        if (info.file != nullptr) {
+            fprintf(report, " %s:%u", info.file, info.line);
+        }
+        fprintf(report, " samples %" PRIu64 " misses %.1f%%\n", stats.samples, miss_rate);
+
+        uint64_t strides = 0;
+        for (uint64_t count : stats.strides) {
+            strides += count;
+        }
+        fprintf(report, "    strides");
+        for (uint32_t stride = 0; stride < kStrideClasses; stride++) {
+            fprintf(report, " %s %.1f%%", kStrideNames[stride], Percent(stats.strides[stride], strides));
+        }
+        fprintf(report, "  repeated %.1f%%\n", Percent(stats.repeated_strides, strides));
+        fprintf(report, "    lines/access %.3f  pages/access %.3f  reuse", Ratio(stats.lines, stats.samples),
+                Ratio(stats.pages, stats.samples));
+        for (uint32_t bucket = 0; bucket < kReuseBuckets; bucket++) {
+            if (stats.reuses[bucket] != 0) {
+                fprintf(report, " <%" PRIu64 ":%.1f%%", uint64_t{1} << bucket, Percent(stats.reuses[bucket], stats.samples));
+            }
+        }
+        fprintf(report, " cold:%.1f%%\n", Percent(stats.cold, stats.samples));
+        WriteHints(report, info, stats);
+
+        const char* color = miss_rate >= 50.0 ? " color=\"#cc0000\" penwidth=3"
+                          : miss_rate >= 10.0 ? " color=\"#e69138\"" : "";
+        fprintf(overlay, "node_%" PRIu64 " xlabel=\"misses ~%.1f%%, %.2f lines/access\"%s\n", info.id, miss_rate,
+                Ratio(stats.lines, stats.samples), color);
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+Ring* CreateRing() {
+    auto* ring = new Ring();
+    std::lock_guard<std::mutex> lock(StatsMutex());
+    if (rings.load(std::memory_order_relaxed) == nullptr) {
+        skip_period = static_cast<uint64_t>(std::max(1l, GetEnvLong("VISUAL_DUMP_MEMORY_PERIOD", 10)));
+        OnExit(WriteMemoryReport);
+    }
+    ring->next = rings.load(std::memory_order_relaxed);
+    rings.store(ring, std::memory_order_release);
+    return ring;
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfileMemoryAccess__(const visual_dump::SiteInfo* site, const void* address) {
+    using namespace visual_dump;
+
+    Ring* ring = current_ring;
+    if (ring == nullptr) {
+        ring = current_ring = CreateRing();
+    }
+    if (ring->skip != 0) {
+        ring->skip--;
+        return;
+    }
+
+    ring->records[ring->head++] = Record{site, reinterpret_cast<uint64_t>(address)};
+    if (ring->head == kBurstSize) {
+        std::lock_guard<std::mutex> lock(StatsMutex());
+        Drain(*ring);
+        ring->skip = (skip_period - 1) * kBurstSize;
+    }
+}
@@ -0,0 +1,219 @@
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kTableSize = 1u << 14;
+constexpr uint32_t kMaxProbes = 32;
+
+struct PathEntry {
+    const SiteInfo* site;
+    const uint64_t* graph;
+    uint64_t path;
+    uint64_t count;
+};
+
+/*
+ * Open addressing table of one thread, no locks on the hot path. Paths
+ * that find no slot within kMaxProbes are only counted as dropped.
+ */
+struct PathTable {
+    PathEntry entries[kTableSize];
+    uint64_t dropped{0};
+    PathTable* next{nullptr};
+};
+
+std::atomic<PathTable*> tables{nullptr};
+thread_local PathTable* current_table = nullptr;
+
+std::mutex& TablesMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+struct DecodedPath {
+    std::vector<uint32_t> blocks;
+    bool from_loop{false}; /* Starts at a loop header, after a back edge */
+    bool to_loop{false};   /* Ends at a back edge */
+};
+
+/* Offsets of the vertex records and of the per block node ids, see PathEdgeKind */
+struct Graph {
+    explicit Graph(const uint64_t* graph_data)
+        : data(graph_data) {
+        uint64_t blocks_num = data[0];
+        size_t offset = 1;
+        for (uint64_t vertex = 0; vertex < blocks_num + 2; vertex++) {
+            vertices.push_back(offset);
+            offset += 1 + 3 * data[offset];
+        }
+        for (uint64_t block = 0; block < blocks_num; block++) {
+            node_ids.push_back(offset);
+            offset += 1 + data[offset];
+        }
+    }
+
+    /* Ball-Larus regeneration: at every vertex the edge with the largest value that fits */
+    DecodedPath Decode(uint64_t path) const {
+        DecodedPath decoded;
+        uint64_t blocks_num = data[0];
+        uint64_t vertex = blocks_num;
+        while (vertex != blocks_num + 1) {
+            const uint64_t* edges = &data[vertices[vertex]];
+            if (edges[0] == 0) {
+                break;
+            }
+            const uint64_t* chosen = &edges[1];
+            for (uint64_t i = 0; i < edges[0]; i++) {
+                if (edges[1 + 3 * i + 2] <= path) {
+                    chosen = &edges[1 + 3 * i];
+                }
+            }
+            path -= chosen[2];
+            decoded.from_loop |= chosen[1] == static_cast<uint64_t>(PathEdgeKind::LoopEntry);
+            decoded.to_loop |= chosen[1] == static_cast<uint64_t>(PathEdgeKind::LoopExit);
+            vertex = chosen[0];
+            if (vertex < blocks_num) {
+                decoded.blocks.push_back(static_cast<uint32_t>(vertex));
+            }
+        }
+        return decoded;
+    }
+
+    const uint64_t* data;
+    std::vector<size_t> vertices;
+    std::vector<size_t> node_ids;
+};
+
+void WritePaths() {
+    using Key = std::pair<const SiteInfo*, uint64_t>;
+    std::map<Key, uint64_t> counts;
+    std::map<const SiteInfo*, const uint64_t*> graphs;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(TablesMutex());
+        for (PathTable* table = tables.load(std::memory_order_acquire); table != nullptr; table = table->next) {
+            for (const PathEntry& entry : table->entries) {
+                if (entry.site != nullptr) {
+                    counts[Key(entry.site, entry.path)] += entry.count;
+                    graphs.emplace(entry.site, entry.graph);
+                }
+            }
+            dropped += table->dropped;
+        }
+    }
+    if (counts.empty()) {
+        return;
+    }
+
+    std::map<const SiteInfo*, uint64_t> function_totals;
+    std::vector<std::pair<Key, uint64_t>> paths(counts.begin(), counts.end());
+    for (const auto& path : paths) {
+        function_totals[path.first.first] += path.second;
+    }
+    std::stable_sort(paths.begin(), paths.end(), [](const std::pair<Key, uint64_t>& lhs,
+                                                    const std::pair<Key, uint64_t>& rhs) {
+        return lhs.second > rhs.second;
+    });
+
+    FILE* report = fopen(OutputPath("paths.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("paths.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    /* paths.overlay highlights the hottest path of every function */
+    long top = GetEnvLong("VISUAL_DUMP_TOP_PATHS", 20);
+    fprintf(report, "# Hot acyclic paths (Ball-Larus), blocks by index in the function\n");
+    fprintf(report, "# \"loop>\" starts at a loop header after a back edge, \">loop\" ends at a back edge\n");
+    fprintf(report, "# %" PRIu64 " path executions dropped, the path tables were full\n", dropped);
+    std::map<const SiteInfo*, bool> highlighted;
+    long rank = 0;
+    for (const auto& path : paths) {
+        const SiteInfo* site = path.first.first;
+        Graph graph{graphs[site]};
+        DecodedPath decoded = graph.Decode(path.first.second);
+
+        if (rank < top) {
+            fprintf(report, "%12" PRIu64 " %6.2f%% %s path %" PRIu64 ":", path.second,
+                    100.0 * static_cast<double>(path.second) / static_cast<double>(function_totals[site]),
+                    site->function, path.first.second);
+            fputs(decoded.from_loop ? " loop>" : "", report);
+            for (uint32_t block : decoded.blocks) {
+                fprintf(report, " %u", block);
+            }
+            fputs(decoded.to_loop ? " >loop\n" : "\n", report);
+            rank++;
+        }
+
+        if (!highlighted[site]) {
+            highlighted[site] = true;
+            fprintf(overlay, "cluster_%" PRIu64 " label=\"%s, hottest path %.1f%%\"\n", site->id, site->function,
+                    100.0 * static_cast<double>(path.second) / static_cast<double>(function_totals[site]));
+            for (uint32_t block : decoded.blocks) {
+                const uint64_t* node_ids = &graph.data[graph.node_ids[block]];
+                for (uint64_t i = 0; i < node_ids[0]; i++) {
+                    fprintf(overlay, "node_%" PRIu64 " color=\"#e69138\" penwidth=3\n", node_ids[1 + i]);
+                }
+            }
+        }
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+PathTable* CreateTable() {
+    auto* table = new PathTable();
+    std::lock_guard<std::mutex> lock(TablesMutex());
+    if (tables.load(std::memory_order_relaxed) == nullptr) {
+        OnExit(WritePaths);
+    }
+    table->next = tables.load(std::memory_order_relaxed);
+    tables.store(table, std::memory_order_release);
+    return table;
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfilePath__(const visual_dump::SiteInfo* site, const uint64_t* graph, uint64_t path) {
+    using namespace visual_dump;
+
+    PathTable* table = current_table;
+    if (table == nullptr) {
+        table = current_table = CreateTable();
+    }
+
+    uint64_t hash = (reinterpret_cast<uint64_t>(site) ^ (path * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+    for (uint32_t probe = 0; probe < kMaxProbes; probe++) {
+        PathEntry& entry = table->entries[((hash >> 32) + probe) & (kTableSize - 1)];
+        if (entry.site == site && entry.path == path) {
+            entry.count++;
+            return;
+        }
+        if (entry.site == nullptr) {
+            entry = PathEntry{site, graph, path, 1};
+            return;
+        }
+    }
+    table->dropped++;
+}
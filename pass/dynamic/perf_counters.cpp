@@ -0,0 +1,309 @@
+#include <perf_counters.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <linux/perf_event.h>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kEvents = 4;
+
+struct EventSpec {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+/* Per slot: the hardware event, then its software stand-in, type PERF_TYPE_MAX when there is none */
+const EventSpec kEventSpecs[kEvents][2] = {
+    {{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+     {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}},
+    {{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS}, {"-", PERF_TYPE_MAX, 0}},
+    {{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+     {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}},
+    {{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+     {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES}},
+};
+
+struct Counters {
+    uint64_t values[kEvents]{};
+};
+
+struct PerfFrame {
+    const char* func;
+    Counters entry;
+    Counters children;
+};
+
+struct FunctionCounters {
+    uint64_t func_id{0};
+    uint64_t calls{0};
+    Counters self;
+    Counters inclusive; /* Counts recursive calls once per frame */
+};
+
+/*
+ * Counter group and frames of one thread. The owner takes the mutex on
+ * every hook, uncontended but for the report at exit.
+ */
+struct PerfThread {
+    std::mutex mutex;
+    int leader{-1};
+    int fds[kEvents]{-1, -1, -1, -1}; /* In group order, leader first */
+    int32_t slots[kEvents]{-1, -1, -1, -1}; /* Position of the slot in the group read, -1 when not opened */
+    uint32_t opened{0};
+    std::vector<PerfFrame> frames;
+    std::unordered_map<const char*, FunctionCounters> functions;
+    PerfThread* next{nullptr};
+};
+
+std::atomic<PerfThread*> perf_threads{nullptr};
+thread_local PerfThread* current_perf_thread = nullptr;
+
+/* Event names of the slots as the first thread opened them, the report's column names */
+const char* slot_names[kEvents] = {"-", "-", "-", "-"};
+
+std::mutex& ThreadsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+bool Enabled() {
+    static const bool enabled = GetEnvLong("VISUAL_DUMP_PERF", 0) != 0;
+    return enabled;
+}
+
+int OpenEvent(const EventSpec& spec, int group_fd) {
+    if (spec.type == PERF_TYPE_MAX) {
+        return -1;
+    }
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+void OpenGroup(PerfThread* thread) {
+    for (uint32_t slot = 0; slot < kEvents; slot++) {
+        for (const EventSpec& spec : kEventSpecs[slot]) {
+            int fd = OpenEvent(spec, thread->leader);
+            if (fd >= 0) {
+                thread->leader = thread->leader < 0 ? fd : thread->leader;
+                thread->fds[thread->opened] = fd;
+                thread->slots[slot] = static_cast<int32_t>(thread->opened++);
+                if (slot_names[slot][0] == '-') {
+                    slot_names[slot] = spec.name;
+                }
+                break;
+            }
+        }
+    }
+}
+
+bool Read(const PerfThread* thread, Counters& counters) {
+    uint64_t buffer[1 + kEvents] = {};
+    if (thread->leader < 0 || read(thread->leader, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    for (uint32_t slot = 0; slot < kEvents; slot++) {
+        counters.values[slot] = thread->slots[slot] >= 0 ? buffer[1 + thread->slots[slot]] : 0;
+    }
+    return true;
+}
+
+int32_t SlotOf(const char* name) {
+    for (uint32_t slot = 0; slot < kEvents; slot++) {
+        if (strcmp(slot_names[slot], name) == 0) {
+            return static_cast<int32_t>(slot);
+        }
+    }
+    return -1;
+}
+
+/* Per thousand instructions when there are instructions, per call otherwise */
+double Rate(const FunctionCounters& function, uint32_t slot) {
+    int32_t instructions = SlotOf("instructions");
+    if (instructions >= 0 && function.self.values[instructions] != 0) {
+        return 1000.0 * static_cast<double>(function.self.values[slot]) /
+               static_cast<double>(function.self.values[instructions]);
+    }
+    return static_cast<double>(function.self.values[slot]) / static_cast<double>(std::max<uint64_t>(function.calls, 1));
+}
+
+/*
+ * perf.txt lists the functions by self cycles (or task clock), perf.overlay
+ * fills their clusters in dump.dot by the same measure.
+ */
+void WritePerfReport() {
+    std::map<std::string, FunctionCounters> functions;
+    {
+        std::lock_guard<std::mutex> threads_lock(ThreadsMutex());
+        for (PerfThread* thread = perf_threads.load(std::memory_order_acquire); thread != nullptr;
+             thread = thread->next) {
+            std::lock_guard<std::mutex> lock(thread->mutex);
+            for (const auto& function : thread->functions) {
+                FunctionCounters& merged = functions[function.first];
+                merged.func_id = merged.func_id != 0 ? merged.func_id : function.second.func_id;
+                merged.calls += function.second.calls;
+                for (uint32_t slot = 0; slot < kEvents; slot++) {
+                    merged.self.values[slot] += function.second.self.values[slot];
+                    merged.inclusive.values[slot] += function.second.inclusive.values[slot];
+                }
+            }
+        }
+    }
+    if (functions.empty()) {
+        return;
+    }
+    std::vector<std::pair<std::string, FunctionCounters>> ranked(functions.begin(), functions.end());
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.self.values[0] > rhs.second.self.values[0];
+    });
+
+    FILE* report = fopen(OutputPath("perf.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("perf.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    int32_t cycles = SlotOf("cycles");
+    int32_t instructions = SlotOf("instructions");
+    fprintf(report, "# Counters per function, read by the entry and exit hooks, self excludes the instrumented callees\n");
+    fprintf(report, "# Misses are per thousand instructions, per call without an instructions counter\n");
+    fprintf(report, "%10s %16s %16s %6s %12s %12s  %s\n", "calls", slot_names[0], slot_names[1], "ipc", slot_names[2],
+            slot_names[3], "function (self)");
+    uint64_t hottest = std::max<uint64_t>(ranked.front().second.self.values[0], 1);
+    for (const auto& function : ranked) {
+        const FunctionCounters& counters = function.second;
+        double ipc = cycles >= 0 && instructions >= 0 && counters.self.values[cycles] != 0
+                         ? static_cast<double>(counters.self.values[instructions]) /
+                               static_cast<double>(counters.self.values[cycles])
+                         : 0.0;
+        fprintf(report, "%10" PRIu64 " %16" PRIu64 " %16" PRIu64 " %6.2f %12.3f %12.3f  %s\n", counters.calls,
+                counters.self.values[0], counters.self.values[1], ipc, Rate(counters, 2), Rate(counters, 3),
+                function.first.c_str());
+
+        double heat = static_cast<double>(counters.self.values[0]) / static_cast<double>(hottest);
+        fprintf(overlay, "cluster_%" PRIu64 " style=filled fillcolor=\"0.000 %.3f 1.000\" label=\"%s, %s %.1f%%\"\n",
+                counters.func_id, heat, function.first.c_str(), slot_names[0], 100.0 * heat);
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+/*
+ * Forked child: the inherited groups count the parent's threads. They are
+ * closed, the forking thread opens a group of its own.
+ */
+void ResetPerf() {
+    new (&ThreadsMutex()) std::mutex();
+    for (PerfThread* thread = perf_threads.load(std::memory_order_acquire); thread != nullptr; thread = thread->next) {
+        new (&thread->mutex) std::mutex();
+        for (uint32_t i = 0; i < thread->opened; i++) {
+            close(thread->fds[i]);
+            thread->fds[i] = -1;
+        }
+        thread->leader = -1;
+        thread->opened = 0;
+        std::fill(std::begin(thread->slots), std::end(thread->slots), -1);
+        thread->frames.clear();
+        thread->functions.clear();
+    }
+    if (current_perf_thread != nullptr) {
+        OpenGroup(current_perf_thread);
+    }
+}
+
+PerfThread* CurrentPerfThread() {
+    PerfThread* thread = current_perf_thread;
+    if (thread != nullptr) {
+        return thread;
+    }
+    thread = current_perf_thread = new PerfThread();
+    std::lock_guard<std::mutex> lock(ThreadsMutex());
+    OpenGroup(thread);
+    if (perf_threads.load(std::memory_order_relaxed) == nullptr) {
+        OnExit(WritePerfReport);
+        OnFork(ResetPerf);
+    }
+    thread->next = perf_threads.load(std::memory_order_relaxed);
+    perf_threads.store(thread, std::memory_order_release);
+    return thread;
+}
+
+} /* namespace */
+
+void PerfEnter(const char* func, uint64_t func_id) {
+    if (!Enabled()) {
+        return;
+    }
+    PerfThread* thread = CurrentPerfThread();
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    thread->functions[func].func_id = func_id;
+    thread->frames.push_back(PerfFrame{func, Counters{}, Counters{}});
+
+    /* Last, so the bookkeeping above is not counted */
+    if (!Read(thread, thread->frames.back().entry)) {
+        thread->frames.pop_back();
+    }
+}
+
+void PerfLeave(const char* func) {
+    if (!Enabled()) {
+        return;
+    }
+    PerfThread* thread = CurrentPerfThread();
+    Counters now;
+    if (!Read(thread, now)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    /* Frames skipped by unwinding or longjmp are dropped, like in LeaveFunction */
+    auto frame = std::find_if(thread->frames.rbegin(), thread->frames.rend(),
+                              [func](const PerfFrame& candidate) { return candidate.func == func; });
+    if (frame == thread->frames.rend()) {
+        return;
+    }
+    thread->frames.erase(frame.base(), thread->frames.end());
+
+    PerfFrame& current = thread->frames.back();
+    FunctionCounters& function = thread->functions[func];
+    function.calls++;
+    for (uint32_t slot = 0; slot < kEvents; slot++) {
+        uint64_t delta = now.values[slot] - current.entry.values[slot];
+        function.inclusive.values[slot] += delta;
+        function.self.values[slot] += delta > current.children.values[slot] ? delta - current.children.values[slot] : 0;
+        if (thread->frames.size() > 1) {
+            thread->frames[thread->frames.size() - 2].children.values[slot] += delta;
+        }
+    }
+    thread->frames.pop_back();
+}
+
+} /* namespace visual_dump */
@@ -0,0 +1,262 @@
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace visual_dump {
+
+namespace {
+
+std::atomic<ThreadState*> threads_head{nullptr};
+std::atomic<uint32_t> threads_num{0};
+std::atomic<int> process_id{0};
+
+constexpr size_t kMaxExitCallbacks = 32;
+void (*exit_callbacks[kMaxExitCallbacks])();
+size_t exit_callbacks_num = 0;
+std::mutex exit_mutex;
+
+constexpr size_t kMaxForkCallbacks = 32;
+void (*fork_callbacks[kMaxForkCallbacks])();
+size_t fork_callbacks_num = 0;
+std::mutex fork_mutex;
+
+/* Guarded by fork_mutex */
+struct StateMutexes {
+    std::mutex* mutexes;
+    size_t count;
+};
+constexpr size_t kMaxStateMutexes = 32;
+StateMutexes state_mutexes[kMaxStateMutexes];
+size_t state_mutexes_num = 0;
+
+/* ".<pid>" in the report names of the processes that descend from the profiled one, empty in that one */
+char pid_suffix[24];
+
+/* OutputPath() before the process is known */
+std::string ReportPath(const std::string& file_name) {
+    std::string name = file_name;
+    if (pid_suffix[0] != '\0' && file_name != "processes.txt") {
+        size_t extension = name.rfind('.');
+        name.insert(extension != std::string::npos ? extension : name.size(), pid_suffix);
+    }
+
+    const char* dir = getenv("VISUAL_DUMP_DIR");
+    if (dir == nullptr || *dir == '\0') {
+        return name;
+    }
+    return std::string(dir) + "/" + name;
+}
+
+void RunExitCallbacks() {
+    std::lock_guard<std::mutex> lock(exit_mutex);
+    for (size_t i = 0; i < exit_callbacks_num; i++) {
+        exit_callbacks[i]();
+    }
+}
+
+/*
+ * processes.txt: a line per process "pid parent origin command", origin
+ * is root, fork or exec. A single append each, so processes that start
+ * at the same time do not mix their lines.
+ */
+void AddToManifest(const char* origin, bool truncate) {
+    char command[256] = "?";
+    ssize_t length = readlink("/proc/self/exe", command, sizeof(command) - 1);
+    command[length > 0 ? length : 1] = '\0';
+
+    char line[512];
+    int size = snprintf(line, sizeof(line), "%s%d %d %s %s\n",
+                        truncate ? "# pid parent origin command, the others' reports are <report>.<pid>.<ext>\n" : "",
+                        getpid(), getppid(), origin, command);
+    int flags = O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0);
+    int fd = open(ReportPath("processes.txt").c_str(), flags, 0644);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t written = write(fd, line, std::min(static_cast<size_t>(size), sizeof(line) - 1));
+    (void)written;
+    close(fd);
+}
+
+/* Buffered output would be written by the parent and the child */
+void PrepareFork() {
+    fflush(nullptr);
+}
+
+/*
+ * Only the forking thread exists in the child. It becomes the only listed
+ * thread, T0 like the first thread of any process. The others' states are
+ * emptied and unlinked but not freed, a sample taken during the fork may
+ * still walk them.
+ */
+void ChildAfterFork() {
+    process_id.store(getpid(), std::memory_order_relaxed);
+    snprintf(pid_suffix, sizeof(pid_suffix), ".%d", ProcessId());
+    new (&exit_mutex) std::mutex();
+    new (&fork_mutex) std::mutex();
+
+    uint64_t now_ns = NowNs();
+    ThreadState* current = CurrentThread();
+    for (ThreadState* thread = threads_head.load(std::memory_order_acquire); thread != nullptr;
+         thread = thread->next) {
+        thread->tree.ResetCounts();
+        thread->window.Reset();
+        thread->timeline.Clear();
+        if (thread == current) {
+            thread->stack.RestartClocks(now_ns);
+        } else {
+            thread->stack.Clear();
+        }
+    }
+    current->index = 0;
+    current->next = nullptr;
+    threads_head.store(current, std::memory_order_release);
+    threads_num.store(1, std::memory_order_relaxed);
+
+    ResetCallTotals();
+
+    for (size_t i = 0; i < state_mutexes_num; i++) {
+        for (size_t j = 0; j < state_mutexes[i].count; j++) {
+            new (&state_mutexes[i].mutexes[j]) std::mutex();
+        }
+    }
+
+    AddToManifest("fork", false);
+    for (size_t i = 0; i < fork_callbacks_num; i++) {
+        fork_callbacks[i]();
+    }
+}
+
+/*
+ * The profiled process exports its pid, so a process it executes knows
+ * that it descends from it. Runs before the first report path is made,
+ * the static constructors of other modules may ask for one before ours.
+ */
+bool StartProcess() {
+    const char* root = getenv("VISUAL_DUMP_ROOT_PID");
+    if (root == nullptr || *root == '\0') {
+        setenv("VISUAL_DUMP_ROOT_PID", std::to_string(getpid()).c_str(), 1);
+        AddToManifest("root", true);
+    } else if (strtol(root, nullptr, 0) != getpid()) {
+        snprintf(pid_suffix, sizeof(pid_suffix), ".%d", getpid());
+        AddToManifest("exec", false);
+    }
+    pthread_atfork(PrepareFork, nullptr, ChildAfterFork);
+    return true;
+}
+
+void EnsureProcessStarted() {
+    static const bool started = StartProcess();
+    (void)started;
+}
+
+const bool process_started = (EnsureProcessStarted(), true);
+
+RuntimeMode ReadMode() {
+    const char* mode = getenv("VISUAL_DUMP_MODE");
+    if (mode != nullptr && strcmp(mode, "sample") == 0) {
+        return RuntimeMode::Sample;
+    }
+    return RuntimeMode::Trace;
+}
+
+} /* namespace */
+
+/* Hooks may run from other modules' constructors, so nothing here relies on static init order */
+RuntimeMode Mode() {
+    static const RuntimeMode mode = ReadMode();
+    return mode;
+}
+
+ThreadState* CurrentThread() {
+    static thread_local ThreadState* state = nullptr;
+    if (state != nullptr) {
+        return state;
+    }
+
+    /* The first hook fixes the origin, before it takes any timestamp */
+    StartNs();
+    state = new ThreadState();
+    state->index = threads_num.fetch_add(1, std::memory_order_relaxed);
+    ThreadState* head = threads_head.load(std::memory_order_relaxed);
+    do {
+        state->next = head;
+    } while (!threads_head.compare_exchange_weak(head, state, std::memory_order_release));
+    return state;
+}
+
+ThreadState* FirstThread() {
+    return threads_head.load(std::memory_order_acquire);
+}
+
+int ProcessId() {
+    int pid = process_id.load(std::memory_order_relaxed);
+    if (pid == 0) {
+        pid = getpid();
+        process_id.store(pid, std::memory_order_relaxed);
+    }
+    return pid;
+}
+
+uint64_t NowNs() {
+    timespec time{};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000ull + static_cast<uint64_t>(time.tv_nsec);
+}
+
+uint64_t StartNs() {
+    static const uint64_t start_ns = NowNs();
+    return start_ns;
+}
+
+long GetEnvLong(const char* name, long default_value) {
+    const char* value = getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return default_value;
+    }
+    return strtol(value, nullptr, 0);
+}
+
+std::string OutputPath(const std::string& file_name) {
+    EnsureProcessStarted();
+    return ReportPath(file_name);
+}
+
+void OnExit(void (*callback)()) {
+    std::lock_guard<std::mutex> lock(exit_mutex);
+    if (exit_callbacks_num == 0) {
+        atexit(RunExitCallbacks);
+    }
+    if (exit_callbacks_num < kMaxExitCallbacks) {
+        exit_callbacks[exit_callbacks_num++] = callback;
+    }
+}
+
+void OnFork(void (*callback)()) {
+    std::lock_guard<std::mutex> lock(fork_mutex);
+    if (fork_callbacks_num < kMaxForkCallbacks) {
+        fork_callbacks[fork_callbacks_num++] = callback;
+    }
+}
+
+/* Past kMaxStateMutexes the mutexes still work, forked children may deadlock on them */
+std::mutex* NewStateMutexes(size_t count) {
+    auto* mutexes = new std::mutex[count];
+    std::lock_guard<std::mutex> lock(fork_mutex);
+    if (state_mutexes_num < kMaxStateMutexes) {
+        state_mutexes[state_mutexes_num++] = StateMutexes{mutexes, count};
+    }
+    return mutexes;
+}
+
+} /* namespace visual_dump */
@@ -0,0 +1,233 @@
+#include <sampler.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <string>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint32_t kMaxSampleDepth = 128;
+constexpr uint32_t kSampleSlots = 1u << 14;
+constexpr uint32_t kFramesPoolSize = 1u << 20;
+
+/* Unique sampled stack, its frames live in frames_pool */
+struct SampleSlot {
+    uint64_t hash;
+    uint32_t thread;
+    uint32_t depth;
+    uint32_t frames;
+    uint64_t count;
+};
+
+/*
+ * Everything the signal handler touches is preallocated: the handler can
+ * neither allocate nor lock. Only one handler runs at a time, so the table
+ * has a single writer and needs no atomics.
+ */
+SampleSlot sample_slots[kSampleSlots];
+const char* frames_pool[kFramesPoolSize];
+uint32_t frames_pool_used = 0;
+uint64_t samples_num = 0;
+uint64_t samples_dropped = 0;
+
+std::atomic<bool> in_handler{false};
+bool per_thread = false;
+long sample_frequency = 99;
+timer_t sample_timer;
+
+uint64_t HashStack(uint32_t thread, const char* const* frames, uint32_t depth) {
+    uint64_t hash = 0xCBF29CE484222325ull ^ thread;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ reinterpret_cast<uint64_t>(frames[i])) * 0x100000001B3ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+bool SameStack(const SampleSlot& slot, uint32_t thread, const char* const* frames, uint32_t depth) {
+    if (slot.thread != thread || slot.depth != depth) {
+        return false;
+    }
+    for (uint32_t i = 0; i < depth; i++) {
+        if (frames_pool[slot.frames + i] != frames[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RecordStack(uint32_t thread, const char* const* frames, uint32_t depth) {
+    uint64_t hash = HashStack(thread, frames, depth);
+    for (uint32_t probe = 0; probe < kSampleSlots; probe++) {
+        SampleSlot& slot = sample_slots[(hash + probe) & (kSampleSlots - 1)];
+        if (slot.hash == hash && SameStack(slot, thread, frames, depth)) {
+            slot.count++;
+            return;
+        }
+        if (slot.hash != 0) {
+            continue;
+        }
+
+        if (frames_pool_used + depth > kFramesPoolSize) {
+            break;
+        }
+        for (uint32_t i = 0; i < depth; i++) {
+            frames_pool[frames_pool_used + i] = frames[i];
+        }
+        slot = SampleSlot{hash, thread, depth, frames_pool_used, 1};
+        frames_pool_used += depth;
+        return;
+    }
+    samples_dropped++;
+}
+
+/* Wall clock sampling: every thread is sampled, whether it runs or waits */
+void HandleSample(int) {
+    if (in_handler.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+    int saved_errno = errno;
+
+    const char* frames[kMaxSampleDepth];
+    for (ThreadState* thread = FirstThread(); thread != nullptr; thread = thread->next) {
+        uint32_t depth = thread->stack.Depth();
+        if (depth == 0) {
+            continue;
+        }
+
+        /* The outermost frames are kept, so truncated stacks still merge at the root */
+        depth = depth < kMaxSampleDepth ? depth : kMaxSampleDepth;
+        for (uint32_t i = 0; i < depth; i++) {
+            frames[i] = thread->stack.Frame(i).func;
+        }
+        RecordStack(per_thread ? thread->index : 0, frames, depth);
+        samples_num++;
+    }
+
+    errno = saved_errno;
+    in_handler.store(false, std::memory_order_release);
+}
+
+void WriteSamples() {
+    timer_delete(sample_timer);
+    while (in_handler.exchange(true, std::memory_order_acquire)) {
+    }
+
+    /* Direct recursion is folded the same way the call stacks of the tracing mode are */
+    long recursion_depth = GetEnvLong("VISUAL_DUMP_RECURSION_DEPTH", 1);
+    std::map<std::string, uint64_t> stacks;
+    for (const SampleSlot& slot : sample_slots) {
+        if (slot.hash == 0) {
+            continue;
+        }
+
+        std::string path = per_thread ? "thread-" + std::to_string(slot.thread) : "";
+        long recursion = 0;
+        for (uint32_t i = 0; i < slot.depth; i++) {
+            const char* func = frames_pool[slot.frames + i];
+            recursion = i > 0 && frames_pool[slot.frames + i - 1] == func ? recursion + 1 : 1;
+            if (recursion_depth > 0 && recursion > recursion_depth) {
+                continue;
+            }
+            path += path.empty() ? func : std::string(";") + func;
+        }
+        stacks[path] += slot.count;
+    }
+
+    FILE* file = fopen(OutputPath("samples.folded").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    for (const auto& stack : stacks) {
+        fprintf(file, "%s %lu\n", stack.first.c_str(), stack.second);
+    }
+    fclose(file);
+
+    if (samples_dropped != 0) {
+        fprintf(stderr, "[visual_dump] %lu of %lu samples dropped, the sample table is full\n",
+                samples_dropped, samples_num + samples_dropped);
+    }
+}
+
+bool ArmTimer() {
+    sigevent event{};
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_MONOTONIC, &event, &sample_timer) != 0) {
+        perror("[visual_dump] timer_create");
+        return false;
+    }
+
+    long interval_ns = 1000000000l / sample_frequency;
+    itimerspec spec{};
+    spec.it_interval.tv_sec = interval_ns / 1000000000l;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000l;
+    spec.it_value = spec.it_interval;
+    if (timer_settime(sample_timer, 0, &spec, nullptr) != 0) {
+        perror("[visual_dump] timer_settime");
+        timer_delete(sample_timer);
+        return false;
+    }
+    return true;
+}
+
+/* Forked child: timers are not inherited, the samples so far are the parent's */
+void RestartSampler() {
+    in_handler.store(false, std::memory_order_relaxed);
+    for (SampleSlot& slot : sample_slots) {
+        slot = SampleSlot{0, 0, 0, 0, 0};
+    }
+    frames_pool_used = 0;
+    samples_num = 0;
+    samples_dropped = 0;
+    ArmTimer();
+}
+
+bool StartSampler() {
+    if (Mode() != RuntimeMode::Sample) {
+        return false;
+    }
+
+    sample_frequency = GetEnvLong("VISUAL_DUMP_SAMPLE_HZ", 99);
+    sample_frequency = sample_frequency < 1 ? 1 : (sample_frequency > 10000 ? 10000 : sample_frequency);
+    per_thread = GetEnvLong("VISUAL_DUMP_SAMPLE_THREADS", 0) != 0;
+
+    struct sigaction action{};
+    action.sa_handler = HandleSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+        perror("[visual_dump] sigaction");
+        return false;
+    }
+    if (!ArmTimer()) {
+        return false;
+    }
+
+    OnExit(WriteSamples);
+    OnFork(RestartSampler);
+    return true;
+}
+
+const bool started = StartSampler();
+
+} /* namespace */
+
+void SampleEnter(ThreadState* thread, const char* func, uint64_t func_id) {
+    thread->stack.Push(func, func_id);
+}
+
+void SampleLeave(ThreadState* thread, const char* func) {
+    StackFrame* top = thread->stack.Top();
+    if (top != nullptr && top->func != func && !thread->stack.UnwindTo(func)) {
+        return;
+    }
+    thread->stack.Pop();
+}
+
+} /* namespace visual_dump */
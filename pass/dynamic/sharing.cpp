@@ -0,0 +1,289 @@
+#include <profile_data.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+constexpr uint64_t kLineBits = 6;
+constexpr uint32_t kShadowLines = 1u << 14;
+constexpr uint32_t kLineThreads = 4;
+constexpr uint32_t kLineSites = 8;
+constexpr uint32_t kLockStripes = 64;
+
+/* Bytes of the line one thread touched, thread is CurrentThread()->index + 1, 0 for a free slot */
+struct ThreadBytes {
+    uint32_t thread;
+    uint64_t written;
+    uint64_t read;
+    uint64_t writes;
+    uint64_t reads;
+};
+
+struct SiteCount {
+    const SiteInfo* site;
+    uint32_t thread;
+    uint64_t count;
+};
+
+/*
+ * Shadow of one cache line. Transfers approximate the coherence misses:
+ * a write after another thread wrote or read the line, a read of a line
+ * another thread wrote, once per reader until the next write.
+ */
+struct LineShadow {
+    uint64_t line;
+    uint32_t last_writer;
+    uint32_t readers; /* Slots in threads[] that read since the last write */
+    uint64_t transfers;
+    ThreadBytes threads[kLineThreads];
+    SiteCount sites[kLineSites];
+
+    uint32_t ThreadsNum() const {
+        uint32_t threads_num = 0;
+        while (threads_num < kLineThreads && threads[threads_num].thread != 0) {
+            threads_num++;
+        }
+        return threads_num;
+    }
+
+    /* Written by several threads, or written by one and read by another */
+    bool IsShared() const {
+        uint32_t writers = 0;
+        for (uint32_t i = 0; i < ThreadsNum(); i++) {
+            writers += threads[i].writes != 0 ? 1 : 0;
+        }
+        return ThreadsNum() > 1 && writers > 0;
+    }
+
+    /* No byte one thread writes is touched by another */
+    bool IsFalseSharing() const {
+        for (uint32_t i = 0; i < ThreadsNum(); i++) {
+            for (uint32_t j = 0; j < ThreadsNum(); j++) {
+                if (i != j && (threads[i].written & (threads[j].written | threads[j].read)) != 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+/* Per thread sampling state, the countdown is random so loops cannot alias with the period */
+struct Sampler {
+    uint32_t thread{0};
+    uint64_t countdown{0};
+    uint64_t random{0};
+};
+
+std::atomic<LineShadow*> shadow{nullptr};
+std::atomic<uint64_t> dropped{0};
+uint64_t sample_period = 1;
+thread_local Sampler sampler;
+
+std::mutex& ShadowMutex() {
+    static std::mutex* mutex = NewStateMutexes(1);
+    return *mutex;
+}
+
+std::mutex* LockStripes() {
+    static auto* stripes = NewStateMutexes(kLockStripes);
+    return stripes;
+}
+
+uint32_t ShadowIndex(uint64_t line) {
+    return static_cast<uint32_t>((line * 0x9E3779B97F4A7C15ull) >> 32) & (kShadowLines - 1);
+}
+
+uint64_t NextCountdown(Sampler& state) {
+    state.random ^= state.random << 13;
+    state.random ^= state.random >> 7;
+    state.random ^= state.random << 17;
+    return sample_period <= 1 ? 0 : state.random % (2 * sample_period - 1);
+}
+
+/* Caller holds the line's stripe */
+void Record(LineShadow& line, const SiteInfo* site, uint32_t thread, uint64_t bytes, bool is_store) {
+    uint32_t slot = 0;
+    while (slot < kLineThreads && line.threads[slot].thread != 0 && line.threads[slot].thread != thread) {
+        slot++;
+    }
+    if (slot < kLineThreads && line.threads[slot].thread == 0) {
+        line.threads[slot].thread = thread;
+    }
+    uint32_t slot_bit = slot < kLineThreads ? 1u << slot : 0;
+
+    if (is_store) {
+        line.transfers += line.last_writer != 0 && (line.last_writer != thread || (line.readers & ~slot_bit) != 0);
+        line.last_writer = thread;
+        line.readers = 0;
+    } else {
+        line.transfers += line.last_writer != 0 && line.last_writer != thread && (line.readers & slot_bit) == 0;
+        line.readers |= slot_bit;
+    }
+
+    if (slot < kLineThreads) {
+        ThreadBytes& bytes_of_thread = line.threads[slot];
+        (is_store ? bytes_of_thread.written : bytes_of_thread.read) |= bytes;
+        (is_store ? bytes_of_thread.writes : bytes_of_thread.reads)++;
+    }
+    for (SiteCount& site_count : line.sites) {
+        if (site_count.site == nullptr) {
+            site_count = SiteCount{site, thread, 0};
+        }
+        if (site_count.site == site && site_count.thread == thread) {
+            site_count.count++;
+            break;
+        }
+    }
+}
+
+void PrintBytes(FILE* file, uint64_t bytes) {
+    if (bytes == 0) {
+        fputs(" -", file);
+        return;
+    }
+    for (uint32_t first = 0; first < 64; first++) {
+        if ((bytes >> first & 1) == 0 || (first > 0 && (bytes >> (first - 1) & 1) != 0)) {
+            continue;
+        }
+        uint32_t last = first;
+        while (last + 1 < 64 && (bytes >> (last + 1) & 1) != 0) {
+            last++;
+        }
+        fprintf(file, " %u-%u", first, last);
+    }
+}
+
+/*
+ * sharing.txt lists the lines several threads touch, at least one of them
+ * writing, ranked by transfers. sharing.overlay marks the instructions of
+ * the falsely shared ones in dump.dot.
+ */
+void WriteSharingReport() {
+    LineShadow* lines = shadow.load(std::memory_order_acquire);
+    std::vector<const LineShadow*> shared;
+    for (uint32_t i = 0; i < kShadowLines; i++) {
+        std::lock_guard<std::mutex> lock(LockStripes()[i % kLockStripes]);
+        if (lines[i].transfers != 0 && lines[i].IsShared()) {
+            shared.push_back(&lines[i]);
+        }
+    }
+    std::stable_sort(shared.begin(), shared.end(), [](const LineShadow* lhs, const LineShadow* rhs) {
+        return lhs->transfers > rhs->transfers;
+    });
+
+    FILE* report = fopen(OutputPath("sharing.txt").c_str(), "w");
+    FILE* overlay = fopen(OutputPath("sharing.overlay").c_str(), "w");
+    if (report == nullptr || overlay == nullptr) {
+        if (report != nullptr) {
+            fclose(report);
+        }
+        if (overlay != nullptr) {
+            fclose(overlay);
+        }
+        return;
+    }
+
+    long top = GetEnvLong("VISUAL_DUMP_TOP_LINES", 20);
+    fprintf(report, "# Cache lines several threads touch, ranked by sampled transfers between the threads, 1 in %" PRIu64
+                    " accesses\n", sample_period);
+    fprintf(report, "# \"false\": no byte one thread writes is touched by another, padding or per thread copies fix it\n");
+    fprintf(report, "# %" PRIu64 " samples dropped, their shadow slot held another shared line\n", dropped.load());
+    std::set<uint64_t> marked;
+    for (size_t i = 0; i < shared.size() && static_cast<long>(i) < top; i++) {
+        const LineShadow& line = *shared[i];
+        bool is_false = line.IsFalseSharing();
+        fprintf(report, "line 0x%" PRIx64 " %s sharing, transfers %" PRIu64 "\n", line.line << kLineBits,
+                is_false ? "false" : "true", line.transfers);
+        for (uint32_t slot = 0; slot < line.ThreadsNum(); slot++) {
+            const ThreadBytes& thread = line.threads[slot];
+            fprintf(report, "    thread %u writes %" PRIu64 " bytes", thread.thread - 1, thread.writes);
+            PrintBytes(report, thread.written);
+            fprintf(report, ", reads %" PRIu64 " bytes", thread.reads);
+            PrintBytes(report, thread.read);
+            fputs("\n", report);
+        }
+        for (const SiteCount& site_count : line.sites) {
+            if (site_count.site == nullptr) {
+                break;
+            }
+            const SiteInfo& site = *site_count.site;
+            fprintf(report, "    thread %u node_%" PRIu64 " %s %s", site_count.thread - 1, site.id, site.function,
+                    site.text);
+            if (site.file != nullptr) {
+                fprintf(report, " %s:%u", site.file, site.line);
+            }
+            fprintf(report, " samples %" PRIu64 "\n", site_count.count);
+            if (is_false && marked.insert(site.id).second) {
+                fprintf(overlay, "node_%" PRIu64 " xlabel=\"false sharing, line 0x%" PRIx64 "\" color=\"#cc0000\" "
+                                 "penwidth=3\n", site.id, line.line << kLineBits);
+            }
+        }
+    }
+    fclose(report);
+    fclose(overlay);
+}
+
+LineShadow* CreateShadow() {
+    std::lock_guard<std::mutex> lock(ShadowMutex());
+    LineShadow* lines = shadow.load(std::memory_order_relaxed);
+    if (lines == nullptr) {
+        sample_period = static_cast<uint64_t>(std::max(1l, GetEnvLong("VISUAL_DUMP_SHARING_PERIOD", 8)));
+        lines = new LineShadow[kShadowLines]();
+        shadow.store(lines, std::memory_order_release);
+        OnExit(WriteSharingReport);
+    }
+    return lines;
+}
+
+} /* namespace */
+
+} /* namespace visual_dump */
+
+extern "C" void ProfileSharedAccess__(const visual_dump::SiteInfo* site, const void* address) {
+    using namespace visual_dump;
+
+    Sampler& state = sampler;
+    if (state.countdown != 0) {
+        state.countdown--;
+        return;
+    }
+    LineShadow* lines = shadow.load(std::memory_order_acquire);
+    if (lines == nullptr) {
+        lines = CreateShadow();
+    }
+    if (state.thread == 0) {
+        state.thread = CurrentThread()->index + 1;
+        state.random = 0x9E3779B97F4A7C15ull * state.thread;
+    }
+    state.countdown = NextCountdown(state);
+
+    auto raw_address = reinterpret_cast<uint64_t>(address);
+    uint64_t line_number = raw_address >> kLineBits;
+    uint64_t offset = raw_address & ((1u << kLineBits) - 1);
+    uint64_t size = std::min<uint64_t>(std::max(site->attributes & kAccessSizeMask, 1u), 64 - offset);
+    uint64_t bytes = (size == 64 ? ~uint64_t{0} : (uint64_t{1} << size) - 1) << offset;
+
+    uint32_t index = ShadowIndex(line_number);
+    std::lock_guard<std::mutex> lock(LockStripes()[index % kLockStripes]);
+    LineShadow& line = lines[index];
+    if (line.line != line_number) {
+        /* Lines only one thread touched so far are fair game, shared ones stay */
+        if (line.ThreadsNum() > 1) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        line = LineShadow{};
+        line.line = line_number;
+    }
+    Record(line, site, state.thread, bytes, (site->attributes & kStoreAccess) != 0);
+}
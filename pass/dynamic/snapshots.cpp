@@ -0,0 +1,165 @@
+#include <counters.hpp>
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <semaphore.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct WindowFunction {
+    uint64_t calls;
+    uint64_t inclusive_ns;
+    uint64_t entries;
+    uint64_t blocks;
+};
+
+sem_t snapshot_request;
+
+/* Seconds between snapshots, 0 for SIGUSR1 only, negative disables them */
+long SnapshotPeriod() {
+    static const long period = GetEnvLong("VISUAL_DUMP_SNAPSHOT_PERIOD", -1);
+    return period;
+}
+
+void HandleSnapshotSignal(int) {
+    int saved_errno = errno;
+    sem_post(&snapshot_request);
+    errno = saved_errno;
+}
+
+/* Returns what ended the window */
+const char* WaitForSnapshot() {
+    if (SnapshotPeriod() == 0) {
+        while (sem_wait(&snapshot_request) != 0) {
+        }
+        return "signal";
+    }
+
+    timespec deadline{};
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SnapshotPeriod();
+    while (sem_timedwait(&snapshot_request, &deadline) != 0) {
+        if (errno == ETIMEDOUT) {
+            return "timer";
+        }
+    }
+    return "signal";
+}
+
+void WriteWindow(FILE* file, const std::map<std::string, WindowFunction>& functions, uint64_t dropped) {
+    std::vector<std::pair<std::string, WindowFunction>> ranked(functions.begin(), functions.end());
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.inclusive_ns != rhs.second.inclusive_ns ? lhs.second.inclusive_ns > rhs.second.inclusive_ns
+                                                                   : lhs.second.blocks > rhs.second.blocks;
+    });
+
+    fprintf(file, "%12s %12s %12s %14s  %s\n", "calls", "time ms", "entries", "blocks", "function");
+    for (const auto& function : ranked) {
+        const WindowFunction& counts = function.second;
+        if (counts.calls == 0 && counts.entries == 0 && counts.blocks == 0) {
+            continue;
+        }
+        fprintf(file, "%12lu %12.3f %12lu %14lu  %s\n", counts.calls, static_cast<double>(counts.inclusive_ns) / 1e6,
+                counts.entries, counts.blocks, function.first.c_str());
+    }
+    if (dropped != 0) {
+        fprintf(file, "# %lu calls dropped, a thread's window table was full\n", dropped);
+    }
+}
+
+/*
+ * Appends a window to snapshots.txt on every period and SIGUSR1: calls and
+ * inclusive time of the calls that returned within it, from the window
+ * counters of the hooks, and the entries and block executions counted by
+ * the instrumented functions, as differences of the counter tables.
+ */
+void SnapshotLoop() {
+    FILE* file = fopen(OutputPath("snapshots.txt").c_str(), "w");
+    if (file == nullptr) {
+        perror("[visual_dump] snapshots.txt");
+        return;
+    }
+    fprintf(file, "# Windows of VISUAL_DUMP_SNAPSHOT_PERIOD=%ld seconds, SIGUSR1 ends one early\n", SnapshotPeriod());
+    fprintf(file, "# time: inclusive time of the calls that returned in the window, recursion counted once\n\n");
+    fflush(file);
+
+    uint64_t loop_start = NowNs();
+    uint64_t window_start = loop_start;
+    std::map<std::string, CallTotals> previous_calls;
+    std::map<std::string, FunctionExecutions> previous;
+    uint64_t previous_dropped = 0;
+    for (uint32_t window = 0;; window++) {
+        const char* trigger = WaitForSnapshot();
+        uint64_t window_end = NowNs();
+
+        std::map<std::string, WindowFunction> functions;
+        uint64_t dropped = 0;
+        std::map<std::string, CallTotals> calls = CollectCallTotals(dropped);
+        for (const auto& function : calls) {
+            const CallTotals& before = previous_calls[function.first];
+            functions[function.first].calls += function.second.calls - before.calls;
+            functions[function.first].inclusive_ns += function.second.inclusive_ns - before.inclusive_ns;
+        }
+
+        std::map<std::string, FunctionExecutions> executions = ReadExecutions();
+        for (const auto& function : executions) {
+            const FunctionExecutions& before = previous[function.first];
+            functions[function.first].entries += function.second.entries - before.entries;
+            functions[function.first].blocks += function.second.blocks - before.blocks;
+        }
+
+        fprintf(file, "window %u %.3f-%.3f s %s\n", window, static_cast<double>(window_start - loop_start) / 1e9,
+                static_cast<double>(window_end - loop_start) / 1e9, trigger);
+        WriteWindow(file, functions, dropped - previous_dropped);
+        fprintf(file, "\n");
+        fflush(file);
+
+        previous_calls.swap(calls);
+        previous.swap(executions);
+        previous_dropped = dropped;
+        window_start = window_end;
+    }
+}
+
+/* Also in a forked child, which has no snapshot thread and writes snapshots.<pid>.txt */
+void LaunchSnapshotThread() {
+    if (sem_init(&snapshot_request, 0, 0) != 0) {
+        perror("[visual_dump] sem_init");
+        return;
+    }
+    std::thread(SnapshotLoop).detach();
+}
+
+bool StartSnapshots() {
+    if (SnapshotPeriod() < 0) {
+        return false;
+    }
+    LaunchSnapshotThread();
+    OnFork(LaunchSnapshotThread);
+
+    struct sigaction action{};
+    action.sa_handler = HandleSnapshotSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, nullptr) != 0) {
+        perror("[visual_dump] sigaction");
+        return false;
+    }
+    return true;
+}
+
+const bool started = StartSnapshots();
+
+} /* namespace */
+
+} /* namespace visual_dump */
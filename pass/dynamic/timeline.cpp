@@ -0,0 +1,99 @@
+#include <runtime.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace visual_dump {
+
+namespace {
+
+struct ThreadSpan {
+    uint32_t thread;
+    const TimelineSpan* span;
+};
+
+std::string EscapeJson(const char* text) {
+    std::string escaped;
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            escaped += '\\';
+        }
+        escaped += *text;
+    }
+    return escaped;
+}
+
+double Microseconds(uint64_t ns) {
+    return static_cast<double>(ns) / 1e3;
+}
+
+/*
+ * timeline.json in the Chrome trace event format, for chrome://tracing or
+ * Perfetto: one complete event per call, a track per thread, all threads
+ * merged by start time on the clock of the trace log.
+ */
+void WriteTimeline() {
+    std::vector<ThreadSpan> spans;
+    std::vector<uint32_t> threads;
+    uint64_t dropped = 0;
+    for (ThreadState* thread = FirstThread(); thread != nullptr; thread = thread->next) {
+        for (const TimelineSpan& span : thread->timeline.Spans()) {
+            spans.push_back(ThreadSpan{thread->index, &span});
+        }
+        threads.push_back(thread->index);
+        dropped += thread->timeline.Dropped();
+    }
+    if (spans.empty()) {
+        return;
+    }
+    std::stable_sort(spans.begin(), spans.end(), [](const ThreadSpan& lhs, const ThreadSpan& rhs) {
+        return lhs.span->start_ns != rhs.span->start_ns ? lhs.span->start_ns < rhs.span->start_ns
+                                                        : lhs.span->depth < rhs.span->depth;
+    });
+
+    FILE* file = fopen(OutputPath("timeline.json").c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    int pid = getpid();
+    fprintf(file, "{\"traceEvents\":[\n");
+    std::sort(threads.begin(), threads.end());
+    for (uint32_t thread : threads) {
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"T%u\"}},\n",
+                pid, thread, thread);
+    }
+    uint64_t start_ns = StartNs();
+    for (size_t i = 0; i < spans.size(); i++) {
+        const TimelineSpan& span = *spans[i].span;
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}%s\n",
+                EscapeJson(span.func).c_str(), Microseconds(span.start_ns - start_ns),
+                Microseconds(span.end_ns - span.start_ns), pid, spans[i].thread, i + 1 < spans.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+
+    if (dropped != 0) {
+        fprintf(stderr, "[visual_dump] %lu calls missing from the timeline, raise VISUAL_DUMP_TIMELINE_SPANS\n",
+                dropped);
+    }
+}
+
+size_t ReadTimelineCapacity() {
+    if (GetEnvLong("VISUAL_DUMP_TIMELINE", 0) == 0 || Mode() != RuntimeMode::Trace) {
+        return 0;
+    }
+    OnExit(WriteTimeline);
+    return static_cast<size_t>(std::max(GetEnvLong("VISUAL_DUMP_TIMELINE_SPANS", 1l << 20), 1l));
+}
+
+} /* namespace */
+
+size_t TimelineCapacity() {
+    static const size_t capacity = ReadTimelineCapacity();
+    return capacity;
+}
+
+} /* namespace visual_dump */
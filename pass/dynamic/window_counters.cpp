@@ -0,0 +1,57 @@
+#include <runtime.hpp>
+
+#include <mutex>
+#include <new>
+
+namespace visual_dump {
+
+namespace {
+
+std::mutex& CollectMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+/* Never destroyed, a collecting thread may still run during exit */
+std::map<std::string, CallTotals>& Totals() {
+    static auto* totals = new std::map<std::string, CallTotals>();
+    return *totals;
+}
+
+uint64_t dropped_calls = 0;
+
+} /* namespace */
+
+bool WindowCountersEnabled() {
+    static const bool enabled =
+        GetEnvLong("VISUAL_DUMP_SNAPSHOT_PERIOD", -1) >= 0 || GetEnvLong("VISUAL_DUMP_LIVE", 0) != 0;
+    return enabled;
+}
+
+std::map<std::string, CallTotals> CollectCallTotals(uint64_t& dropped) {
+    std::lock_guard<std::mutex> lock(CollectMutex());
+    std::map<std::string, CallTotals>& totals = Totals();
+    for (ThreadState* thread = FirstThread(); thread != nullptr; thread = thread->next) {
+        uint32_t buffer = thread->window.Flip();
+        const WindowEntry* entries = thread->window.Entries(buffer);
+        for (uint32_t slot = 0; slot < WindowCounters::kSlots; slot++) {
+            if (entries[slot].func != nullptr) {
+                CallTotals& function = totals[entries[slot].func];
+                function.calls += entries[slot].calls;
+                function.inclusive_ns += entries[slot].inclusive_ns;
+            }
+        }
+        dropped_calls += thread->window.Dropped(buffer);
+        thread->window.Clear(buffer);
+    }
+    dropped = dropped_calls;
+    return totals;
+}
+
+void ResetCallTotals() {
+    new (&CollectMutex()) std::mutex();
+    Totals().clear();
+    dropped_calls = 0;
+}
+
+} /* namespace visual_dump */
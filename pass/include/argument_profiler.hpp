@@ -0,0 +1,24 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+/*
+ * Value profiling of the arguments of pure functions, to find
+ * memoization and constant specialization candidates. Every call hands
+ * its argument tuple to ProfileArguments__ and every return calls
+ * ProfileArgumentsEnd__, the runtime ranks the functions by how often the
+ * same tuple repeats and how much time the repeats took.
+ */
+class ArgumentProfiler {
+public:
+    static constexpr unsigned kMaxArgs = 4;
+
+    /*
+     * readnone/readonly functions, plus the ones that are pure by
+     * inspection: -O0 code has no inferred attributes, so fact() only
+     * touches its own allocas and calls itself.
+     */
+    static bool IsCandidate(const llvm::Function& func);
+
+    void Instrument(llvm::Function& func);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+
+#include <string>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Value profiling of binary operators. Every selected operator hands its
+ * operands and result to ProfileBinaryOp__, the runtime summarises them
+ * per site into zero/one/power of two frequencies and value ranges, the
+ * input for strength reduction and specialization.
+ */
+class BinaryOpProfiler {
+public:
+    explicit BinaryOpProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    /* opcodes is a comma separated list of opcode names, e.g. "mul,udiv", or "all" */
+    void Instrument(llvm::Function& func, const std::string& opcodes);
+
+private:
+    static bool IsSelected(const llvm::BinaryOperator& binary_op, const std::string& opcodes);
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Branch bias and predictability. Every conditional branch counts its
+ * taken and not taken executions and how often its direction changed
+ * since the previous execution, in plain IR without calls. The runtime
+ * estimates the mispredictions from them, see branches.txt.
+ *
+ * The previous direction is one byte per branch shared by all threads,
+ * so the direction changes of a branch several threads run are approximate.
+ */
+class BranchBias {
+public:
+    explicit BranchBias(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+private:
+    /* A triangle or diamond whose arms are a few side effect free instructions, a select would do */
+    static bool IsSelectCandidate(const llvm::BranchInst& branch);
+
+private:
+    ProfileEmitter& emitter_;
+};
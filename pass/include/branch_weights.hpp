@@ -0,0 +1,32 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+#include <vector>
+
+#include <profile_emitter.hpp>
+#include <profile_reader.hpp>
+
+/*
+ * Self-contained PGO loop. The profile-gen compile counts function entries
+ * and the successors taken by every conditional branch and switch, the
+ * profile-use compile turns the counts into entry counts and !prof
+ * branch_weights. Terminators are identified by their ordinal in the
+ * function, guarded by the CFG checksum.
+ */
+class BranchWeights {
+public:
+    explicit BranchWeights(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+    void Apply(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile);
+
+private:
+    static std::vector<llvm::Instruction*> MultiWayTerminators(llvm::Function& func);
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <runtime.hpp>
+
+#include <map>
+#include <string>
+
+namespace visual_dump {
+
+/* Push the function onto the thread's shadow stack and enter its context */
+void EnterFunction(ThreadState* thread, const char* func, uint64_t func_id);
+
+/* Pop the innermost frame of the function and account its time */
+void LeaveFunction(ThreadState* thread, const char* func);
+
+/*
+ * Leaves the hook work since start_ns out of the time of the innermost
+ * frame and of its callers. The hooks write the trace and read the
+ * counters outside their own clock reads, but within those of the caller.
+ */
+void ExcludeHookTime(ThreadState* thread, uint64_t start_ns);
+
+/* Self time by function name over all the threads, probes removed. Empty unless tracing */
+std::map<std::string, uint64_t> FunctionSelfTimes();
+
+} /* namespace visual_dump */
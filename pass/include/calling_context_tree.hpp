@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace visual_dump {
+
+struct ContextNode {
+    const char* func;
+    uint64_t func_id;
+    uint32_t parent;
+    uint64_t calls;
+    uint64_t folded_calls; /* Calls that shared the node with a recursive parent, not in inclusive_ns */
+    uint64_t inclusive_ns;
+};
+
+/*
+ * Calling context tree stored as a hash trie: every node is found by the
+ * (parent, function) pair, so a call only costs one probe of an open
+ * addressing table instead of a walk over the children.
+ */
+class CallingContextTree {
+public:
+    static constexpr uint32_t kRoot = 0;
+
+    CallingContextTree()
+        : slots_(kInitialSlots, kEmpty) {
+        nodes_.push_back(ContextNode{"<root>", 0, kRoot, 0, 0, 0});
+    }
+
+    uint32_t Child(uint32_t parent, const char* func, uint64_t func_id) {
+        size_t mask = slots_.size() - 1;
+        for (size_t slot = Hash(parent, func) & mask;; slot = (slot + 1) & mask) {
+            uint32_t idx = slots_[slot];
+            if (idx == kEmpty) {
+                break;
+            }
+            if (nodes_[idx].parent == parent && nodes_[idx].func == func) {
+                return idx;
+            }
+        }
+
+        uint32_t idx = static_cast<uint32_t>(nodes_.size());
+        nodes_.push_back(ContextNode{func, func_id, parent, 0, 0, 0});
+        if (nodes_.size() * 2 > slots_.size()) {
+            Rehash(slots_.size() * 2);
+        } else {
+            Insert(idx);
+        }
+        return idx;
+    }
+
+    ContextNode& Node(uint32_t idx) {
+        return nodes_[idx];
+    }
+
+    const ContextNode& Node(uint32_t idx) const {
+        return nodes_[idx];
+    }
+
+    uint32_t Size() const {
+        return static_cast<uint32_t>(nodes_.size());
+    }
+
+    /* Keeps the nodes, the frames on the stack refer to them */
+    void ResetCounts() {
+        for (ContextNode& node : nodes_) {
+            node.calls = 0;
+            node.folded_calls = 0;
+            node.inclusive_ns = 0;
+        }
+    }
+
+private:
+    static constexpr size_t kInitialSlots = 256;
+    enum : uint32_t { kEmpty = UINT32_MAX };
+
+    static size_t Hash(uint32_t parent, const char* func) {
+        uint64_t key = reinterpret_cast<uint64_t>(func) ^ (static_cast<uint64_t>(parent) << 40);
+        key *= 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(key >> 29);
+    }
+
+    void Insert(uint32_t idx) {
+        size_t mask = slots_.size() - 1;
+        size_t slot = Hash(nodes_[idx].parent, nodes_[idx].func) & mask;
+        while (slots_[slot] != kEmpty) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = idx;
+    }
+
+    void Rehash(size_t slots_num) {
+        slots_.assign(slots_num, kEmpty);
+        for (uint32_t idx = 1; idx < nodes_.size(); idx++) {
+            Insert(idx);
+        }
+    }
+
+private:
+    std::vector<ContextNode> nodes_;
+    std::vector<uint32_t> slots_;
+};
+
+} /* namespace visual_dump */
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <profile_data.hpp>
+
+namespace visual_dump {
+
+/* Tables of inline functions are emitted by every module, they are merged by kind, function and hash */
+using CounterKey = std::tuple<uint32_t, std::string, uint64_t>;
+
+struct MergedTable {
+    std::vector<uint64_t> counters;
+    std::vector<std::string> symbols;
+    std::vector<std::map<std::string, uint64_t>> targets;
+    const uint64_t* aux{nullptr}; /* Of the first module that registered the function */
+    uint64_t num_aux{0};
+    const SourceLine* lines{nullptr}; /* Of the same module as aux, CounterKind::LineCounts */
+};
+
+using MergedTables = std::map<CounterKey, MergedTable>;
+
+struct FunctionExecutions {
+    uint64_t entries; /* CounterKind::Branches */
+    uint64_t blocks;  /* CounterKind::InstructionMix */
+};
+
+/* Totals so far by function name, read while the program runs, so a total may lag a few increments */
+std::map<std::string, FunctionExecutions> ReadExecutions();
+
+/* Reports of a single counter kind, written at exit after visual_dump.prof */
+void WriteCoverage(const MergedTables& tables);
+
+void WriteBranchBias(const MergedTables& tables);
+
+void WriteLoopTrips(const MergedTables& tables);
+
+void WriteInstructionMix(const MergedTables& tables);
+
+void WriteLineProfile(const MergedTables& tables);
+
+} /* namespace visual_dump */
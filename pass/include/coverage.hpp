@@ -0,0 +1,33 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
+
+#include <map>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Basic block coverage. Every block starts with a single byte store into
+ * a bitmap shared by the whole module, "bitmap[i] = 1", no calls and no
+ * read-modify-write. The runtime writes the bitmap at exit, see
+ * CounterKind::Coverage.
+ */
+class Coverage {
+public:
+    explicit Coverage(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    /* Reserves the bitmap slots of every function, called from doInitialization */
+    void Begin(llvm::Module& module);
+
+    /* Must run before any instrumentation adds blocks */
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+private:
+    ProfileEmitter& emitter_;
+    llvm::GlobalVariable* bitmap_{nullptr};
+    std::map<const llvm::Function*, std::pair<uint32_t, uint32_t>> slots_; /* First slot and blocks */
+};
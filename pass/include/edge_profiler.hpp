@@ -0,0 +1,46 @@
+#pragma once
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+
+#include <vector>
+
+#include <profile_emitter.hpp>
+#include <profile_reader.hpp>
+
+/*
+ * Edge profiling with optimal counter placement (Knuth; Ball & Larus,
+ * "Optimally profiling and tracing programs"). The edges of a maximum
+ * spanning tree of the CFG, weighted by the static block frequencies, get
+ * no counter. The profile-use compile rebuilds the same tree and recovers
+ * their counts from flow conservation, then attaches entry counts and
+ * branch weights like BranchWeights does.
+ *
+ * A virtual root closes the flow: it enters the entry block, and every
+ * block without successors leaves to it.
+ */
+class EdgeProfiler {
+public:
+    explicit EdgeProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    /* Must run before any instrumentation adds calls or blocks, the tree depends on the static estimates */
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+    void Apply(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile);
+
+private:
+    struct Edge {
+        llvm::BasicBlock* src; /* Null for the virtual root */
+        llvm::BasicBlock* dst; /* Null for the virtual root */
+        uint64_t weight;
+        bool in_tree;
+    };
+
+    /* Edges in a stable order, parallel edges of a switch are one edge. Empty if no tree exists */
+    static std::vector<Edge> SpanningTree(llvm::Function& func);
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Heap allocation call sites. Calls of malloc, calloc, realloc,
+ * aligned_alloc, free and the operator new and delete family are followed
+ * (frees preceded) by ProfileHeap__ with the pointers and the size. The
+ * runtime attributes every allocation to its site and the caller chain on
+ * the shadow stack, the LogCalls hooks maintain it, and tracks the live
+ * bytes per site, see heap.txt.
+ */
+class HeapProfiler {
+public:
+    explicit HeapProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func);
+
+private:
+    /* Argument indices, -1 when the call has none */
+    struct HeapCall {
+        llvm::CallBase* call;
+        visual_dump::HeapOp op;
+        int pointer_arg; /* Freed or reallocated */
+        int size_arg;
+        int count_arg;   /* calloc's element count */
+    };
+
+    /* Recognizes the call by the callee's name, op is None for everything else */
+    static HeapCall Classify(llvm::CallBase* call);
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+
+#include <vector>
+
+#include <profile_emitter.hpp>
+#include <profile_reader.hpp>
+
+/*
+ * Indirect call value profiling. The profile-gen compile gives every
+ * indirect call site a small top-K target cache, the profile-use compile
+ * promotes the dominant targets into guarded direct calls the inliner
+ * can see:
+ *
+ *   if (ptr == @target) call @target(...) else call ptr(...)
+ */
+class IndirectCalls {
+public:
+    explicit IndirectCalls(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+    /* Returns the number of promoted targets */
+    uint32_t Promote(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile,
+                     uint32_t threshold_percent);
+
+private:
+    static std::vector<llvm::CallBase*> IndirectCallSites(llvm::Function& func);
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Executed instruction mix. Every block counts its executions, the pass
+ * records the block's static opcode mix next to the counters, and the
+ * runtime multiplies the two into per function totals by class, see
+ * CounterKind::InstructionMix. One increment per block, no calls.
+ *
+ * The mix is that of the function as the pass sees it, so this mode runs
+ * before the modes that add instructions of their own, and calls of the
+ * hooks never count.
+ */
+class InstructionMix {
+public:
+    explicit InstructionMix(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+    /* kInstructionClasses for phis, debug intrinsics, other free instructions and the earlier modes' probes */
+    static uint32_t Classify(const llvm::Instruction& instruction);
+
+private:
+    ProfileEmitter& emitter_;
+};
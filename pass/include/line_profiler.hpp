@@ -0,0 +1,25 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Source line profile. Every block counts its executions like the
+ * instruction mix, the pass records which source lines the block's
+ * instructions come from, per their !dbg locations, and the runtime turns
+ * the counts into executed instructions and time per line, see
+ * CounterKind::LineCounts. Instructions without a location are not
+ * counted, functions without any are not instrumented.
+ */
+class LineProfiler {
+public:
+    explicit LineProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+private:
+    ProfileEmitter& emitter_;
+};
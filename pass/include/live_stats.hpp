@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace visual_dump {
+
+/*
+ * Layout of the POSIX shared memory segment "/visual_dump.<pid>" the
+ * runtime publishes with VISUAL_DUMP_LIVE=1 and tools/live_top reads: a
+ * header, then capacity slots of which num_slots are in use. A slot's name
+ * is written once before num_slots covers it, its counters are updated
+ * under the slot's sequence lock, so a reader never sees calls and time
+ * of different publishes.
+ */
+constexpr uint32_t kLiveMagic = 0x5644534C; /* "VDSL" */
+constexpr uint32_t kLiveVersion = 1;
+constexpr uint32_t kLiveNameSize = 120;
+
+struct LiveSlot {
+    std::atomic<uint32_t> sequence; /* Odd while the runtime updates the slot */
+    char func[kLiveNameSize];
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> inclusive_ns;
+};
+
+struct LiveHeader {
+    std::atomic<uint32_t> magic; /* Stored last, once the rest is initialized */
+    uint32_t version;
+    uint32_t capacity;
+    std::atomic<uint32_t> num_slots;
+    std::atomic<uint64_t> published_ns; /* CLOCK_MONOTONIC of the last publish */
+    std::atomic<uint64_t> dropped_calls;
+};
+
+inline std::string LiveSegmentName(long pid) {
+    return "/visual_dump." + std::to_string(pid);
+}
+
+inline size_t LiveSegmentSize(uint32_t capacity) {
+    return sizeof(LiveHeader) + capacity * sizeof(LiveSlot);
+}
+
+inline LiveSlot* LiveSlots(LiveHeader* header) {
+    return reinterpret_cast<LiveSlot*>(header + 1);
+}
+
+/* Single writer */
+inline void PublishSlot(LiveSlot& slot, uint64_t calls, uint64_t inclusive_ns) {
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.calls.store(calls, std::memory_order_relaxed);
+    slot.inclusive_ns.store(inclusive_ns, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+/* False while the writer is in the middle of an update, retry then */
+inline bool ReadSlot(const LiveSlot& slot, uint64_t& calls, uint64_t& inclusive_ns) {
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if ((sequence & 1) != 0) {
+        return false;
+    }
+    calls = slot.calls.load(std::memory_order_relaxed);
+    inclusive_ns = slot.inclusive_ns.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+} /* namespace visual_dump */
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstrTypes.h>
+
+#include <vector>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Lock contention. Calls of the pthread mutex, rwlock and condition
+ * variable functions and of std::mutex and std::recursive_mutex are
+ * recognized by name and wrapped with probes:
+ *   ProfileLockBegin__ before an acquisition or a condition wait,
+ *   ProfileLockEnd__ after it, with whether the lock is now held,
+ *   ProfileLockRelease__ before a release.
+ * The runtime turns them into wait and hold times per lock and site and
+ * into a lock order graph, see locks.txt and locks.dot.
+ *
+ * The inline std::mutex members call pthread through __gthread wrappers,
+ * and std::lock_guard, std::unique_lock and std::scoped_lock call the
+ * std::mutex members. Their bodies are left alone and the calls of their
+ * constructors, destructors and lock members are probed instead, so every
+ * acquisition counts once, at the user's call site.
+ */
+class LockProfiler {
+public:
+    explicit LockProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func);
+
+private:
+    /* Where the locks of a call are, the RAII objects by their libstdc++ layouts */
+    enum class LockSource {
+        Argument,        /* The mutex, rwlock or std::mutex is lock_arg */
+        Arguments,       /* lock_arg and every pointer argument after it, the scoped_lock constructor */
+        Guard,           /* lock_arg is a lock_guard or scoped_lock, nothing but references to its mutexes */
+        UniqueLock,      /* lock_arg is a unique_lock, its mutex pointer comes first */
+        OwnedUniqueLock, /* Same, the mutex only while the unique_lock owns it */
+    };
+
+    struct LockCall {
+        llvm::CallBase* call;
+        visual_dump::LockOp op;
+        unsigned lock_arg;
+        LockSource source;
+    };
+
+    /* Recognizes the call by the callee's name, op is None for everything else */
+    static LockCall Classify(llvm::CallBase* call);
+
+    /* The locks of the call, as i8*, emitted at the builder's insert point */
+    static std::vector<llvm::Value*> Locks(llvm::IRBuilder<>& builder, const LockCall& lock_call);
+
+private:
+    ProfileEmitter& emitter_;
+};
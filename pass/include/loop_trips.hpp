@@ -0,0 +1,36 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+#include <map>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Loop trip counts. Every loop keeps its trip count, the executions of
+ * its header since it was entered, in a stack slot. The entering edges
+ * count the entries and reset it, the exit edges fold it into a log2
+ * histogram with its sum, min and max, all inline.
+ *
+ * Leaving a loop by returning from inside it, longjmp or an exception
+ * skips the exit edges, loops.txt reports those entries as unfinished.
+ */
+class LoopTrips {
+public:
+    explicit LoopTrips(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    /*
+     * Before any mode instruments the function: a loop is the dump.dot node
+     * of the first instruction its header had, the modes insert theirs in
+     * front of it.
+     */
+    void Begin(llvm::Function& func);
+
+    void Instrument(llvm::Function& func, uint64_t hash);
+
+private:
+    ProfileEmitter& emitter_;
+    std::map<const llvm::BasicBlock*, const llvm::Instruction*> first_instructions_;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+
+#include <string>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Loads and stores. Every load and store of the selected functions hands
+ * its site and address to a hook:
+ *   ProfileMemoryAccess__ records bursts of consecutive accesses per thread
+ *   and derives stride histograms, cache line reuse distances and page
+ *   spread from them, see memory.txt.
+ *   ProfileSharedAccess__ samples the accesses into a shadow table indexed
+ *   by cache line to find the lines several threads write, see sharing.txt.
+ * Stack slots and thread locals are left out, no other thread sees them
+ * and they are not what a re-layout is about.
+ */
+class MemoryProfiler {
+public:
+    explicit MemoryProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    /* functions is a comma separated list of function names, or "all", hook one of the above */
+    void Instrument(llvm::Function& func, const std::string& functions, const char* hook);
+
+private:
+    static bool IsSelected(const llvm::Function& func, const std::string& functions);
+
+private:
+    ProfileEmitter& emitter_;
+};
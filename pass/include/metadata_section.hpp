@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+namespace visual_dump {
+
+/*
+ * Layout of the .visual_dump section. Every instrumented module emits one
+ * record describing the ids its hooks pass to the runtime, the linker
+ * concatenates them, so tools/symbolize reads the names and locations
+ * straight from the binary. A record is a header, num_functions
+ * MetadataFunction, num_sites MetadataSite, then strings_size bytes of
+ * strings, padded to 8 bytes. Strings are offsets into the record's
+ * strings, 0 is the empty one.
+ *
+ * Ids are the addresses of the functions and instructions in the pass,
+ * unique within a compiler process only, so two modules may describe the
+ * same id.
+ */
+constexpr const char* kMetadataSection = ".visual_dump";
+constexpr uint32_t kMetadataMagic = 0x444D4456; /* "VDMD" */
+constexpr uint32_t kMetadataVersion = 1;
+
+struct MetadataHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; /* Of the whole record */
+    uint32_t num_functions;
+    uint32_t num_sites;
+    uint32_t strings_size;
+    uint32_t module; /* Module identifier, usually the source file */
+};
+
+struct MetadataFunction {
+    uint64_t id;
+    uint32_t name;
+    uint32_t file;
+    uint32_t line;
+    uint32_t reserved;
+};
+
+struct MetadataSite {
+    uint64_t id;
+    uint64_t function; /* Id of the function it is in */
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    uint32_t text; /* What the hooks see there, e.g. "call foo" */
+};
+
+} /* namespace visual_dump */
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+
+#include <vector>
+
+#include <profile_emitter.hpp>
+
+/*
+ * Ball-Larus path profiling ("Efficient path profiling", MICRO 1996).
+ * Back edges are replaced by a dummy edge from the virtual entry to the
+ * loop header plus one from the latch to the virtual exit, which leaves a
+ * DAG. Every DAG edge gets a value such that the sums along the paths from
+ * entry to exit are exactly 0..paths-1. A path register accumulates the
+ * values, and the path is counted by ProfilePath__ at every return and
+ * back edge.
+ *
+ * The hook also gets the DAG, so the runtime can turn path numbers back
+ * into blocks, see visual_dump::PathEdgeKind.
+ */
+class PathProfiler {
+public:
+    explicit PathProfiler(ProfileEmitter& emitter)
+        : emitter_(emitter) {
+    }
+
+    void Instrument(llvm::Function& func);
+
+private:
+    struct DagEdge {
+        uint32_t dst;
+        visual_dump::PathEdgeKind kind;
+        uint64_t value;
+    };
+
+private:
+    ProfileEmitter& emitter_;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <runtime.hpp>
+
+namespace visual_dump {
+
+/*
+ * Hardware counters per function, enabled with VISUAL_DUMP_PERF=1 in the
+ * trace mode. Every thread opens cycles, instructions, cache misses and
+ * branch misses as one perf_event_open group, a software event stands in
+ * for an unavailable hardware one. The entry and exit hooks read the
+ * group, the deltas go to the function, see perf.txt.
+ */
+void PerfEnter(const char* func, uint64_t func_id);
+
+void PerfLeave(const char* func);
+
+} /* namespace visual_dump */
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+
+#include <site_info.hpp>
+
+namespace visual_dump {
+
+enum class CounterKind : uint32_t {
+    /* Entry count, then one counter per successor of every multi-way terminator */
+    Branches = 1,
+    /* Per indirect call site: total calls, then (target, calls) pairs of the top targets */
+    IndirectCalls = 2,
+    /* Address-taken function, "counters" is the function itself, used to symbolize targets */
+    FunctionAddress = 3,
+    /* One byte per basic block, non-zero once the block ran. Aux: function id, then <instructions, ids...> per block */
+    Coverage = 4,
+    /* Counts of the CFG edges outside the spanning tree, see EdgeProfiler */
+    EdgeCounts = 5,
+    /* Per conditional branch: taken, not taken, direction changes. Aux: <node id, line, flags> per branch */
+    BranchBias = 6,
+    /*
+     * Per loop: entries, exits, sum of trips, max trips, ~min trips, then a
+     * histogram of trips by log2. Aux: <node id, line> per loop
+     */
+    LoopTrips = 7,
+    /* Executions of every basic block. Aux: the block's static InstructionClass counts, kInstructionClasses each */
+    InstructionMix = 8,
+    /*
+     * Executions of every basic block. Aux: per block <lines>, then <line, instructions> per source line
+     * of the block, where line indexes the SourceLines table of the same module
+     */
+    LineCounts = 9,
+    /* The module's deduplicated source locations, "counters" is an array of SourceLine, never counted */
+    SourceLines = 10,
+};
+
+/* Opcode classes of CounterKind::InstructionMix, vector instructions count as Vector only */
+enum InstructionClass : uint32_t {
+    kIntegerOps = 0,
+    kFloatOps = 1,
+    kLoads = 2,
+    kStores = 3, /* Atomic read-modify-writes included */
+    kBranches = 4,
+    kCalls = 5,
+    kVectorOps = 6,
+    kInstructionClasses = 7,
+};
+
+constexpr uint32_t kIndirectCallTargets = 4;
+constexpr uint32_t kIndirectCallSiteSize = 1 + 2 * kIndirectCallTargets;
+
+constexpr uint32_t kBranchBiasSiteSize = 3;
+constexpr uint32_t kBranchBiasAuxSize = 3;
+constexpr uint64_t kBranchSelectCandidate = 1; /* Both arms are small and side effect free */
+
+constexpr uint32_t kLoopTripBuckets = 16; /* 1, 2-3, 4-7, ..., the last one takes the rest */
+constexpr uint32_t kLoopSiteSize = 5 + kLoopTripBuckets;
+constexpr uint32_t kLoopAuxSize = 2;
+
+/* Entry of a CounterKind::SourceLines table */
+struct SourceLine {
+    const char* file; /* With the compile directory when the debug info has it */
+    uint32_t line;
+    uint32_t column;
+};
+
+/* SiteInfo::attributes of a binary operator: the operand width in bits, or'ed with kFloatOperands */
+constexpr uint32_t kOperandBitsMask = 0xFFFF;
+constexpr uint32_t kFloatOperands = 1u << 16;
+
+/* SiteInfo::attributes of a load or store: the access size in bytes, or'ed with kStoreAccess */
+constexpr uint32_t kAccessSizeMask = 0xFFFF;
+constexpr uint32_t kStoreAccess = 1u << 16;
+
+/* SiteInfo::attributes of a heap call */
+enum class HeapOp : uint32_t {
+    None = 0,
+    Allocate = 1,   /* malloc, calloc, aligned_alloc, operator new */
+    Reallocate = 2,
+    Free = 3,       /* free, operator delete */
+};
+
+/* SiteInfo::attributes of a lock call */
+enum class LockOp : uint32_t {
+    None = 0,
+    Lock = 1,     /* Blocks until acquired, a timed lock may still fail */
+    TryLock = 2,  /* Never waits */
+    Unlock = 3,
+    CondWait = 4, /* Releases the mutex while waiting, holds it again on return */
+};
+
+/*
+ * Path profiling DAG of a function, an array of uint64_t handed to
+ * ProfilePath__. With N blocks, vertex N is the virtual entry and N + 1
+ * the virtual exit:
+ *   <N>, then per vertex 0..N+1: <edges> and <dst, kind, value> per edge,
+ *   then per block: <instructions> and their dump.dot node ids
+ */
+enum class PathEdgeKind : uint64_t {
+    Real = 0,
+    LoopEntry = 1, /* Virtual entry to a loop header, stands for a back edge */
+    LoopExit = 2,  /* Latch to the virtual exit, stands for a back edge */
+};
+
+/*
+ * Counters of one function. The pass emits an array of these per module
+ * and hands it to RegisterCounters__ from a module constructor, the
+ * runtime writes them to visual_dump.prof at exit.
+ * The layout must match ProfileEmitter::GetTableType().
+ */
+struct CounterTable {
+    uint32_t kind;
+    uint32_t num_counters;
+    uint64_t hash;          /* CFG checksum, a stale profile is never applied */
+    const char* function;
+    void* counters;
+    const uint64_t* aux;    /* Kind specific static data, may be null */
+    uint64_t num_aux;
+};
+
+} /* namespace visual_dump */
+
+extern "C" void RegisterCounters__(const visual_dump::CounterTable* tables, uint64_t num_tables);
+
+/* Updates the target cache of an IndirectCalls site */
+extern "C" void ProfileIndirectCall__(uint64_t* site, void* target);
+
+/* Records the operands and the result of a binary operator, zero extended, floats as their bits */
+extern "C" void ProfileBinaryOp__(const visual_dump::SiteInfo* site, uint64_t lhs, uint64_t rhs, uint64_t result);
+
+/* Records the address of a load or store, sampled in bursts */
+extern "C" void ProfileMemoryAccess__(const visual_dump::SiteInfo* site, const void* address);
+
+/* Records a load or store in the cache line shadow table, sampled */
+extern "C" void ProfileSharedAccess__(const visual_dump::SiteInfo* site, const void* address);
+
+/* Reports a heap call: the freed or reallocated pointer, the allocated one and its size, see HeapOp */
+extern "C" void ProfileHeap__(const visual_dump::SiteInfo* site, void* old_pointer, void* new_pointer, uint64_t size);
+
+/* Probes around a lock call, see LockOp. acquired: the call returned with the lock held */
+extern "C" void ProfileLockBegin__(const visual_dump::SiteInfo* site, void* lock);
+extern "C" void ProfileLockEnd__(const visual_dump::SiteInfo* site, void* lock, int32_t acquired);
+extern "C" void ProfileLockRelease__(const visual_dump::SiteInfo* site, void* lock);
+
+/* Counts a Ball-Larus path of the function described by site and graph */
+extern "C" void ProfilePath__(const visual_dump::SiteInfo* site, const uint64_t* graph, uint64_t path);
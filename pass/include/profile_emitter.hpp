@@ -0,0 +1,120 @@
+#pragma once
+
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <profile_data.hpp>
+#include <site_info.hpp>
+
+/*
+ * Owns the counter arrays the instrumentation modes add to a module and
+ * emits the constructor that registers them with the runtime.
+ */
+class ProfileEmitter {
+public:
+    /* CFG checksum, must be taken before any instrumentation splits edges */
+    static uint64_t FunctionHash(const llvm::Function& func);
+
+    /* Adds a zeroed array of num_counters elements of counter_type for the function */
+    llvm::GlobalVariable* AddCounters(llvm::Function& func, uint64_t hash, visual_dump::CounterKind kind,
+                                      uint32_t num_counters, llvm::Type* counter_type = nullptr,
+                                      const std::vector<uint64_t>& aux = {});
+
+    /* Registers counters that live elsewhere, e.g. a slice of a module wide array */
+    void AddTable(llvm::Function& func, uint64_t hash, visual_dump::CounterKind kind, llvm::Constant* counters,
+                  uint32_t num_counters, const std::vector<uint64_t>& aux = {});
+
+    /* Lets the runtime symbolize the function's address, see CounterKind::FunctionAddress */
+    void AddFunctionAddress(llvm::Function& func);
+
+    /* Emits a visual_dump::SiteInfo constant describing the instruction, returns it as i8* */
+    llvm::Constant* AddSiteInfo(llvm::Instruction& instruction, const std::string& text, uint32_t attributes);
+
+    /* Same for a function, located at its definition */
+    llvm::Constant* AddSiteInfo(llvm::Function& func, const std::string& text, uint32_t attributes);
+
+    /* Index of the location in the module's SourceLines table, see CounterKind::LineCounts */
+    uint32_t AddSourceLine(const llvm::DILocation& location);
+
+    /* Describes the id of the function in the module's .visual_dump section, see metadata_section.hpp */
+    void DescribeFunction(llvm::Function& func);
+
+    /* Same for an instruction whose id a hook gets, text says what the hook sees there */
+    void DescribeSite(llvm::Instruction& instruction, const std::string& text);
+
+    /*
+     * Whether the callee is a runtime hook, like the ProfileIndirectCall__ a
+     * mode inserts: a declaration whose name ends in "__". Calls of hooks are
+     * not part of the program and are never logged or counted.
+     */
+    static bool IsHook(const llvm::Function* callee);
+
+    /* Whether code can be placed on a CFG edge, see EdgeInsertPoint */
+    static bool CanInstrumentEdge(llvm::BasicBlock* src, llvm::BasicBlock* dst);
+
+    /*
+     * Where code runs exactly when the edge is taken: the end of the source
+     * or the start of the destination when it is private to the edge,
+     * otherwise the critical edge is split. Parallel edges count as one.
+     */
+    static llvm::Instruction* EdgeInsertPoint(llvm::BasicBlock* src, llvm::BasicBlock* dst);
+
+    /* Emits "counters[idx] += 1" at the builder's insert point */
+    static void Increment(llvm::IRBuilder<>& builder, llvm::GlobalVariable* counters, llvm::Value* idx);
+
+    /* Emits the tables and their registration and the metadata, called from doFinalization */
+    void Finalize(llvm::Module& module);
+
+private:
+    static llvm::StructType* GetTableType(llvm::LLVMContext& context);
+    static llvm::StructType* GetSiteInfoType(llvm::LLVMContext& context);
+
+    llvm::Constant* AddSiteInfo(llvm::Module& module, uint64_t id, const std::string& function,
+                                const llvm::DILocation* location, const std::string& text, uint32_t attributes);
+
+    /* One private string per name, shared by all the sites */
+    llvm::Constant* GetString(llvm::Module& module, const std::string& str);
+
+    void EmitMetadata(llvm::Module& module);
+
+    /* Adds the SourceLines table of the module to the tables */
+    void EmitSourceLines(llvm::Module& module);
+
+private:
+    struct Table {
+        visual_dump::CounterKind kind;
+        uint64_t hash;
+        std::string function;
+        llvm::Constant* counters;
+        uint32_t num_counters;
+        std::vector<uint64_t> aux;
+    };
+
+    struct FunctionMetadata {
+        std::string name;
+        std::string file;
+        uint32_t line;
+    };
+
+    struct SiteMetadata {
+        uint64_t function;
+        std::string file;
+        uint32_t line;
+        uint32_t column;
+        std::string text;
+    };
+
+    std::vector<Table> tables_;
+    std::map<std::pair<const llvm::Module*, std::string>, llvm::Constant*> strings_;
+    std::map<uint64_t, FunctionMetadata> functions_;
+    std::map<uint64_t, SiteMetadata> sites_;
+    std::map<std::tuple<std::string, uint32_t, uint32_t>, uint32_t> source_lines_;
+};
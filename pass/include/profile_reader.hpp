@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <profile_data.hpp>
+
+namespace visual_dump {
+
+struct ProfileRecord {
+    uint64_t hash{0};
+    std::vector<uint64_t> counters;
+    std::vector<std::string> symbols; /* Counters holding code addresses are written symbolized */
+};
+
+/*
+ * Reads visual_dump.prof, one record per line:
+ *   <kind> <function> <hash> <num counters> <counter or symbol>...
+ */
+class ProfileReader {
+public:
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::istringstream stream(line);
+            uint32_t kind = 0;
+            std::string function;
+            ProfileRecord record;
+            size_t num_counters = 0;
+            if (!(stream >> kind >> function >> std::hex >> record.hash >> std::dec >> num_counters)) {
+                continue;
+            }
+
+            record.counters.resize(num_counters, 0);
+            record.symbols.resize(num_counters);
+            for (size_t i = 0; i < num_counters; i++) {
+                std::string value;
+                stream >> value;
+                if (!value.empty() && value[0] >= '0' && value[0] <= '9') {
+                    record.counters[i] = std::stoull(value);
+                } else {
+                    record.symbols[i] = value;
+                }
+            }
+            records_[std::make_pair(kind, function)] = std::move(record);
+        }
+        return true;
+    }
+
+    const ProfileRecord* Find(CounterKind kind, const std::string& function) const {
+        auto record = records_.find(std::make_pair(static_cast<uint32_t>(kind), function));
+        return record != records_.end() ? &record->second : nullptr;
+    }
+
+    const std::map<std::pair<uint32_t, std::string>, ProfileRecord>& Records() const {
+        return records_;
+    }
+
+private:
+    std::map<std::pair<uint32_t, std::string>, ProfileRecord> records_;
+};
+
+} /* namespace visual_dump */
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <calling_context_tree.hpp>
+#include <shadow_stack.hpp>
+#include <timeline.hpp>
+#include <window_counters.hpp>
+
+namespace visual_dump {
+
+/*
+ * Everything the hooks of one thread touch. It is allocated on the first
+ * hook the thread executes and never freed, so the reports written at exit
+ * still see the threads that are already gone.
+ */
+struct ThreadState {
+    uint32_t index{0};
+    ShadowStack stack;
+    CallingContextTree tree;
+    WindowCounters window;
+    Timeline timeline;
+    ThreadState* next{nullptr};
+};
+
+enum class RuntimeMode {
+    Trace = 0,  /* Log every event and time every call */
+    Sample = 1, /* Hooks only maintain the shadow stack, a timer samples it */
+};
+
+/* Selected with VISUAL_DUMP_MODE=trace|sample, tracing by default */
+RuntimeMode Mode();
+
+/* State of the calling thread, created on demand */
+ThreadState* CurrentThread();
+
+/* Head of the list of all threads of this process that have ever executed a hook */
+ThreadState* FirstThread();
+
+/* getpid() without the system call, the trace log tags its events with it */
+int ProcessId();
+
+uint64_t NowNs();
+
+/* NowNs() when the runtime started, the origin of the trace log and timeline timestamps */
+uint64_t StartNs();
+
+long GetEnvLong(const char* name, long default_value);
+
+/*
+ * Path of a report file, VISUAL_DUMP_DIR selects the directory. Processes
+ * forked or executed from the profiled one insert their pid before the
+ * extension, "cct.dot" becomes "cct.<pid>.dot", processes.txt maps them.
+ */
+std::string OutputPath(const std::string& file_name);
+
+/* Callbacks run once at process exit in the order of registration */
+void OnExit(void (*callback)());
+
+/*
+ * Callbacks run in the child after fork(), in the order of registration,
+ * after the thread states are reset. The child only has the forking
+ * thread, locks the other threads held stay locked: a callback does not
+ * take them, it reinitializes them.
+ */
+void OnFork(void (*callback)());
+
+/*
+ * Mutexes for the state the hooks of a module share. That state is created
+ * on first use and never destroyed: hooks run from other modules'
+ * constructors, before the statics here may be initialized, and the
+ * reports are written from atexit, after the static destructors may have
+ * run. Its mutexes are created the same way, and a forked child
+ * reinitializes them before the OnFork callbacks run.
+ */
+std::mutex* NewStateMutexes(size_t count);
+
+} /* namespace visual_dump */
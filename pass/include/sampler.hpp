@@ -0,0 +1,15 @@
+#pragma once
+
+#include <runtime.hpp>
+
+namespace visual_dump {
+
+/*
+ * Hooks of the sampling mode: only the shadow stack is maintained, the
+ * SIGPROF handler of a VISUAL_DUMP_SAMPLE_HZ timer reads it.
+ */
+void SampleEnter(ThreadState* thread, const char* func, uint64_t func_id);
+
+void SampleLeave(ThreadState* thread, const char* func);
+
+} /* namespace visual_dump */
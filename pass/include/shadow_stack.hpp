@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace visual_dump {
+
+struct StackFrame {
+    const char* func;
+    uint64_t func_id;
+    uint64_t enter_ns;
+    uint64_t untimed_ns; /* Hook work within the frame's clock reads, trace output and counter reads */
+    uint32_t node;      /* Calling context the frame accounts to */
+    uint32_t recursion; /* Length of the run of direct recursive frames */
+    bool folded;        /* Frame shares the context of its recursive parent */
+};
+
+/*
+ * Fixed capacity stack of the functions a thread is currently in.
+ * Frames are written before the depth is published, so another thread
+ * may read the function names of [0, Depth()) at any moment.
+ */
+class ShadowStack {
+public:
+    static constexpr uint32_t kMaxDepth = 1024;
+
+    StackFrame* Push(const char* func, uint64_t func_id) {
+        uint32_t depth = depth_.load(std::memory_order_relaxed);
+        StackFrame* frame = nullptr;
+        if (depth < kMaxDepth) {
+            frame = &frames_[depth];
+            frame->func = func;
+            frame->func_id = func_id;
+        }
+        depth_.store(depth + 1, std::memory_order_release);
+        return frame;
+    }
+
+    /* Returns nullptr for frames that did not fit into the stack */
+    StackFrame* Pop() {
+        uint32_t depth = depth_.load(std::memory_order_relaxed);
+        if (depth == 0) {
+            return nullptr;
+        }
+        depth_.store(depth - 1, std::memory_order_release);
+        return depth - 1 < kMaxDepth ? &frames_[depth - 1] : nullptr;
+    }
+
+    StackFrame* Top() {
+        uint32_t depth = depth_.load(std::memory_order_relaxed);
+        if (depth == 0 || depth > kMaxDepth) {
+            return nullptr;
+        }
+        return &frames_[depth - 1];
+    }
+
+    /*
+     * Pops the frames above the innermost frame of the function. Used to
+     * resync after the frames were skipped by unwinding or longjmp.
+     */
+    bool UnwindTo(const char* func) {
+        uint32_t depth = Depth();
+        while (depth > 0 && frames_[depth - 1].func != func) {
+            depth--;
+        }
+        if (depth == 0) {
+            return false;
+        }
+        while (Depth() > depth) {
+            Pop();
+        }
+        return true;
+    }
+
+    /* A forked child keeps the frames of the forking thread, timed from the fork on */
+    void RestartClocks(uint64_t now_ns) {
+        for (uint32_t idx = 0; idx < Depth(); idx++) {
+            frames_[idx].enter_ns = now_ns;
+            frames_[idx].untimed_ns = 0;
+        }
+    }
+
+    /* The threads that did not fork are gone in the child */
+    void Clear() {
+        depth_.store(0, std::memory_order_release);
+    }
+
+    uint32_t Depth() const {
+        uint32_t depth = depth_.load(std::memory_order_acquire);
+        return depth < kMaxDepth ? depth : kMaxDepth;
+    }
+
+    const StackFrame& Frame(uint32_t idx) const {
+        return frames_[idx];
+    }
+
+private:
+    StackFrame frames_[kMaxDepth];
+    std::atomic<uint32_t> depth_{0};
+};
+
+} /* namespace visual_dump */
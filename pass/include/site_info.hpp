@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace visual_dump {
+
+/*
+ * Static description of an instrumented instruction. The pass emits one
+ * private constant per site and hands its address to the hooks, so the
+ * runtime can name a site without any lookup.
+ * The layout must match ProfileEmitter::GetSiteInfoType().
+ */
+struct SiteInfo {
+    uint64_t id;            /* Address of the instruction in the pass, its node in dump.dot */
+    const char* function;
+    const char* file;       /* Null without debug info */
+    uint32_t line;
+    uint32_t attributes;    /* Kind specific */
+    const char* text;       /* Kind specific, e.g. the opcode */
+};
+
+} /* namespace visual_dump */
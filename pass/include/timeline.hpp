@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace visual_dump {
+
+/* A finished call, times in NowNs() */
+struct TimelineSpan {
+    const char* func;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t depth;
+};
+
+/* Calls of one thread in the order they returned, up to VISUAL_DUMP_TIMELINE_SPANS */
+class Timeline {
+public:
+    void Record(const char* func, uint64_t start_ns, uint64_t end_ns, uint32_t depth, size_t capacity) {
+        if (spans_.size() < capacity) {
+            spans_.push_back(TimelineSpan{func, start_ns, end_ns, depth});
+        } else {
+            dropped_++;
+        }
+    }
+
+    const std::vector<TimelineSpan>& Spans() const {
+        return spans_;
+    }
+
+    uint64_t Dropped() const {
+        return dropped_;
+    }
+
+    void Clear() {
+        spans_.clear();
+        dropped_ = 0;
+    }
+
+private:
+    std::vector<TimelineSpan> spans_;
+    uint64_t dropped_{0};
+};
+
+/* Spans a thread keeps with VISUAL_DUMP_TIMELINE=1, zero when the timeline is off */
+size_t TimelineCapacity();
+
+} /* namespace visual_dump */
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace visual_dump {
+
+struct WindowEntry {
+    const char* func;
+    uint64_t calls;
+    uint64_t inclusive_ns;
+};
+
+/*
+ * Calls and times of one thread since the last snapshot, double buffered:
+ * the hooks write the active buffer, the snapshot thread flips it and
+ * reads the other one. The hooks never wait, only the snapshot thread
+ * spins while a hook may still be writing the buffer it just retired.
+ */
+class WindowCounters {
+public:
+    static constexpr uint32_t kSlots = 256;
+
+    void Record(const char* func, uint64_t inclusive_ns) {
+        uint32_t sequence = writing_.load(std::memory_order_relaxed);
+        writing_.store(sequence + 1, std::memory_order_seq_cst);
+
+        uint32_t buffer = active_.load(std::memory_order_seq_cst);
+        WindowEntry* entries = buffers_[buffer];
+        size_t slot = (reinterpret_cast<uint64_t>(func) * 0x9E3779B97F4A7C15ull) >> 56;
+        for (uint32_t probe = 0; probe < kSlots; probe++, slot = (slot + 1) & (kSlots - 1)) {
+            WindowEntry& entry = entries[slot];
+            if (entry.func == nullptr) {
+                entry.func = func;
+            }
+            if (entry.func == func) {
+                entry.calls++;
+                entry.inclusive_ns += inclusive_ns;
+                break;
+            }
+            if (probe == kSlots - 1) {
+                dropped_[buffer]++;
+            }
+        }
+
+        writing_.store(sequence + 2, std::memory_order_release);
+    }
+
+    /* Snapshot thread only: retires the active buffer and returns it, Clear() it once read */
+    uint32_t Flip() {
+        uint32_t retired = active_.load(std::memory_order_relaxed);
+        active_.store(retired ^ 1, std::memory_order_seq_cst);
+
+        /* A hook that began before the flip may still write the retired buffer */
+        uint32_t sequence = writing_.load(std::memory_order_seq_cst);
+        while ((sequence & 1) != 0 && writing_.load(std::memory_order_acquire) == sequence) {
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return retired;
+    }
+
+    const WindowEntry* Entries(uint32_t buffer) const {
+        return buffers_[buffer];
+    }
+
+    /* Calls of functions that found the buffer full */
+    uint64_t Dropped(uint32_t buffer) const {
+        return dropped_[buffer];
+    }
+
+    void Clear(uint32_t buffer) {
+        for (WindowEntry& entry : buffers_[buffer]) {
+            entry = WindowEntry{nullptr, 0, 0};
+        }
+        dropped_[buffer] = 0;
+    }
+
+    /* Forked child: a hook of a thread that is gone may have been writing */
+    void Reset() {
+        Clear(0);
+        Clear(1);
+        active_.store(0, std::memory_order_relaxed);
+        writing_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    WindowEntry buffers_[2][kSlots]{};
+    uint64_t dropped_[2]{};
+    std::atomic<uint32_t> active_{0};
+    std::atomic<uint32_t> writing_{0}; /* Odd while a hook writes */
+};
+
+struct CallTotals {
+    uint64_t calls;
+    uint64_t inclusive_ns;
+};
+
+/* Snapshots or live statistics are on, the hooks fill the window counters */
+bool WindowCountersEnabled();
+
+/*
+ * Flips the window counters of every thread into the running totals by
+ * function name and returns them, dropped counts the calls lost so far.
+ * For the runtime's own threads, never from a hook.
+ */
+std::map<std::string, CallTotals> CollectCallTotals(uint64_t& dropped);
+
+/* Forked child: forgets the parent's totals */
+void ResetCallTotals();
+
+} /* namespace visual_dump */
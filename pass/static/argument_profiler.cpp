@@ -0,0 +1,109 @@
+#include <argument_profiler.hpp>
+
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+namespace {
+
+bool IsLocalMemory(const llvm::Value* pointer) {
+    const llvm::Value* object = llvm::getUnderlyingObject(pointer);
+    if (llvm::isa<llvm::AllocaInst>(object)) {
+        return true;
+    }
+    auto* global = llvm::dyn_cast<llvm::GlobalVariable>(object);
+    return global != nullptr && global->isConstant();
+}
+
+} /* namespace */
+
+bool ArgumentProfiler::IsCandidate(const llvm::Function& func) {
+    /* Nothing to memoize */
+    if (func.getReturnType()->isVoidTy() || func.arg_empty() || func.arg_size() > kMaxArgs || func.isVarArg()) {
+        return false;
+    }
+    for (auto& arg : func.args()) {
+        if (!arg.getType()->isIntegerTy() && !arg.getType()->isFloatingPointTy() &&
+            !(arg.getType()->isPointerTy() && func.doesNotAccessMemory())) {
+            return false;
+        }
+    }
+
+    if (func.doesNotAccessMemory() || func.onlyReadsMemory()) {
+        return true;
+    }
+
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            if (llvm::isa<llvm::DbgInfoIntrinsic>(instruction) || instruction.isLifetimeStartOrEnd()) {
+                continue;
+            }
+            if (auto* load = llvm::dyn_cast<llvm::LoadInst>(&instruction)) {
+                if (load->isVolatile() || !IsLocalMemory(load->getPointerOperand())) {
+                    return false;
+                }
+            } else if (auto* store = llvm::dyn_cast<llvm::StoreInst>(&instruction)) {
+                if (store->isVolatile() || !IsLocalMemory(store->getPointerOperand())) {
+                    return false;
+                }
+            } else if (auto* call = llvm::dyn_cast<llvm::CallBase>(&instruction)) {
+                const llvm::Function* callee = call->getCalledFunction();
+                if (callee != &func && (callee == nullptr || !callee->doesNotAccessMemory())) {
+                    return false;
+                }
+            } else if (instruction.mayReadOrWriteMemory()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void ArgumentProfiler::Instrument(llvm::Function& func) {
+    llvm::Module* module = func.getParent();
+    llvm::LLVMContext& context = func.getContext();
+    llvm::IRBuilder<> builder{&*func.getEntryBlock().getFirstInsertionPt()};
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    /* void ProfileArguments__(void** state, char* func_name, uint32_t num_args, uint64_t args...) */
+    llvm::FunctionCallee profile_callee = module->getOrInsertFunction(
+        "ProfileArguments__", builder.getVoidTy(), builder.getInt8PtrTy()->getPointerTo(), builder.getInt8PtrTy(),
+        builder.getInt32Ty(), i64, i64, i64, i64);
+    llvm::FunctionCallee end_callee =
+        module->getOrInsertFunction("ProfileArgumentsEnd__", builder.getVoidTy(), builder.getInt8PtrTy());
+
+    /* The runtime caches the function's state here, so the hook needs no lookup */
+    auto* state = new llvm::GlobalVariable(*module, builder.getInt8PtrTy(), false,
+                                           llvm::GlobalValue::PrivateLinkage,
+                                           llvm::ConstantPointerNull::get(builder.getInt8PtrTy()),
+                                           "__visual_dump_args." + func.getName());
+    llvm::Value* func_name = builder.CreateGlobalStringPtr(func.getName());
+
+    std::vector<llvm::Value*> args = {state, func_name, builder.getInt32(func.arg_size())};
+    for (auto& arg : func.args()) {
+        llvm::Value* value = &arg;
+        if (value->getType()->isFloatingPointTy()) {
+            unsigned bits = value->getType()->getPrimitiveSizeInBits().getFixedSize();
+            value = builder.CreateBitCast(value, llvm::IntegerType::get(context, bits));
+        }
+        if (value->getType()->isPointerTy()) {
+            value = builder.CreatePtrToInt(value, i64);
+        }
+        args.push_back(builder.CreateZExtOrTrunc(value, i64));
+    }
+    while (args.size() < 3 + kMaxArgs) {
+        args.push_back(builder.getInt64(0));
+    }
+    builder.CreateCall(profile_callee, args);
+
+    for (auto& block : func) {
+        if (auto* ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+            builder.SetInsertPoint(ret);
+            builder.CreateCall(end_callee, {func_name});
+        }
+    }
+}
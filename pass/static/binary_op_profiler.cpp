@@ -0,0 +1,75 @@
+#include <binary_op_profiler.hpp>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+
+bool BinaryOpProfiler::IsSelected(const llvm::BinaryOperator& binary_op, const std::string& opcodes) {
+    /* Vectors and wide integers do not fit the 64 bit records */
+    llvm::Type* type = binary_op.getType();
+    bool is_scalar = type->isFloatTy() || type->isDoubleTy() ||
+                     (type->isIntegerTy() && type->getIntegerBitWidth() <= 64);
+    if (!is_scalar) {
+        return false;
+    }
+    if (opcodes == "all") {
+        return true;
+    }
+
+    llvm::SmallVector<llvm::StringRef, 8> names;
+    llvm::StringRef(opcodes).split(names, ',', -1, false);
+    for (llvm::StringRef name : names) {
+        if (name.trim() == binary_op.getOpcodeName()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BinaryOpProfiler::Instrument(llvm::Function& func, const std::string& opcodes) {
+    std::vector<llvm::BinaryOperator*> binary_ops;
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            auto* binary_op = llvm::dyn_cast<llvm::BinaryOperator>(&instruction);
+            if (binary_op != nullptr && IsSelected(*binary_op, opcodes)) {
+                binary_ops.push_back(binary_op);
+            }
+        }
+    }
+    if (binary_ops.empty()) {
+        return;
+    }
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    /* void ProfileBinaryOp__(const SiteInfo* site, uint64_t lhs, uint64_t rhs, uint64_t result) */
+    llvm::FunctionCallee profile_callee = func.getParent()->getOrInsertFunction(
+        "ProfileBinaryOp__", builder.getVoidTy(), builder.getInt8PtrTy(), i64, i64, i64);
+
+    for (llvm::BinaryOperator* binary_op : binary_ops) {
+        llvm::Type* type = binary_op->getType();
+        unsigned bits = type->getPrimitiveSizeInBits().getFixedSize();
+        uint32_t attributes = bits | (type->isFloatingPointTy() ? visual_dump::kFloatOperands : 0);
+
+        std::string text;
+        llvm::raw_string_ostream text_stream{text};
+        text_stream << binary_op->getOpcodeName() << ' ' << *type;
+        llvm::Constant* site = emitter_.AddSiteInfo(*binary_op, text_stream.str(), attributes);
+
+        builder.SetInsertPoint(binary_op->getNextNode());
+        auto to_record = [&](llvm::Value* value) {
+            if (value->getType()->isFloatingPointTy()) {
+                value = builder.CreateBitCast(value, builder.getIntNTy(bits));
+            }
+            return builder.CreateZExt(value, i64);
+        };
+        builder.CreateCall(profile_callee, {site, to_record(binary_op->getOperand(0)),
+                                            to_record(binary_op->getOperand(1)), to_record(binary_op)});
+    }
+}
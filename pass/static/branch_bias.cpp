@@ -0,0 +1,114 @@
+#include <branch_bias.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+using visual_dump::kBranchBiasSiteSize;
+
+namespace {
+
+constexpr size_t kMaxArmInstructions = 4;
+
+/* Stack slots count as registers, mem2reg promotes them */
+bool IsSpeculatable(const llvm::Instruction& instruction) {
+    if (auto* load = llvm::dyn_cast<llvm::LoadInst>(&instruction)) {
+        return !load->isVolatile() && llvm::isa<llvm::AllocaInst>(load->getPointerOperand());
+    }
+    if (auto* store = llvm::dyn_cast<llvm::StoreInst>(&instruction)) {
+        return !store->isVolatile() && llvm::isa<llvm::AllocaInst>(store->getPointerOperand());
+    }
+    return !instruction.mayHaveSideEffects() && !instruction.mayReadOrWriteMemory() &&
+           !llvm::isa<llvm::PHINode>(instruction);
+}
+
+/* An arm: only reached from the branch, a few speculatable instructions, then straight to the join */
+bool IsSimpleArm(const llvm::BasicBlock* arm, const llvm::BasicBlock* branch_block, const llvm::BasicBlock* join) {
+    if (arm->getSinglePredecessor() != branch_block || arm->getSingleSuccessor() != join) {
+        return false;
+    }
+    size_t instructions = 0;
+    for (const auto& instruction : *arm) {
+        if (&instruction == arm->getTerminator()) {
+            break;
+        }
+        if (!IsSpeculatable(instruction) || ++instructions > kMaxArmInstructions) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} /* namespace */
+
+bool BranchBias::IsSelectCandidate(const llvm::BranchInst& branch) {
+    const llvm::BasicBlock* block = branch.getParent();
+    const llvm::BasicBlock* taken = branch.getSuccessor(0);
+    const llvm::BasicBlock* not_taken = branch.getSuccessor(1);
+
+    /* Triangles */
+    if (IsSimpleArm(taken, block, not_taken) || IsSimpleArm(not_taken, block, taken)) {
+        return true;
+    }
+
+    /* Diamond */
+    const llvm::BasicBlock* join = taken->getSingleSuccessor();
+    return join != nullptr && IsSimpleArm(taken, block, join) && IsSimpleArm(not_taken, block, join);
+}
+
+void BranchBias::Instrument(llvm::Function& func, uint64_t hash) {
+    std::vector<llvm::BranchInst*> branches;
+    for (auto& block : func) {
+        auto* branch = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+        if (branch != nullptr && branch->isConditional()) {
+            branches.push_back(branch);
+        }
+    }
+    if (branches.empty()) {
+        return;
+    }
+
+    std::vector<uint64_t> aux;
+    for (llvm::BranchInst* branch : branches) {
+        const llvm::DILocation* location = branch->getDebugLoc().get();
+        aux.push_back(reinterpret_cast<uint64_t>(branch));
+        aux.push_back(location != nullptr ? location->getLine() : 0);
+        aux.push_back(IsSelectCandidate(*branch) ? visual_dump::kBranchSelectCandidate : 0);
+    }
+
+    llvm::GlobalVariable* counters =
+        emitter_.AddCounters(func, hash, visual_dump::CounterKind::BranchBias,
+                             static_cast<uint32_t>(branches.size()) * kBranchBiasSiteSize, nullptr, aux);
+
+    /* Previous direction of every branch: 0 none yet, 1 not taken, 2 taken */
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::ArrayType* state_type = llvm::ArrayType::get(builder.getInt8Ty(), branches.size());
+    auto* state = new llvm::GlobalVariable(*func.getParent(), state_type, false, llvm::GlobalValue::PrivateLinkage,
+                                           llvm::ConstantAggregateZero::get(state_type),
+                                           "__visual_dump_branch_state." + func.getName());
+
+    for (size_t i = 0; i < branches.size(); i++) {
+        llvm::BranchInst* branch = branches[i];
+        llvm::Value* condition = branch->getCondition();
+        uint64_t base = i * kBranchBiasSiteSize;
+        builder.SetInsertPoint(branch);
+
+        llvm::Value* idx = builder.CreateSelect(condition, builder.getInt64(base), builder.getInt64(base + 1));
+        ProfileEmitter::Increment(builder, counters, idx);
+
+        /* 1 xor 2 is the only way to get 3, a change of direction */
+        llvm::Value* direction = builder.CreateSelect(condition, builder.getInt8(2), builder.getInt8(1));
+        llvm::Value* last_ptr = builder.CreateConstInBoundsGEP2_64(state_type, state, 0, i);
+        llvm::Value* last = builder.CreateLoad(builder.getInt8Ty(), last_ptr);
+        llvm::Value* changed = builder.CreateICmpEQ(builder.CreateXor(last, direction), builder.getInt8(3));
+
+        llvm::Value* indices[] = {builder.getInt64(0), builder.getInt64(base + 2)};
+        llvm::Value* transitions = builder.CreateInBoundsGEP(counters->getValueType(), counters, indices);
+        llvm::Value* count = builder.CreateLoad(builder.getInt64Ty(), transitions);
+        builder.CreateStore(builder.CreateAdd(count, builder.CreateZExt(changed, builder.getInt64Ty())), transitions);
+        builder.CreateStore(direction, last_ptr);
+    }
+}
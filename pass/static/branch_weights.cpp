@@ -0,0 +1,105 @@
+#include <branch_weights.hpp>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+std::vector<llvm::Instruction*> BranchWeights::MultiWayTerminators(llvm::Function& func) {
+    std::vector<llvm::Instruction*> terminators;
+    for (auto& block : func) {
+        llvm::Instruction* terminator = block.getTerminator();
+        if (auto* branch = llvm::dyn_cast_or_null<llvm::BranchInst>(terminator)) {
+            if (branch->isConditional()) {
+                terminators.push_back(branch);
+            }
+        } else if (llvm::isa_and_nonnull<llvm::SwitchInst>(terminator)) {
+            terminators.push_back(terminator);
+        }
+    }
+    return terminators;
+}
+
+void BranchWeights::Instrument(llvm::Function& func, uint64_t hash) {
+    std::vector<llvm::Instruction*> terminators = MultiWayTerminators(func);
+    uint32_t num_counters = 1;
+    for (auto* terminator : terminators) {
+        num_counters += terminator->getNumSuccessors();
+    }
+
+    llvm::GlobalVariable* counters =
+        emitter_.AddCounters(func, hash, visual_dump::CounterKind::Branches, num_counters);
+
+    /* Entry count */
+    llvm::IRBuilder<> builder{&*func.getEntryBlock().getFirstInsertionPt()};
+    ProfileEmitter::Increment(builder, counters, builder.getInt64(0));
+
+    /* The successor taken is selected in front of the terminator, no edge is split */
+    uint64_t base = 1;
+    for (auto* terminator : terminators) {
+        builder.SetInsertPoint(terminator);
+
+        llvm::Value* idx = nullptr;
+        if (auto* branch = llvm::dyn_cast<llvm::BranchInst>(terminator)) {
+            idx = builder.CreateSelect(branch->getCondition(), builder.getInt64(base), builder.getInt64(base + 1));
+        } else {
+            auto* switch_inst = llvm::cast<llvm::SwitchInst>(terminator);
+            idx = builder.getInt64(base);
+            for (auto& switch_case : switch_inst->cases()) {
+                llvm::Value* matches = builder.CreateICmpEQ(switch_inst->getCondition(), switch_case.getCaseValue());
+                idx = builder.CreateSelect(matches, builder.getInt64(base + switch_case.getSuccessorIndex()), idx);
+            }
+        }
+
+        ProfileEmitter::Increment(builder, counters, idx);
+        base += terminator->getNumSuccessors();
+    }
+}
+
+void BranchWeights::Apply(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile) {
+    const visual_dump::ProfileRecord* record =
+        profile.Find(visual_dump::CounterKind::Branches, func.getName().str());
+    if (record == nullptr) {
+        return;
+    }
+
+    std::vector<llvm::Instruction*> terminators = MultiWayTerminators(func);
+    size_t num_counters = 1;
+    for (auto* terminator : terminators) {
+        num_counters += terminator->getNumSuccessors();
+    }
+
+    if (record->hash != hash || record->counters.size() != num_counters) {
+        llvm::errs() << "visual-dump: profile of '" << func.getName() << "' does not match its CFG, ignored\n";
+        return;
+    }
+
+    func.setEntryCount(llvm::Function::ProfileCount(record->counters[0], llvm::Function::PCT_Real));
+
+    llvm::MDBuilder md_builder{func.getContext()};
+    size_t base = 1;
+    for (auto* terminator : terminators) {
+        auto first = record->counters.begin() + static_cast<std::ptrdiff_t>(base);
+        auto last = first + terminator->getNumSuccessors();
+        base += terminator->getNumSuccessors();
+
+        /* Never executed, leave it to the static heuristics */
+        uint64_t max_count = *std::max_element(first, last);
+        if (max_count == 0) {
+            continue;
+        }
+
+        /* Branch weights are 32 bit */
+        unsigned shift = 0;
+        while ((max_count >> shift) > UINT32_MAX) {
+            shift++;
+        }
+
+        std::vector<uint32_t> weights;
+        for (auto count = first; count != last; ++count) {
+            weights.push_back(static_cast<uint32_t>(*count >> shift));
+        }
+        terminator->setMetadata(llvm::LLVMContext::MD_prof, md_builder.createBranchWeights(weights));
+    }
+}
@@ -0,0 +1,67 @@
+#include <coverage.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+
+void Coverage::Begin(llvm::Module& module) {
+    uint32_t slots_num = 0;
+    slots_.clear();
+    for (auto& func : module) {
+        if (!func.isDeclaration() && func.hasName()) {
+            slots_[&func] = std::make_pair(slots_num, static_cast<uint32_t>(func.size()));
+            slots_num += static_cast<uint32_t>(func.size());
+        }
+    }
+
+    bitmap_ = nullptr;
+    if (slots_num == 0) {
+        return;
+    }
+    llvm::ArrayType* bitmap_type = llvm::ArrayType::get(llvm::Type::getInt8Ty(module.getContext()), slots_num);
+    bitmap_ = new llvm::GlobalVariable(module, bitmap_type, false, llvm::GlobalValue::PrivateLinkage,
+                                       llvm::ConstantAggregateZero::get(bitmap_type), "__visual_dump_coverage");
+}
+
+void Coverage::Instrument(llvm::Function& func, uint64_t hash) {
+    auto slots = slots_.find(&func);
+    if (bitmap_ == nullptr || slots == slots_.end()) {
+        return;
+    }
+
+    /* Another pass changed the CFG after doInitialization, the slots do not fit anymore */
+    uint32_t first_slot = slots->second.first;
+    uint32_t blocks_num = slots->second.second;
+    if (func.size() != blocks_num) {
+        llvm::errs() << "visual-dump: '" << func.getName() << "' changed before instrumentation, no coverage\n";
+        return;
+    }
+
+    /* The tools mark the dump.dot nodes of an uncovered block: func id, then <instructions, ids...> per block */
+    std::vector<uint64_t> node_ids = {reinterpret_cast<uint64_t>(&func)};
+    for (auto& block : func) {
+        node_ids.push_back(block.size());
+        for (auto& instruction : block) {
+            node_ids.push_back(reinterpret_cast<uint64_t>(&instruction));
+        }
+    }
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::Type* bitmap_type = bitmap_->getValueType();
+    uint32_t slot = first_slot;
+    for (auto& block : func) {
+        /* catchswitch blocks cannot hold anything else, they stay uncovered */
+        if (block.getFirstInsertionPt() != block.end()) {
+            builder.SetInsertPoint(&*block.getFirstInsertionPt());
+            builder.CreateStore(builder.getInt8(1),
+                                builder.CreateConstInBoundsGEP2_64(bitmap_type, bitmap_, 0, slot));
+        }
+        slot++;
+    }
+
+    llvm::Constant* indices[] = {builder.getInt64(0), builder.getInt64(first_slot)};
+    llvm::Constant* counters = llvm::ConstantExpr::getInBoundsGetElementPtr(bitmap_type, bitmap_, indices);
+    emitter_.AddTable(func, hash, visual_dump::CounterKind::Coverage, counters, blocks_num, node_ids);
+}
@@ -0,0 +1,225 @@
+#include <edge_profiler.hpp>
+
+#include <llvm/Analysis/BlockFrequencyInfo.h>
+#include <llvm/Analysis/BranchProbabilityInfo.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+
+namespace {
+
+std::vector<llvm::BasicBlock*> UniqueSuccessors(llvm::BasicBlock* block) {
+    std::vector<llvm::BasicBlock*> successors;
+    for (llvm::BasicBlock* successor : llvm::successors(block)) {
+        if (std::find(successors.begin(), successors.end(), successor) == successors.end()) {
+            successors.push_back(successor);
+        }
+    }
+    return successors;
+}
+
+uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t vertex) {
+    while (parents[vertex] != vertex) {
+        parents[vertex] = parents[parents[vertex]];
+        vertex = parents[vertex];
+    }
+    return vertex;
+}
+
+} /* namespace */
+
+std::vector<EdgeProfiler::Edge> EdgeProfiler::SpanningTree(llvm::Function& func) {
+    llvm::DominatorTree dominator_tree{func};
+    llvm::LoopInfo loop_info{dominator_tree};
+    llvm::BranchProbabilityInfo probability_info{func, loop_info};
+    llvm::BlockFrequencyInfo frequency_info{func, probability_info, loop_info};
+
+    /* The root edge always stays in the tree, the entry count is recovered from the exits */
+    std::vector<Edge> edges = {Edge{nullptr, &func.getEntryBlock(), UINT64_MAX, false}};
+    std::map<const llvm::BasicBlock*, uint32_t> block_idx;
+    for (auto& block : func) {
+        uint64_t frequency = frequency_info.getBlockFreq(&block).getFrequency();
+        std::vector<llvm::BasicBlock*> successors = UniqueSuccessors(&block);
+        for (llvm::BasicBlock* successor : successors) {
+            uint64_t weight = probability_info.getEdgeProbability(&block, successor).scale(frequency);
+            edges.push_back(Edge{&block, successor, weight, false});
+        }
+        if (successors.empty()) {
+            edges.push_back(Edge{&block, nullptr, frequency, false});
+        }
+        block_idx.emplace(&block, block_idx.size());
+    }
+
+    /* Kruskal, heaviest first. Edges that cannot hold a counter go first, they must be in the tree */
+    std::vector<uint32_t> order(edges.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<bool> countable(edges.size());
+    for (size_t i = 0; i < edges.size(); i++) {
+        countable[i] = edges[i].src == nullptr || edges[i].dst == nullptr ||
+                       ProfileEmitter::CanInstrumentEdge(edges[i].src, edges[i].dst);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+        if (countable[lhs] != countable[rhs]) {
+            return !countable[lhs];
+        }
+        return edges[lhs].weight > edges[rhs].weight;
+    });
+
+    uint32_t root = static_cast<uint32_t>(block_idx.size());
+    std::vector<uint32_t> parents(block_idx.size() + 1);
+    std::iota(parents.begin(), parents.end(), 0);
+    for (uint32_t edge_idx : order) {
+        Edge& edge = edges[edge_idx];
+        uint32_t src = FindRoot(parents, edge.src != nullptr ? block_idx[edge.src] : root);
+        uint32_t dst = FindRoot(parents, edge.dst != nullptr ? block_idx[edge.dst] : root);
+        if (src != dst) {
+            parents[src] = dst;
+            edge.in_tree = true;
+        } else if (!countable[edge_idx]) {
+            return {};
+        }
+    }
+    return edges;
+}
+
+void EdgeProfiler::Instrument(llvm::Function& func, uint64_t hash) {
+    std::vector<Edge> edges = SpanningTree(func);
+    uint32_t num_counters = 0;
+    for (const Edge& edge : edges) {
+        num_counters += edge.in_tree ? 0 : 1;
+    }
+    if (num_counters == 0) {
+        llvm::errs() << "visual-dump: no edge profile for '" << func.getName() << "', its CFG cannot be counted\n";
+        return;
+    }
+
+    llvm::GlobalVariable* counters =
+        emitter_.AddCounters(func, hash, visual_dump::CounterKind::EdgeCounts, num_counters);
+    llvm::IRBuilder<> builder{func.getContext()};
+    uint64_t counter_idx = 0;
+    for (const Edge& edge : edges) {
+        if (edge.in_tree) {
+            continue;
+        }
+
+        if (edge.src == nullptr) {
+            builder.SetInsertPoint(&*edge.dst->getFirstInsertionPt());
+        } else if (edge.dst == nullptr) {
+            builder.SetInsertPoint(edge.src->getTerminator());
+        } else {
+            builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(edge.src, edge.dst));
+        }
+        ProfileEmitter::Increment(builder, counters, builder.getInt64(counter_idx++));
+    }
+}
+
+void EdgeProfiler::Apply(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile) {
+    const visual_dump::ProfileRecord* record =
+        profile.Find(visual_dump::CounterKind::EdgeCounts, func.getName().str());
+    if (record == nullptr) {
+        return;
+    }
+
+    std::vector<Edge> edges = SpanningTree(func);
+    size_t num_counters = 0;
+    for (const Edge& edge : edges) {
+        num_counters += edge.in_tree ? 0 : 1;
+    }
+    if (record->hash != hash || record->counters.size() != num_counters || num_counters == 0) {
+        llvm::errs() << "visual-dump: edge profile of '" << func.getName() << "' does not match its CFG, ignored\n";
+        return;
+    }
+
+    /* Counted edges are known, the tree edges follow from "inflow == outflow" at every vertex, leaves first */
+    std::vector<int64_t> counts(edges.size(), 0);
+    std::vector<bool> known(edges.size(), false);
+    size_t counter_idx = 0;
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (!edges[i].in_tree) {
+            counts[i] = static_cast<int64_t>(record->counters[counter_idx++]);
+            known[i] = true;
+        }
+    }
+
+    std::map<const llvm::BasicBlock*, std::vector<size_t>> incident;
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (edges[i].src != edges[i].dst) {
+            incident[edges[i].src].push_back(i);
+            incident[edges[i].dst].push_back(i);
+        }
+    }
+
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (const auto& vertex : incident) {
+            size_t unknown = edges.size();
+            size_t unknown_num = 0;
+            int64_t balance = 0; /* Inflow minus outflow of the known edges */
+            for (size_t i : vertex.second) {
+                if (!known[i]) {
+                    unknown = i;
+                    unknown_num++;
+                } else {
+                    balance += edges[i].dst == vertex.first ? counts[i] : -counts[i];
+                }
+            }
+            if (unknown_num == 1) {
+                counts[unknown] = std::max<int64_t>(edges[unknown].dst == vertex.first ? -balance : balance, 0);
+                known[unknown] = true;
+                progress = true;
+            }
+        }
+    }
+
+    /* The root edge is the first one */
+    func.setEntryCount(llvm::Function::ProfileCount(static_cast<uint64_t>(counts[0]), llvm::Function::PCT_Real));
+
+    std::map<std::pair<const llvm::BasicBlock*, const llvm::BasicBlock*>, uint64_t> edge_counts;
+    for (size_t i = 0; i < edges.size(); i++) {
+        edge_counts[{edges[i].src, edges[i].dst}] = static_cast<uint64_t>(counts[i]);
+    }
+
+    llvm::MDBuilder md_builder{func.getContext()};
+    for (auto& block : func) {
+        llvm::Instruction* terminator = block.getTerminator();
+        if (!llvm::isa<llvm::BranchInst>(terminator) && !llvm::isa<llvm::SwitchInst>(terminator)) {
+            continue;
+        }
+        if (terminator->getNumSuccessors() < 2) {
+            continue;
+        }
+
+        /* Parallel switch edges share the count of their edge */
+        std::vector<uint64_t> successor_counts;
+        for (llvm::BasicBlock* successor : llvm::successors(&block)) {
+            auto parallel = std::count(llvm::succ_begin(&block), llvm::succ_end(&block), successor);
+            successor_counts.push_back(edge_counts[{&block, successor}] / static_cast<uint64_t>(parallel));
+        }
+
+        /* Never executed, leave it to the static heuristics */
+        uint64_t max_count = *std::max_element(successor_counts.begin(), successor_counts.end());
+        if (max_count == 0) {
+            continue;
+        }
+
+        /* Branch weights are 32 bit */
+        unsigned shift = 0;
+        while ((max_count >> shift) > UINT32_MAX) {
+            shift++;
+        }
+
+        std::vector<uint32_t> weights;
+        for (uint64_t count : successor_counts) {
+            weights.push_back(static_cast<uint32_t>(count >> shift));
+        }
+        terminator->setMetadata(llvm::LLVMContext::MD_prof, md_builder.createBranchWeights(weights));
+    }
+}
@@ -0,0 +1,100 @@
+#include <heap_profiler.hpp>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+using visual_dump::HeapOp;
+
+HeapProfiler::HeapCall HeapProfiler::Classify(llvm::CallBase* call) {
+    llvm::Function* callee = call->getCalledFunction();
+    if (callee == nullptr) {
+        return HeapCall{call, HeapOp::None, -1, -1, -1};
+    }
+
+    llvm::StringRef name = callee->getName();
+    if (name == "malloc") {
+        return HeapCall{call, HeapOp::Allocate, -1, 0, -1};
+    }
+    if (name == "calloc") {
+        return HeapCall{call, HeapOp::Allocate, -1, 1, 0};
+    }
+    if (name == "aligned_alloc") {
+        return HeapCall{call, HeapOp::Allocate, -1, 1, -1};
+    }
+    if (name == "realloc") {
+        return HeapCall{call, HeapOp::Reallocate, 0, 1, -1};
+    }
+    if (name == "free") {
+        return HeapCall{call, HeapOp::Free, 0, -1, -1};
+    }
+
+    /* operator new and new[], any overload, and delete and delete[], sized, aligned or nothrow */
+    if (name.startswith("_Znwm") || name.startswith("_Znam")) {
+        return HeapCall{call, HeapOp::Allocate, -1, 0, -1};
+    }
+    if (name.startswith("_ZdlPv") || name.startswith("_ZdaPv")) {
+        return HeapCall{call, HeapOp::Free, 0, -1, -1};
+    }
+    return HeapCall{call, HeapOp::None, -1, -1, -1};
+}
+
+void HeapProfiler::Instrument(llvm::Function& func) {
+    std::vector<HeapCall> heap_calls;
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            auto* call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+            if (call == nullptr) {
+                continue;
+            }
+            HeapCall heap_call = Classify(call);
+            auto* invoke = llvm::dyn_cast<llvm::InvokeInst>(call);
+            bool can_follow = invoke == nullptr || ProfileEmitter::CanInstrumentEdge(&block, invoke->getNormalDest());
+            if (heap_call.op != HeapOp::None && (heap_call.op == HeapOp::Free || can_follow)) {
+                heap_calls.push_back(heap_call);
+            }
+        }
+    }
+    if (heap_calls.empty()) {
+        return;
+    }
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::Type* i8_ptr = builder.getInt8PtrTy();
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    /* void ProfileHeap__(const SiteInfo* site, void* old_pointer, void* new_pointer, uint64_t size) */
+    llvm::FunctionCallee profile_callee =
+        func.getParent()->getOrInsertFunction("ProfileHeap__", builder.getVoidTy(), i8_ptr, i8_ptr, i8_ptr, i64);
+
+    for (const HeapCall& heap_call : heap_calls) {
+        llvm::CallBase* call = heap_call.call;
+        llvm::Constant* site = emitter_.AddSiteInfo(*call, call->getCalledFunction()->getName().str(),
+                                                    static_cast<uint32_t>(heap_call.op));
+        llvm::Value* null = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8_ptr));
+
+        /* A free is reported before the memory can be handed out again */
+        if (heap_call.op == HeapOp::Free) {
+            builder.SetInsertPoint(call);
+            llvm::Value* pointer = builder.CreatePointerCast(call->getArgOperand(heap_call.pointer_arg), i8_ptr);
+            builder.CreateCall(profile_callee, {site, pointer, null, builder.getInt64(0)});
+            continue;
+        }
+
+        if (auto* invoke = llvm::dyn_cast<llvm::InvokeInst>(call)) {
+            builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(invoke->getParent(), invoke->getNormalDest()));
+        } else {
+            builder.SetInsertPoint(call->getNextNode());
+        }
+        llvm::Value* size = builder.CreateZExtOrTrunc(call->getArgOperand(heap_call.size_arg), i64);
+        if (heap_call.count_arg >= 0) {
+            size = builder.CreateMul(size, builder.CreateZExtOrTrunc(call->getArgOperand(heap_call.count_arg), i64));
+        }
+        llvm::Value* old_pointer =
+            heap_call.pointer_arg >= 0 ? builder.CreatePointerCast(call->getArgOperand(heap_call.pointer_arg), i8_ptr)
+                                       : null;
+        builder.CreateCall(profile_callee, {site, old_pointer, builder.CreatePointerCast(call, i8_ptr), size});
+    }
+}
@@ -0,0 +1,107 @@
+#include <indirect_calls.hpp>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/CallPromotionUtils.h>
+
+using visual_dump::kIndirectCallSiteSize;
+using visual_dump::kIndirectCallTargets;
+
+std::vector<llvm::CallBase*> IndirectCalls::IndirectCallSites(llvm::Function& func) {
+    std::vector<llvm::CallBase*> sites;
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            auto* call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+            if (call != nullptr && call->isIndirectCall()) {
+                sites.push_back(call);
+            }
+        }
+    }
+    return sites;
+}
+
+void IndirectCalls::Instrument(llvm::Function& func, uint64_t hash) {
+    /* Targets are known to the runtime by address only */
+    if (func.hasAddressTaken()) {
+        emitter_.AddFunctionAddress(func);
+    }
+
+    std::vector<llvm::CallBase*> sites = IndirectCallSites(func);
+    if (sites.empty()) {
+        return;
+    }
+
+    llvm::GlobalVariable* counters = emitter_.AddCounters(
+        func, hash, visual_dump::CounterKind::IndirectCalls, static_cast<uint32_t>(sites.size()) * kIndirectCallSiteSize);
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::FunctionCallee profile_callee = func.getParent()->getOrInsertFunction(
+        "ProfileIndirectCall__", builder.getVoidTy(), builder.getInt64Ty()->getPointerTo(), builder.getInt8PtrTy());
+
+    for (size_t i = 0; i < sites.size(); i++) {
+        builder.SetInsertPoint(sites[i]);
+        llvm::Value* site = builder.CreateConstInBoundsGEP2_64(counters->getValueType(), counters, 0,
+                                                               i * kIndirectCallSiteSize);
+        llvm::Value* target = builder.CreatePointerCast(sites[i]->getCalledOperand(), builder.getInt8PtrTy());
+        builder.CreateCall(profile_callee, {site, target});
+    }
+}
+
+uint32_t IndirectCalls::Promote(llvm::Function& func, uint64_t hash, const visual_dump::ProfileReader& profile,
+                                uint32_t threshold_percent) {
+    const visual_dump::ProfileRecord* record =
+        profile.Find(visual_dump::CounterKind::IndirectCalls, func.getName().str());
+    if (record == nullptr) {
+        return 0;
+    }
+
+    std::vector<llvm::CallBase*> sites = IndirectCallSites(func);
+    if (record->hash != hash || record->counters.size() != sites.size() * kIndirectCallSiteSize) {
+        llvm::errs() << "visual-dump: indirect call profile of '" << func.getName()
+                     << "' does not match its CFG, ignored\n";
+        return 0;
+    }
+
+    /* Branch weights are 32 bit */
+    auto scale = [](uint64_t count, uint64_t max_count) {
+        unsigned shift = 0;
+        while ((max_count >> shift) > UINT32_MAX) {
+            shift++;
+        }
+        return static_cast<uint32_t>(count >> shift);
+    };
+
+    llvm::MDBuilder md_builder{func.getContext()};
+    uint32_t promoted = 0;
+    for (size_t i = 0; i < sites.size(); i++) {
+        size_t base = i * kIndirectCallSiteSize;
+        uint64_t remaining = record->counters[base];
+
+        /* The runtime writes the targets sorted by calls */
+        for (uint32_t target_idx = 0; target_idx < kIndirectCallTargets; target_idx++) {
+            const std::string& name = record->symbols[base + 1 + 2 * target_idx];
+            uint64_t count = record->counters[base + 2 + 2 * target_idx];
+            if (name.empty() || count == 0 || count * 100 < remaining * threshold_percent) {
+                break;
+            }
+
+            /*
+             * Only functions this module already knows about: a name from
+             * another module may belong to an internal function there.
+             */
+            llvm::Function* target = func.getParent()->getFunction(name);
+            if (target == nullptr || !llvm::isLegalToPromote(*sites[i], target)) {
+                continue;
+            }
+
+            llvm::MDNode* weights =
+                md_builder.createBranchWeights(scale(count, remaining), scale(remaining - count, remaining));
+            llvm::promoteCallWithIfThenElse(*sites[i], target, weights);
+            remaining -= count;
+            promoted++;
+        }
+    }
+    return promoted;
+}
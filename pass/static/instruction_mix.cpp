@@ -0,0 +1,87 @@
+#include <instruction_mix.hpp>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+#include <algorithm>
+#include <vector>
+
+using visual_dump::kInstructionClasses;
+
+uint32_t InstructionMix::Classify(const llvm::Instruction& instruction) {
+    if (llvm::isa<llvm::PHINode>(instruction) || llvm::isa<llvm::AllocaInst>(instruction) ||
+        llvm::isa<llvm::DbgInfoIntrinsic>(instruction) || instruction.isLifetimeStartOrEnd()) {
+        return kInstructionClasses;
+    }
+    if (auto* call = llvm::dyn_cast<llvm::CallBase>(&instruction)) {
+        if (ProfileEmitter::IsHook(call->getCalledFunction())) {
+            return kInstructionClasses;
+        }
+    }
+    /* The memory modes run first, the casts of their hook arguments are theirs too */
+    if (llvm::isa<llvm::CastInst>(instruction) && !instruction.use_empty() &&
+        std::all_of(instruction.user_begin(), instruction.user_end(), [](const llvm::User* user) {
+            auto* call = llvm::dyn_cast<llvm::CallBase>(user);
+            return call != nullptr && ProfileEmitter::IsHook(call->getCalledFunction());
+        })) {
+        return kInstructionClasses;
+    }
+
+    bool is_vector = instruction.getType()->isVectorTy();
+    for (const llvm::Value* operand : instruction.operands()) {
+        is_vector |= operand->getType()->isVectorTy();
+    }
+    if (is_vector) {
+        return visual_dump::kVectorOps;
+    }
+
+    if (llvm::isa<llvm::LoadInst>(instruction)) {
+        return visual_dump::kLoads;
+    }
+    if (llvm::isa<llvm::StoreInst>(instruction) || llvm::isa<llvm::AtomicRMWInst>(instruction) ||
+        llvm::isa<llvm::AtomicCmpXchgInst>(instruction)) {
+        return visual_dump::kStores;
+    }
+    if (llvm::isa<llvm::CallBase>(instruction) && !llvm::isa<llvm::IntrinsicInst>(instruction)) {
+        return visual_dump::kCalls;
+    }
+    if (instruction.isTerminator()) {
+        return visual_dump::kBranches;
+    }
+
+    /* Arithmetic, compares and conversions by the type they work on, intrinsics included */
+    bool is_float = instruction.getType()->isFPOrFPVectorTy();
+    for (const llvm::Value* operand : instruction.operands()) {
+        is_float |= operand->getType()->isFPOrFPVectorTy();
+    }
+    return is_float ? visual_dump::kFloatOps : visual_dump::kIntegerOps;
+}
+
+void InstructionMix::Instrument(llvm::Function& func, uint64_t hash) {
+    std::vector<uint64_t> aux;
+    for (auto& block : func) {
+        uint64_t mix[kInstructionClasses] = {};
+        for (auto& instruction : block) {
+            uint32_t instruction_class = Classify(instruction);
+            if (instruction_class < kInstructionClasses) {
+                mix[instruction_class]++;
+            }
+        }
+        aux.insert(aux.end(), mix, mix + kInstructionClasses);
+    }
+
+    llvm::GlobalVariable* counters = emitter_.AddCounters(func, hash, visual_dump::CounterKind::InstructionMix,
+                                                          static_cast<uint32_t>(func.size()), nullptr, aux);
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    uint64_t idx = 0;
+    for (auto& block : func) {
+        /* catchswitch blocks cannot hold anything else, they count as never run */
+        if (block.getFirstInsertionPt() != block.end()) {
+            builder.SetInsertPoint(&*block.getFirstInsertionPt());
+            ProfileEmitter::Increment(builder, counters, builder.getInt64(idx));
+        }
+        idx++;
+    }
+}
@@ -0,0 +1,45 @@
+#include <instruction_mix.hpp>
+#include <line_profiler.hpp>
+
+#include <llvm/IR/IRBuilder.h>
+
+#include <map>
+#include <vector>
+
+void LineProfiler::Instrument(llvm::Function& func, uint64_t hash) {
+    std::vector<uint64_t> aux;
+    bool has_lines = false;
+    for (auto& block : func) {
+        /* Ordered by line index, so a block lists every line once */
+        std::map<uint32_t, uint64_t> lines;
+        for (auto& instruction : block) {
+            const llvm::DILocation* location = instruction.getDebugLoc().get();
+            if (location != nullptr && location->getLine() != 0 &&
+                InstructionMix::Classify(instruction) < visual_dump::kInstructionClasses) {
+                lines[emitter_.AddSourceLine(*location)]++;
+            }
+        }
+        aux.push_back(lines.size());
+        for (const auto& line : lines) {
+            aux.push_back(line.first);
+            aux.push_back(line.second);
+        }
+        has_lines |= !lines.empty();
+    }
+    if (!has_lines) {
+        return;
+    }
+
+    llvm::GlobalVariable* counters = emitter_.AddCounters(func, hash, visual_dump::CounterKind::LineCounts,
+                                                          static_cast<uint32_t>(func.size()), nullptr, aux);
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    uint64_t idx = 0;
+    for (auto& block : func) {
+        if (block.getFirstInsertionPt() != block.end()) {
+            builder.SetInsertPoint(&*block.getFirstInsertionPt());
+            ProfileEmitter::Increment(builder, counters, builder.getInt64(idx));
+        }
+        idx++;
+    }
+}
@@ -0,0 +1,216 @@
+#include <lock_profiler.hpp>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+using visual_dump::LockOp;
+
+namespace {
+
+/* std::lock_guard, std::unique_lock and std::scoped_lock, any mutex type */
+bool IsLockWrapper(llvm::StringRef name) {
+    return name.startswith("_ZNSt10lock_guard") || name.startswith("_ZNSt11unique_lock") ||
+           name.startswith("_ZNSt11scoped_lock");
+}
+
+} /* namespace */
+
+LockProfiler::LockCall LockProfiler::Classify(llvm::CallBase* call) {
+    llvm::Function* callee = call->getCalledFunction();
+    if (callee == nullptr || call->arg_size() == 0) {
+        return LockCall{call, LockOp::None, 0, LockSource::Argument};
+    }
+
+    llvm::StringRef name = callee->getName();
+    if (name == "pthread_mutex_lock" || name == "pthread_mutex_timedlock" || name == "pthread_rwlock_rdlock" ||
+        name == "pthread_rwlock_wrlock" || name == "pthread_rwlock_timedrdlock" ||
+        name == "pthread_rwlock_timedwrlock") {
+        return LockCall{call, LockOp::Lock, 0, LockSource::Argument};
+    }
+    if (name == "pthread_mutex_trylock" || name == "pthread_rwlock_tryrdlock" || name == "pthread_rwlock_trywrlock") {
+        return LockCall{call, LockOp::TryLock, 0, LockSource::Argument};
+    }
+    if (name == "pthread_mutex_unlock" || name == "pthread_rwlock_unlock") {
+        return LockCall{call, LockOp::Unlock, 0, LockSource::Argument};
+    }
+    if ((name == "pthread_cond_wait" || name == "pthread_cond_timedwait") && call->arg_size() >= 2) {
+        return LockCall{call, LockOp::CondWait, 1, LockSource::Argument};
+    }
+
+    /* std::mutex and std::recursive_mutex, "this" is the pthread mutex */
+    if (name.startswith("_ZNSt5mutex") || name.startswith("_ZNSt15recursive_mutex")) {
+        if (name.endswith("4lockEv")) {
+            return LockCall{call, LockOp::Lock, 0, LockSource::Argument};
+        }
+        if (name.endswith("8try_lockEv")) {
+            return LockCall{call, LockOp::TryLock, 0, LockSource::Argument};
+        }
+        if (name.endswith("6unlockEv")) {
+            return LockCall{call, LockOp::Unlock, 0, LockSource::Argument};
+        }
+    }
+
+    /*
+     * RAII locks, "this" comes first. The constructors that adopt or defer
+     * the lock, move it or wait with a timeout are left out, the adopted
+     * lock was counted where it was taken.
+     */
+    if (IsLockWrapper(name)) {
+        bool is_unique_lock = name.startswith("_ZNSt11unique_lock");
+        bool is_constructor = name.contains("C1E") || name.contains("C2E");
+        bool is_destructor = name.endswith("D1Ev") || name.endswith("D2Ev");
+        if (is_constructor && call->arg_size() >= 2 && !name.contains("adopt_lock_t") &&
+            !name.contains("defer_lock_t") && !name.contains("EOS") && !name.contains("chrono")) {
+            LockOp op = name.contains("try_to_lock_t") ? LockOp::TryLock : LockOp::Lock;
+            return LockCall{call, op, 1, LockSource::Arguments};
+        }
+        if (is_destructor) {
+            return LockCall{call, LockOp::Unlock, 0, is_unique_lock ? LockSource::OwnedUniqueLock : LockSource::Guard};
+        }
+        if (is_unique_lock && name.endswith("4lockEv")) {
+            return LockCall{call, LockOp::Lock, 0, LockSource::UniqueLock};
+        }
+        if (is_unique_lock && name.endswith("8try_lockEv")) {
+            return LockCall{call, LockOp::TryLock, 0, LockSource::UniqueLock};
+        }
+        if (is_unique_lock && name.endswith("6unlockEv")) {
+            return LockCall{call, LockOp::Unlock, 0, LockSource::UniqueLock};
+        }
+    }
+    return LockCall{call, LockOp::None, 0, LockSource::Argument};
+}
+
+std::vector<llvm::Value*> LockProfiler::Locks(llvm::IRBuilder<>& builder, const LockCall& lock_call) {
+    llvm::CallBase* call = lock_call.call;
+    llvm::Type* i8_ptr = builder.getInt8PtrTy();
+    llvm::Value* object = call->getArgOperand(lock_call.lock_arg);
+    std::vector<llvm::Value*> locks;
+
+    switch (lock_call.source) {
+    case LockSource::Argument:
+        locks.push_back(builder.CreatePointerCast(object, i8_ptr));
+        break;
+    case LockSource::Arguments:
+        for (unsigned arg = lock_call.lock_arg; arg < call->arg_size(); arg++) {
+            if (call->getArgOperand(arg)->getType()->isPointerTy()) {
+                locks.push_back(builder.CreatePointerCast(call->getArgOperand(arg), i8_ptr));
+            }
+        }
+        break;
+    case LockSource::Guard:
+    case LockSource::UniqueLock:
+    case LockSource::OwnedUniqueLock: {
+        /* A lock_guard or a scoped_lock is an array of mutex pointers, a unique_lock starts with one */
+        llvm::Type* object_type = call->getCalledFunction()->getFunctionType()->getParamType(lock_call.lock_arg);
+        const llvm::DataLayout& data_layout = call->getModule()->getDataLayout();
+        uint64_t slots = 1;
+        if (lock_call.source == LockSource::Guard && object_type->getPointerElementType()->isSized()) {
+            slots = data_layout.getTypeAllocSize(object_type->getPointerElementType()) / sizeof(void*);
+        }
+        llvm::Value* mutexes = builder.CreatePointerCast(object, i8_ptr->getPointerTo());
+        for (uint64_t slot = 0; slot < slots; slot++) {
+            locks.push_back(builder.CreateLoad(i8_ptr, builder.CreateConstInBoundsGEP1_64(i8_ptr, mutexes, slot)));
+        }
+        if (lock_call.source == LockSource::OwnedUniqueLock) {
+            /* Releasing a lock the thread does not hold does nothing */
+            llvm::Value* owns = builder.CreateLoad(builder.getInt8Ty(), builder.CreateConstInBoundsGEP1_64(
+                                                       builder.getInt8Ty(), builder.CreatePointerCast(object, i8_ptr),
+                                                       sizeof(void*)));
+            locks[0] = builder.CreateSelect(builder.CreateICmpNE(owns, builder.getInt8(0)), locks[0],
+                                            llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8_ptr)));
+        }
+        break;
+    }
+    }
+    return locks;
+}
+
+void LockProfiler::Instrument(llvm::Function& func) {
+    llvm::StringRef name = func.getName();
+    if (name.startswith("_ZNSt5mutex") || name.startswith("_ZNSt15recursive_mutex") || name.contains("__gthread") ||
+        IsLockWrapper(name)) {
+        return;
+    }
+
+    std::vector<LockCall> lock_calls;
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            auto* call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+            if (call == nullptr) {
+                continue;
+            }
+            LockCall lock_call = Classify(call);
+            auto* invoke = llvm::dyn_cast<llvm::InvokeInst>(call);
+            bool can_follow = invoke == nullptr || ProfileEmitter::CanInstrumentEdge(&block, invoke->getNormalDest());
+            if (lock_call.op != LockOp::None && (lock_call.op == LockOp::Unlock || can_follow)) {
+                lock_calls.push_back(lock_call);
+            }
+        }
+    }
+    if (lock_calls.empty()) {
+        return;
+    }
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    llvm::Type* i8_ptr = builder.getInt8PtrTy();
+    llvm::Module& module = *func.getParent();
+
+    /* void ProfileLockBegin__(const SiteInfo* site, void* lock), the same for ProfileLockRelease__ */
+    llvm::FunctionCallee begin_callee =
+        module.getOrInsertFunction("ProfileLockBegin__", builder.getVoidTy(), i8_ptr, i8_ptr);
+    llvm::FunctionCallee release_callee =
+        module.getOrInsertFunction("ProfileLockRelease__", builder.getVoidTy(), i8_ptr, i8_ptr);
+    /* void ProfileLockEnd__(const SiteInfo* site, void* lock, int32_t acquired) */
+    llvm::FunctionCallee end_callee =
+        module.getOrInsertFunction("ProfileLockEnd__", builder.getVoidTy(), i8_ptr, i8_ptr, builder.getInt32Ty());
+
+    for (const LockCall& lock_call : lock_calls) {
+        llvm::CallBase* call = lock_call.call;
+        llvm::Constant* site = emitter_.AddSiteInfo(*call, call->getCalledFunction()->getName().str(),
+                                                    static_cast<uint32_t>(lock_call.op));
+        builder.SetInsertPoint(call);
+        std::vector<llvm::Value*> locks = Locks(builder, lock_call);
+        if (locks.empty()) {
+            continue;
+        }
+        if (lock_call.op == LockOp::Unlock) {
+            for (llvm::Value* lock : locks) {
+                builder.CreateCall(release_callee, {site, lock});
+            }
+            continue;
+        }
+        /* A scoped_lock takes all its mutexes at once, they share the wait */
+        builder.CreateCall(begin_callee, {site, locks[0]});
+
+        if (auto* invoke = llvm::dyn_cast<llvm::InvokeInst>(call)) {
+            builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(invoke->getParent(), invoke->getNormalDest()));
+        } else {
+            builder.SetInsertPoint(call->getNextNode());
+        }
+
+        /*
+         * The pthread functions return 0 on success, try_lock returns true, lock returns nothing.
+         * A condition wait holds the mutex again even when it timed out. A unique_lock built
+         * with try_to_lock owns the mutex if it got it, its flag follows the mutex pointer.
+         */
+        llvm::Value* acquired = builder.getInt32(1);
+        llvm::Type* result_type = call->getType();
+        if (lock_call.op != LockOp::CondWait && result_type->isIntegerTy()) {
+            bool is_pthread = call->getCalledFunction()->getName().startswith("pthread_");
+            llvm::Value* zero = llvm::ConstantInt::get(result_type, 0);
+            acquired = builder.CreateZExt(is_pthread ? builder.CreateICmpEQ(call, zero) : builder.CreateICmpNE(call, zero),
+                                          builder.getInt32Ty());
+        } else if (lock_call.op == LockOp::TryLock) {
+            llvm::Value* object = builder.CreatePointerCast(call->getArgOperand(0), i8_ptr);
+            llvm::Value* owns = builder.CreateLoad(
+                builder.getInt8Ty(), builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), object, sizeof(void*)));
+            acquired = builder.CreateZExt(builder.CreateICmpNE(owns, builder.getInt8(0)), builder.getInt32Ty());
+        }
+        for (llvm::Value* lock : locks) {
+            builder.CreateCall(end_callee, {site, lock, acquired});
+        }
+    }
+}
@@ -0,0 +1,142 @@
+#include <loop_trips.hpp>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using visual_dump::kLoopSiteSize;
+using visual_dump::kLoopTripBuckets;
+
+namespace {
+
+using Edge = std::pair<llvm::BasicBlock*, llvm::BasicBlock*>;
+
+/* Loops by index, an edge can leave one loop and enter the next */
+struct EdgeActions {
+    std::vector<uint32_t> exits;
+    std::vector<uint32_t> entries;
+};
+
+void AddUnique(std::vector<uint32_t>& loops, uint32_t loop) {
+    if (std::find(loops.begin(), loops.end(), loop) == loops.end()) {
+        loops.push_back(loop);
+    }
+}
+
+llvm::Value* Counter(llvm::IRBuilder<>& builder, llvm::GlobalVariable* counters, uint64_t idx) {
+    llvm::Value* indices[] = {builder.getInt64(0), builder.getInt64(idx)};
+    return builder.CreateInBoundsGEP(counters->getValueType(), counters, indices);
+}
+
+void UpdateMax(llvm::IRBuilder<>& builder, llvm::GlobalVariable* counters, uint64_t idx, llvm::Value* value) {
+    llvm::Value* counter = Counter(builder, counters, idx);
+    llvm::Value* current = builder.CreateLoad(builder.getInt64Ty(), counter);
+    builder.CreateStore(builder.CreateBinaryIntrinsic(llvm::Intrinsic::umax, current, value), counter);
+}
+
+} /* namespace */
+
+void LoopTrips::Begin(llvm::Function& func) {
+    first_instructions_.clear();
+    for (const llvm::BasicBlock& block : func) {
+        if (!block.empty()) {
+            first_instructions_[&block] = &block.front();
+        }
+    }
+}
+
+void LoopTrips::Instrument(llvm::Function& func, uint64_t hash) {
+    llvm::DominatorTree dominator_tree{func};
+    llvm::LoopInfo loop_info{dominator_tree};
+
+    /* Edges are collected first, splitting them invalidates the loop info */
+    std::map<Edge, EdgeActions> edges;
+    std::vector<llvm::BasicBlock*> headers;
+    std::vector<uint64_t> aux;
+    for (llvm::Loop* loop : loop_info.getLoopsInPreorder()) {
+        llvm::BasicBlock* header = loop->getHeader();
+        std::vector<Edge> entries;
+        for (llvm::BasicBlock* pred : llvm::predecessors(header)) {
+            if (!loop->contains(pred)) {
+                entries.emplace_back(pred, header);
+            }
+        }
+        llvm::SmallVector<Edge, 8> exits;
+        loop->getExitEdges(exits);
+
+        /* A trip count that is never reset would be garbage, so such loops are left out */
+        bool instrumentable = header->getFirstInsertionPt() != header->end();
+        for (const Edge& edge : entries) {
+            instrumentable &= ProfileEmitter::CanInstrumentEdge(edge.first, edge.second);
+        }
+        if (!instrumentable) {
+            continue;
+        }
+
+        auto idx = static_cast<uint32_t>(headers.size());
+        for (const Edge& edge : entries) {
+            AddUnique(edges[edge].entries, idx);
+        }
+        for (const Edge& edge : exits) {
+            if (ProfileEmitter::CanInstrumentEdge(edge.first, edge.second)) {
+                AddUnique(edges[edge].exits, idx);
+            }
+        }
+        auto first = first_instructions_.find(header);
+        headers.push_back(header);
+        aux.push_back(reinterpret_cast<uint64_t>(first != first_instructions_.end() ? first->second : &header->front()));
+        aux.push_back(loop->getStartLoc() ? loop->getStartLoc().getLine() : 0);
+    }
+    if (headers.empty()) {
+        return;
+    }
+
+    llvm::GlobalVariable* counters =
+        emitter_.AddCounters(func, hash, visual_dump::CounterKind::LoopTrips,
+                             static_cast<uint32_t>(headers.size()) * kLoopSiteSize, nullptr, aux);
+
+    llvm::IRBuilder<> builder{&func.getEntryBlock(), func.getEntryBlock().getFirstInsertionPt()};
+    std::vector<llvm::AllocaInst*> trips;
+    for (size_t i = 0; i < headers.size(); i++) {
+        trips.push_back(builder.CreateAlloca(builder.getInt64Ty(), nullptr, "visual_dump.trips"));
+    }
+
+    for (size_t i = 0; i < headers.size(); i++) {
+        builder.SetInsertPoint(headers[i], headers[i]->getFirstInsertionPt());
+        llvm::Value* count = builder.CreateLoad(builder.getInt64Ty(), trips[i]);
+        builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)), trips[i]);
+    }
+
+    for (const auto& edge : edges) {
+        builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(edge.first.first, edge.first.second));
+        for (uint32_t loop : edge.second.exits) {
+            uint64_t base = loop * kLoopSiteSize;
+            llvm::Value* count = builder.CreateLoad(builder.getInt64Ty(), trips[loop]);
+            ProfileEmitter::Increment(builder, counters, builder.getInt64(base + 1));
+
+            llvm::Value* sum = Counter(builder, counters, base + 2);
+            builder.CreateStore(builder.CreateAdd(builder.CreateLoad(builder.getInt64Ty(), sum), count), sum);
+            UpdateMax(builder, counters, base + 3, count);
+            UpdateMax(builder, counters, base + 4, builder.CreateNot(count));
+
+            /* floor(log2(trips)), the header ran at least once */
+            llvm::Value* leading_zeros = builder.CreateBinaryIntrinsic(
+                llvm::Intrinsic::ctlz, builder.CreateOr(count, builder.getInt64(1)), builder.getFalse());
+            llvm::Value* bucket = builder.CreateBinaryIntrinsic(
+                llvm::Intrinsic::umin, builder.CreateSub(builder.getInt64(63), leading_zeros),
+                builder.getInt64(kLoopTripBuckets - 1));
+            ProfileEmitter::Increment(builder, counters, builder.CreateAdd(bucket, builder.getInt64(base + 5)));
+        }
+        for (uint32_t loop : edge.second.entries) {
+            ProfileEmitter::Increment(builder, counters, builder.getInt64(loop * kLoopSiteSize));
+            builder.CreateStore(builder.getInt64(0), trips[loop]);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#include <memory_profiler.hpp>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <vector>
+
+bool MemoryProfiler::IsSelected(const llvm::Function& func, const std::string& functions) {
+    if (functions == "all") {
+        return true;
+    }
+
+    llvm::SmallVector<llvm::StringRef, 8> names;
+    llvm::StringRef(functions).split(names, ',', -1, false);
+    for (llvm::StringRef name : names) {
+        if (name.trim() == func.getName()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MemoryProfiler::Instrument(llvm::Function& func, const std::string& functions, const char* hook) {
+    if (!IsSelected(func, functions)) {
+        return;
+    }
+
+    std::vector<llvm::Instruction*> accesses;
+    for (auto& block : func) {
+        for (auto& instruction : block) {
+            llvm::Value* pointer = llvm::getLoadStorePointerOperand(&instruction);
+            if (pointer == nullptr) {
+                continue;
+            }
+            const llvm::Value* object = llvm::getUnderlyingObject(pointer);
+            auto* global = llvm::dyn_cast<llvm::GlobalVariable>(object);
+            if (!llvm::isa<llvm::AllocaInst>(object) && (global == nullptr || !global->isThreadLocal())) {
+                accesses.push_back(&instruction);
+            }
+        }
+    }
+    if (accesses.empty()) {
+        return;
+    }
+
+    llvm::IRBuilder<> builder{func.getContext()};
+    const llvm::DataLayout& data_layout = func.getParent()->getDataLayout();
+
+    /* void hook(const SiteInfo* site, const void* address) */
+    llvm::FunctionCallee profile_callee = func.getParent()->getOrInsertFunction(
+        hook, builder.getVoidTy(), builder.getInt8PtrTy(), builder.getInt8PtrTy());
+
+    for (llvm::Instruction* access : accesses) {
+        bool is_store = llvm::isa<llvm::StoreInst>(access);
+        llvm::Type* type = llvm::getLoadStoreType(access);
+        auto size = static_cast<uint32_t>(data_layout.getTypeStoreSize(type).getKnownMinSize());
+        uint32_t attributes = std::min(size, visual_dump::kAccessSizeMask) | (is_store ? visual_dump::kStoreAccess : 0);
+
+        std::string text;
+        llvm::raw_string_ostream text_stream{text};
+        text_stream << (is_store ? "store " : "load ") << *type;
+        llvm::Constant* site = emitter_.AddSiteInfo(*access, text_stream.str(), attributes);
+
+        builder.SetInsertPoint(access);
+        llvm::Value* address = builder.CreatePointerCast(llvm::getLoadStorePointerOperand(access),
+                                                         builder.getInt8PtrTy());
+        builder.CreateCall(profile_callee, {site, address});
+    }
+}
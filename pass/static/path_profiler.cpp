@@ -0,0 +1,213 @@
+#include <path_profiler.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+using visual_dump::PathEdgeKind;
+
+namespace {
+
+/* Beyond this the path numbers are no use to anybody */
+constexpr uint64_t kMaxPaths = 1ull << 48;
+
+std::vector<llvm::BasicBlock*> UniqueSuccessors(llvm::BasicBlock* block) {
+    std::vector<llvm::BasicBlock*> successors;
+    for (llvm::BasicBlock* successor : llvm::successors(block)) {
+        if (std::find(successors.begin(), successors.end(), successor) == successors.end()) {
+            successors.push_back(successor);
+        }
+    }
+    return successors;
+}
+
+} /* namespace */
+
+void PathProfiler::Instrument(llvm::Function& func) {
+    std::vector<llvm::BasicBlock*> blocks;
+    std::map<const llvm::BasicBlock*, uint32_t> block_idx;
+    for (auto& block : func) {
+        block_idx.emplace(&block, blocks.size());
+        blocks.push_back(&block);
+    }
+    uint32_t entry = static_cast<uint32_t>(blocks.size());
+    uint32_t exit = entry + 1;
+
+    /* Back edges are the ones to a block on the DFS stack, unreachable blocks are searched too */
+    std::vector<std::pair<llvm::BasicBlock*, llvm::BasicBlock*>> back_edges;
+    std::vector<uint8_t> states(blocks.size(), 0); /* 0 new, 1 on the stack, 2 done */
+    for (uint32_t root = 0; root < blocks.size(); root++) {
+        if (states[root] != 0) {
+            continue;
+        }
+        std::vector<std::pair<uint32_t, size_t>> stack = {{root, 0}};
+        states[root] = 1;
+        while (!stack.empty()) {
+            uint32_t block = stack.back().first;
+            std::vector<llvm::BasicBlock*> successors = UniqueSuccessors(blocks[block]);
+            if (stack.back().second == successors.size()) {
+                states[block] = 2;
+                stack.pop_back();
+                continue;
+            }
+            uint32_t successor = block_idx[successors[stack.back().second++]];
+            if (states[successor] == 1) {
+                back_edges.emplace_back(blocks[block], blocks[successor]);
+            } else if (states[successor] == 0) {
+                states[successor] = 1;
+                stack.emplace_back(successor, 0);
+            }
+        }
+    }
+
+    /* Every edge the instrumentation goes on must take code */
+    for (auto& block : func) {
+        for (llvm::BasicBlock* successor : UniqueSuccessors(&block)) {
+            if (!ProfileEmitter::CanInstrumentEdge(&block, successor)) {
+                llvm::errs() << "visual-dump: no path profile for '" << func.getName() << "', its CFG cannot be counted\n";
+                return;
+            }
+        }
+    }
+
+    /* The DAG, the virtual entry enters the entry block first so its paths get the low numbers */
+    std::vector<std::vector<DagEdge>> dag(blocks.size() + 2);
+    dag[entry].push_back(DagEdge{0, PathEdgeKind::Real, 0});
+    for (uint32_t block = 0; block < blocks.size(); block++) {
+        std::vector<llvm::BasicBlock*> successors = UniqueSuccessors(blocks[block]);
+        bool has_loop_exit = false;
+        for (llvm::BasicBlock* successor : successors) {
+            auto back_edge = std::make_pair(blocks[block], successor);
+            if (std::find(back_edges.begin(), back_edges.end(), back_edge) == back_edges.end()) {
+                dag[block].push_back(DagEdge{block_idx[successor], PathEdgeKind::Real, 0});
+                continue;
+            }
+
+            auto& entry_edges = dag[entry];
+            uint32_t header = block_idx[successor];
+            if (std::none_of(entry_edges.begin(), entry_edges.end(), [header](const DagEdge& edge) {
+                    return edge.kind == PathEdgeKind::LoopEntry && edge.dst == header;
+                })) {
+                entry_edges.push_back(DagEdge{header, PathEdgeKind::LoopEntry, 0});
+            }
+            if (!has_loop_exit) {
+                dag[block].push_back(DagEdge{exit, PathEdgeKind::LoopExit, 0});
+                has_loop_exit = true;
+            }
+        }
+        if (successors.empty()) {
+            dag[block].push_back(DagEdge{exit, PathEdgeKind::Real, 0});
+        }
+    }
+
+    /* Reverse topological order, the number of paths to the exit of every vertex and the edge values */
+    std::vector<uint32_t> in_degree(dag.size(), 0);
+    for (const auto& edges : dag) {
+        for (const DagEdge& edge : edges) {
+            in_degree[edge.dst]++;
+        }
+    }
+    std::vector<uint32_t> order;
+    for (uint32_t vertex = 0; vertex < dag.size(); vertex++) {
+        if (in_degree[vertex] == 0) {
+            order.push_back(vertex);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (const DagEdge& edge : dag[order[i]]) {
+            if (--in_degree[edge.dst] == 0) {
+                order.push_back(edge.dst);
+            }
+        }
+    }
+
+    std::vector<uint64_t> num_paths(dag.size(), 0);
+    num_paths[exit] = 1;
+    for (auto vertex = order.rbegin(); vertex != order.rend(); ++vertex) {
+        if (*vertex == exit) {
+            continue;
+        }
+        for (DagEdge& edge : dag[*vertex]) {
+            edge.value = num_paths[*vertex];
+            num_paths[*vertex] += num_paths[edge.dst];
+        }
+        if (num_paths[*vertex] > kMaxPaths) {
+            llvm::errs() << "visual-dump: no path profile for '" << func.getName() << "', too many paths\n";
+            return;
+        }
+    }
+
+    std::vector<uint64_t> graph = {blocks.size()};
+    for (const auto& edges : dag) {
+        graph.push_back(edges.size());
+        for (const DagEdge& edge : edges) {
+            graph.insert(graph.end(), {edge.dst, static_cast<uint64_t>(edge.kind), edge.value});
+        }
+    }
+    for (llvm::BasicBlock* block : blocks) {
+        graph.push_back(block->size());
+        for (auto& instruction : *block) {
+            graph.push_back(reinterpret_cast<uint64_t>(&instruction));
+        }
+    }
+
+    llvm::Module& module = *func.getParent();
+    llvm::LLVMContext& context = func.getContext();
+    llvm::Constant* graph_data = llvm::ConstantDataArray::get(context, graph);
+    auto* graph_var = new llvm::GlobalVariable(module, graph_data->getType(), true,
+                                               llvm::GlobalValue::PrivateLinkage, graph_data,
+                                               "__visual_dump_paths." + func.getName());
+    llvm::Constant* site = emitter_.AddSiteInfo(func, "", 0);
+
+    llvm::IRBuilder<> builder{&*func.getEntryBlock().getFirstInsertionPt()};
+    llvm::Type* i64 = builder.getInt64Ty();
+
+    /* void ProfilePath__(const SiteInfo* site, const uint64_t* graph, uint64_t path) */
+    llvm::FunctionCallee profile_callee = module.getOrInsertFunction(
+        "ProfilePath__", builder.getVoidTy(), builder.getInt8PtrTy(), i64->getPointerTo(), i64);
+    llvm::Value* graph_ptr = builder.CreateConstInBoundsGEP2_64(graph_data->getType(), graph_var, 0, 0);
+
+    /* The entry block has no predecessors, the register starts there */
+    llvm::AllocaInst* path = builder.CreateAlloca(i64, nullptr, "__visual_dump_path");
+    builder.CreateStore(builder.getInt64(0), path);
+
+    auto count_path = [&](uint64_t value) {
+        llvm::Value* path_value = builder.CreateAdd(builder.CreateLoad(i64, path), builder.getInt64(value));
+        builder.CreateCall(profile_callee, {site, graph_ptr, path_value});
+    };
+
+    for (uint32_t block = 0; block < blocks.size(); block++) {
+        for (const DagEdge& edge : dag[block]) {
+            if (edge.dst == exit && edge.kind == PathEdgeKind::Real) {
+                builder.SetInsertPoint(blocks[block]->getTerminator());
+                count_path(edge.value);
+            } else if (edge.kind == PathEdgeKind::Real && edge.value != 0) {
+                builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(blocks[block], blocks[edge.dst]));
+                builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, path), builder.getInt64(edge.value)),
+                                    path);
+            }
+        }
+    }
+
+    /* A back edge ends the path through the latch and starts the one through the header */
+    for (const auto& back_edge : back_edges) {
+        uint32_t latch = block_idx[back_edge.first];
+        uint32_t header = block_idx[back_edge.second];
+        auto loop_exit = std::find_if(dag[latch].begin(), dag[latch].end(), [](const DagEdge& edge) {
+            return edge.kind == PathEdgeKind::LoopExit;
+        });
+        auto loop_entry = std::find_if(dag[entry].begin(), dag[entry].end(), [header](const DagEdge& edge) {
+            return edge.kind == PathEdgeKind::LoopEntry && edge.dst == header;
+        });
+
+        builder.SetInsertPoint(ProfileEmitter::EdgeInsertPoint(back_edge.first, back_edge.second));
+        count_path(loop_exit->value);
+        builder.CreateStore(builder.getInt64(loop_entry->value), path);
+    }
+}
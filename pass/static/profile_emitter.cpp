@@ -0,0 +1,399 @@
+#include <metadata_section.hpp>
+#include <profile_emitter.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <map>
+
+uint64_t ProfileEmitter::FunctionHash(const llvm::Function& func) {
+    /* FNV-1a over the block count and every block's successor indices */
+    std::map<const llvm::BasicBlock*, uint64_t> block_idx;
+    for (auto& block : func) {
+        block_idx.emplace(&block, block_idx.size());
+    }
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto mix = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 0x100000001B3ull;
+    };
+
+    mix(block_idx.size());
+    for (auto& block : func) {
+        const llvm::Instruction* terminator = block.getTerminator();
+        unsigned succ_num = terminator != nullptr ? terminator->getNumSuccessors() : 0;
+        mix(succ_num);
+        for (unsigned i = 0; i < succ_num; i++) {
+            mix(block_idx[terminator->getSuccessor(i)]);
+        }
+    }
+    return hash;
+}
+
+llvm::GlobalVariable* ProfileEmitter::AddCounters(llvm::Function& func, uint64_t hash,
+                                                  visual_dump::CounterKind kind, uint32_t num_counters,
+                                                  llvm::Type* counter_type,
+                                                  const std::vector<uint64_t>& aux) {
+    llvm::LLVMContext& context = func.getContext();
+    if (counter_type == nullptr) {
+        counter_type = llvm::Type::getInt64Ty(context);
+    }
+
+    llvm::ArrayType* array_type = llvm::ArrayType::get(counter_type, num_counters);
+    auto* counters = new llvm::GlobalVariable(
+        *func.getParent(), array_type, false, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantAggregateZero::get(array_type), "__visual_dump_counters." + func.getName());
+
+    tables_.push_back(Table{kind, hash, func.getName().str(), counters, num_counters, aux});
+    DescribeFunction(func);
+    return counters;
+}
+
+void ProfileEmitter::AddTable(llvm::Function& func, uint64_t hash, visual_dump::CounterKind kind,
+                              llvm::Constant* counters, uint32_t num_counters, const std::vector<uint64_t>& aux) {
+    tables_.push_back(Table{kind, hash, func.getName().str(), counters, num_counters, aux});
+    DescribeFunction(func);
+}
+
+void ProfileEmitter::AddFunctionAddress(llvm::Function& func) {
+    tables_.push_back(Table{visual_dump::CounterKind::FunctionAddress, 0, func.getName().str(), &func, 0, {}});
+    DescribeFunction(func);
+}
+
+llvm::Constant* ProfileEmitter::AddSiteInfo(llvm::Instruction& instruction, const std::string& text,
+                                            uint32_t attributes) {
+    DescribeSite(instruction, text);
+    return AddSiteInfo(*instruction.getModule(), reinterpret_cast<uint64_t>(&instruction),
+                       instruction.getFunction()->getName().str(), instruction.getDebugLoc().get(), text, attributes);
+}
+
+llvm::Constant* ProfileEmitter::AddSiteInfo(llvm::Function& func, const std::string& text, uint32_t attributes) {
+    llvm::DILocation* location = nullptr;
+    if (llvm::DISubprogram* subprogram = func.getSubprogram()) {
+        location = llvm::DILocation::get(func.getContext(), subprogram->getLine(), 0, subprogram);
+    }
+    DescribeFunction(func);
+    return AddSiteInfo(*func.getParent(), reinterpret_cast<uint64_t>(&func), func.getName().str(), location, text,
+                       attributes);
+}
+
+llvm::Constant* ProfileEmitter::AddSiteInfo(llvm::Module& module, uint64_t id, const std::string& function,
+                                            const llvm::DILocation* location, const std::string& text,
+                                            uint32_t attributes) {
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder{context};
+    llvm::Type* i8_ptr = builder.getInt8PtrTy();
+
+    llvm::Constant* file = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8_ptr));
+    uint32_t line = 0;
+    if (location != nullptr) {
+        file = GetString(module, location->getFilename().str());
+        line = location->getLine();
+    }
+
+    llvm::StructType* site_type = GetSiteInfoType(context);
+    llvm::Constant* site = llvm::ConstantStruct::get(site_type, {
+        builder.getInt64(id),
+        GetString(module, function),
+        file,
+        builder.getInt32(line),
+        builder.getInt32(attributes),
+        GetString(module, text),
+    });
+    auto* site_var = new llvm::GlobalVariable(module, site_type, true, llvm::GlobalValue::PrivateLinkage, site,
+                                              "__visual_dump_site");
+    return llvm::ConstantExpr::getPointerCast(site_var, i8_ptr);
+}
+
+uint32_t ProfileEmitter::AddSourceLine(const llvm::DILocation& location) {
+    /* The full path, so that the listings find the file from anywhere */
+    std::string file = location.getFilename().str();
+    if (!file.empty() && file[0] != '/' && !location.getDirectory().empty()) {
+        file = location.getDirectory().str() + "/" + file;
+    }
+    auto key = std::make_tuple(file, location.getLine(), location.getColumn());
+    return source_lines_.emplace(key, static_cast<uint32_t>(source_lines_.size())).first->second;
+}
+
+void ProfileEmitter::DescribeFunction(llvm::Function& func) {
+    uint64_t id = reinterpret_cast<uint64_t>(&func);
+    if (functions_.count(id) != 0) {
+        return;
+    }
+    const llvm::DISubprogram* subprogram = func.getSubprogram();
+    functions_.emplace(id, FunctionMetadata{func.getName().str(),
+                                            subprogram != nullptr ? subprogram->getFilename().str() : "",
+                                            subprogram != nullptr ? subprogram->getLine() : 0});
+}
+
+void ProfileEmitter::DescribeSite(llvm::Instruction& instruction, const std::string& text) {
+    DescribeFunction(*instruction.getFunction());
+
+    /* Several modes may instrument the same instruction */
+    auto site = sites_.find(reinterpret_cast<uint64_t>(&instruction));
+    if (site != sites_.end()) {
+        if (site->second.text != text) {
+            site->second.text += ", " + text;
+        }
+        return;
+    }
+
+    const llvm::DILocation* location = instruction.getDebugLoc().get();
+    sites_.emplace(reinterpret_cast<uint64_t>(&instruction),
+                   SiteMetadata{reinterpret_cast<uint64_t>(instruction.getFunction()),
+                                location != nullptr ? location->getFilename().str() : "",
+                                location != nullptr ? location->getLine() : 0,
+                                location != nullptr ? location->getColumn() : 0, text});
+}
+
+bool ProfileEmitter::IsHook(const llvm::Function* callee) {
+    return callee != nullptr && callee->isDeclaration() && callee->getName().endswith("__");
+}
+
+bool ProfileEmitter::CanInstrumentEdge(llvm::BasicBlock* src, llvm::BasicBlock* dst) {
+    if (src->getUniqueSuccessor() == dst) {
+        return true;
+    }
+    if (dst->getUniquePredecessor() == src) {
+        return dst->getFirstInsertionPt() != dst->end();
+    }
+
+    /* Critical edge, it has to be split */
+    const llvm::Instruction* terminator = src->getTerminator();
+    return !dst->isEHPad() && !llvm::isa<llvm::IndirectBrInst>(terminator) && !llvm::isa<llvm::CallBrInst>(terminator);
+}
+
+llvm::Instruction* ProfileEmitter::EdgeInsertPoint(llvm::BasicBlock* src, llvm::BasicBlock* dst) {
+    if (src->getUniqueSuccessor() == dst) {
+        return src->getTerminator();
+    }
+    if (dst->getUniquePredecessor() == src) {
+        return &*dst->getFirstInsertionPt();
+    }
+
+    llvm::Instruction* terminator = src->getTerminator();
+    unsigned successor_idx = 0;
+    while (terminator->getSuccessor(successor_idx) != dst) {
+        successor_idx++;
+    }
+    llvm::BasicBlock* split = llvm::SplitCriticalEdge(terminator, successor_idx,
+                                                      llvm::CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+    return &*split->getFirstInsertionPt();
+}
+
+void ProfileEmitter::Increment(llvm::IRBuilder<>& builder, llvm::GlobalVariable* counters, llvm::Value* idx) {
+    llvm::Type* array_type = counters->getValueType();
+    llvm::Type* counter_type = array_type->getArrayElementType();
+
+    /* Without a location, the increment belongs to no source line, see LineProfiler */
+    llvm::DebugLoc location = builder.getCurrentDebugLocation();
+    builder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+    llvm::Value* indices[] = {builder.getInt64(0), builder.CreateZExtOrTrunc(idx, builder.getInt64Ty())};
+    llvm::Value* counter = builder.CreateInBoundsGEP(array_type, counters, indices);
+    llvm::Value* value = builder.CreateLoad(counter_type, counter);
+    builder.CreateStore(builder.CreateAdd(value, llvm::ConstantInt::get(counter_type, 1)), counter);
+    builder.SetCurrentDebugLocation(location);
+}
+
+llvm::StructType* ProfileEmitter::GetTableType(llvm::LLVMContext& context) {
+    llvm::Type* i8_ptr = llvm::Type::getInt8PtrTy(context);
+    llvm::Type* i32 = llvm::Type::getInt32Ty(context);
+    llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+
+    /* Mirrors visual_dump::CounterTable */
+    return llvm::StructType::get(context, {i32, i32, i64, i8_ptr, i8_ptr, i8_ptr, i64});
+}
+
+llvm::StructType* ProfileEmitter::GetSiteInfoType(llvm::LLVMContext& context) {
+    llvm::Type* i8_ptr = llvm::Type::getInt8PtrTy(context);
+    llvm::Type* i32 = llvm::Type::getInt32Ty(context);
+    llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+
+    /* Mirrors visual_dump::SiteInfo */
+    return llvm::StructType::get(context, {i64, i8_ptr, i8_ptr, i32, i32, i8_ptr});
+}
+
+llvm::Constant* ProfileEmitter::GetString(llvm::Module& module, const std::string& str) {
+    llvm::Constant*& string_ptr = strings_[{&module, str}];
+    if (string_ptr == nullptr) {
+        llvm::Constant* data = llvm::ConstantDataArray::getString(module.getContext(), str);
+        auto* string_var = new llvm::GlobalVariable(module, data->getType(), true,
+                                                    llvm::GlobalValue::PrivateLinkage, data);
+        string_ptr = llvm::ConstantExpr::getPointerCast(string_var, llvm::Type::getInt8PtrTy(module.getContext()));
+    }
+    return string_ptr;
+}
+
+/* The module's record of the .visual_dump section, its layout is that of metadata_section.hpp */
+void ProfileEmitter::EmitMetadata(llvm::Module& module) {
+    if (functions_.empty() && sites_.empty()) {
+        return;
+    }
+
+    std::string strings(1, '\0');
+    std::map<std::string, uint32_t> offsets;
+    auto intern = [&strings, &offsets](const std::string& str) -> uint32_t {
+        if (str.empty()) {
+            return 0;
+        }
+        auto offset = offsets.emplace(str, static_cast<uint32_t>(strings.size()));
+        if (offset.second) {
+            strings.append(str).push_back('\0');
+        }
+        return offset.first->second;
+    };
+
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder{context};
+    llvm::Type* i32 = builder.getInt32Ty();
+    llvm::Type* i64 = builder.getInt64Ty();
+    llvm::StructType* header_type = llvm::StructType::get(context, {i32, i32, i64, i32, i32, i32, i32});
+    llvm::StructType* function_type = llvm::StructType::get(context, {i64, i32, i32, i32, i32});
+    llvm::StructType* site_type = llvm::StructType::get(context, {i64, i64, i32, i32, i32, i32});
+
+    std::vector<llvm::Constant*> functions;
+    for (const auto& function : functions_) {
+        functions.push_back(llvm::ConstantStruct::get(function_type, {
+            builder.getInt64(function.first),
+            builder.getInt32(intern(function.second.name)),
+            builder.getInt32(intern(function.second.file)),
+            builder.getInt32(function.second.line),
+            builder.getInt32(0),
+        }));
+    }
+    std::vector<llvm::Constant*> sites;
+    for (const auto& site : sites_) {
+        sites.push_back(llvm::ConstantStruct::get(site_type, {
+            builder.getInt64(site.first),
+            builder.getInt64(site.second.function),
+            builder.getInt32(intern(site.second.file)),
+            builder.getInt32(site.second.line),
+            builder.getInt32(site.second.column),
+            builder.getInt32(intern(site.second.text)),
+        }));
+    }
+    uint32_t module_name = intern(module.getSourceFileName());
+
+    /* The linker packs the records back to back, each keeps the 8 byte alignment of the next */
+    strings.resize((strings.size() + 7) & ~size_t{7}, '\0');
+    uint64_t size = sizeof(visual_dump::MetadataHeader) + functions.size() * sizeof(visual_dump::MetadataFunction) +
+                    sites.size() * sizeof(visual_dump::MetadataSite) + strings.size();
+
+    llvm::ArrayType* functions_type = llvm::ArrayType::get(function_type, functions.size());
+    llvm::ArrayType* sites_type = llvm::ArrayType::get(site_type, sites.size());
+    llvm::Constant* strings_data = llvm::ConstantDataArray::getString(context, strings, false);
+    llvm::StructType* record_type =
+        llvm::StructType::get(context, {header_type, functions_type, sites_type, strings_data->getType()});
+    llvm::Constant* record = llvm::ConstantStruct::get(record_type, {
+        llvm::ConstantStruct::get(header_type, {
+            builder.getInt32(visual_dump::kMetadataMagic),
+            builder.getInt32(visual_dump::kMetadataVersion),
+            builder.getInt64(size),
+            builder.getInt32(static_cast<uint32_t>(functions.size())),
+            builder.getInt32(static_cast<uint32_t>(sites.size())),
+            builder.getInt32(static_cast<uint32_t>(strings.size())),
+            builder.getInt32(module_name),
+        }),
+        llvm::ConstantArray::get(functions_type, functions),
+        llvm::ConstantArray::get(sites_type, sites),
+        strings_data,
+    });
+
+    auto* record_var = new llvm::GlobalVariable(module, record_type, true, llvm::GlobalValue::PrivateLinkage, record,
+                                                "__visual_dump_metadata");
+    record_var->setSection(visual_dump::kMetadataSection);
+    record_var->setAlignment(llvm::Align(8));
+    llvm::appendToCompilerUsed(module, {record_var});
+
+    functions_.clear();
+    sites_.clear();
+}
+
+void ProfileEmitter::EmitSourceLines(llvm::Module& module) {
+    if (source_lines_.empty()) {
+        return;
+    }
+
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder{context};
+    /* Mirrors visual_dump::SourceLine */
+    llvm::StructType* line_type =
+        llvm::StructType::get(context, {builder.getInt8PtrTy(), builder.getInt32Ty(), builder.getInt32Ty()});
+
+    std::vector<llvm::Constant*> lines(source_lines_.size());
+    for (const auto& source_line : source_lines_) {
+        lines[source_line.second] = llvm::ConstantStruct::get(line_type, {
+            GetString(module, std::get<0>(source_line.first)),
+            builder.getInt32(std::get<1>(source_line.first)),
+            builder.getInt32(std::get<2>(source_line.first)),
+        });
+    }
+
+    llvm::ArrayType* lines_type = llvm::ArrayType::get(line_type, lines.size());
+    auto* lines_var = new llvm::GlobalVariable(module, lines_type, true, llvm::GlobalValue::PrivateLinkage,
+                                               llvm::ConstantArray::get(lines_type, lines), "__visual_dump_lines");
+    tables_.push_back(Table{visual_dump::CounterKind::SourceLines, 0, module.getSourceFileName(), lines_var,
+                            static_cast<uint32_t>(lines.size()), {}});
+    source_lines_.clear();
+}
+
+void ProfileEmitter::Finalize(llvm::Module& module) {
+    strings_.clear();
+    EmitMetadata(module);
+    EmitSourceLines(module);
+    if (tables_.empty()) {
+        return;
+    }
+
+    llvm::LLVMContext& context = module.getContext();
+    llvm::IRBuilder<> builder{context};
+    llvm::StructType* table_type = GetTableType(context);
+    llvm::Type* i8_ptr = builder.getInt8PtrTy();
+
+    std::vector<llvm::Constant*> tables;
+    for (auto& table : tables_) {
+        llvm::Constant* name = llvm::ConstantDataArray::getString(context, table.function);
+        auto* name_var = new llvm::GlobalVariable(module, name->getType(), true,
+                                                  llvm::GlobalValue::PrivateLinkage, name);
+
+        llvm::Constant* aux = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(i8_ptr));
+        if (!table.aux.empty()) {
+            llvm::Constant* aux_data = llvm::ConstantDataArray::get(context, table.aux);
+            aux = new llvm::GlobalVariable(module, aux_data->getType(), true,
+                                           llvm::GlobalValue::PrivateLinkage, aux_data);
+        }
+
+        tables.push_back(llvm::ConstantStruct::get(table_type, {
+            builder.getInt32(static_cast<uint32_t>(table.kind)),
+            builder.getInt32(table.num_counters),
+            builder.getInt64(table.hash),
+            llvm::ConstantExpr::getPointerCast(name_var, i8_ptr),
+            llvm::ConstantExpr::getPointerCast(table.counters, i8_ptr),
+            llvm::ConstantExpr::getPointerCast(aux, i8_ptr),
+            builder.getInt64(table.aux.size()),
+        }));
+    }
+
+    llvm::ArrayType* tables_type = llvm::ArrayType::get(table_type, tables.size());
+    auto* tables_var = new llvm::GlobalVariable(module, tables_type, true, llvm::GlobalValue::PrivateLinkage,
+                                                llvm::ConstantArray::get(tables_type, tables),
+                                                "__visual_dump_tables");
+
+    /* void RegisterCounters__(const CounterTable* tables, uint64_t num_tables) */
+    llvm::FunctionCallee register_callee = module.getOrInsertFunction(
+        "RegisterCounters__", builder.getVoidTy(), table_type->getPointerTo(), builder.getInt64Ty());
+
+    auto* ctor = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false),
+                                        llvm::GlobalValue::InternalLinkage, "__visual_dump_register", module);
+    builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", ctor));
+    llvm::Value* first_table = builder.CreateConstInBoundsGEP2_64(tables_type, tables_var, 0, 0);
+    builder.CreateCall(register_callee, {first_table, builder.getInt64(tables.size())});
+    builder.CreateRetVoid();
+
+    llvm::appendToGlobalCtors(module, ctor, 0);
+    tables_.clear();
+}
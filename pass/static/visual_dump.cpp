@@ -9,6 +9,7 @@
 
 /* Common */
 #include <llvm/Pass.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
@@ -16,15 +17,115 @@
 /* Dot */
 #include <dot_builder.hpp>
 
+/* Profiling */
+#include <argument_profiler.hpp>
+#include <binary_op_profiler.hpp>
+#include <branch_bias.hpp>
+#include <lock_profiler.hpp>
+#include <loop_trips.hpp>
+#include <memory_profiler.hpp>
+#include <branch_weights.hpp>
+#include <coverage.hpp>
+#include <heap_profiler.hpp>
+#include <edge_profiler.hpp>
+#include <path_profiler.hpp>
+#include <indirect_calls.hpp>
+#include <instruction_mix.hpp>
+#include <line_profiler.hpp>
+#include <profile_emitter.hpp>
+#include <profile_reader.hpp>
+
 namespace {
 
+/* Options are passed through clang as "-mllvm -visual-dump-..." */
+static llvm::cl::opt<bool> LogCalls(
+    "visual-dump-log-calls", llvm::cl::init(true),
+    llvm::cl::desc("Insert the LogFunctionCall__/LogFuncEntry__/LogFuncRet__ hooks"));
+
+static llvm::cl::opt<bool> ProfileGen(
+    "visual-dump-profile-gen", llvm::cl::init(false),
+    llvm::cl::desc("Count function entries and branch successors into visual_dump.prof"));
+
+static llvm::cl::opt<std::string> ProfileUse(
+    "visual-dump-profile-use", llvm::cl::init(""), llvm::cl::value_desc("file"),
+    llvm::cl::desc("Attach entry counts and branch weights from a visual_dump.prof, no instrumentation"));
+
+static llvm::cl::opt<bool> ValueProfile(
+    "visual-dump-value-profile", llvm::cl::init(false),
+    llvm::cl::desc("Profile the arguments of pure functions to find memoization candidates"));
+
+static llvm::cl::opt<std::string> BinaryOpProfile(
+    "visual-dump-binop-profile", llvm::cl::init(""), llvm::cl::value_desc("opcodes"),
+    llvm::cl::desc("Profile the operand values of binary operators, e.g. \"mul,udiv\" or \"all\""));
+
+static llvm::cl::opt<bool> BlockCoverage(
+    "visual-dump-coverage", llvm::cl::init(false),
+    llvm::cl::desc("Mark every executed basic block in a per-module bitmap, no calls"));
+
+static llvm::cl::opt<bool> EdgeProfile(
+    "visual-dump-edge-profile", llvm::cl::init(false),
+    llvm::cl::desc("Count the CFG edges outside a maximum spanning tree, the profile-use compile recovers the rest"));
+
+static llvm::cl::opt<bool> PathProfile(
+    "visual-dump-path-profile", llvm::cl::init(false),
+    llvm::cl::desc("Count the Ball-Larus acyclic paths through every function"));
+
+static llvm::cl::opt<bool> BranchBiasProfile(
+    "visual-dump-branch-bias", llvm::cl::init(false),
+    llvm::cl::desc("Count the directions and direction changes of every conditional branch"));
+
+static llvm::cl::opt<bool> LoopTripProfile(
+    "visual-dump-loop-trips", llvm::cl::init(false),
+    llvm::cl::desc("Record a trip count histogram of every loop, no calls"));
+
+static llvm::cl::opt<std::string> MemoryProfile(
+    "visual-dump-memory-profile", llvm::cl::init(""), llvm::cl::value_desc("functions"),
+    llvm::cl::desc("Sample the addresses of the loads and stores of these functions, e.g. \"lookup,insert\" or \"all\""));
+
+static llvm::cl::opt<std::string> FalseSharing(
+    "visual-dump-false-sharing", llvm::cl::init(""), llvm::cl::value_desc("functions"),
+    llvm::cl::desc("Find cache lines several threads write at different offsets, e.g. \"worker\" or \"all\""));
+
+static llvm::cl::opt<bool> HeapProfile(
+    "visual-dump-heap-profile", llvm::cl::init(false),
+    llvm::cl::desc("Attribute malloc/free and new/delete calls to their sites and caller chains"));
+
+static llvm::cl::opt<bool> LockProfile(
+    "visual-dump-lock-profile", llvm::cl::init(false),
+    llvm::cl::desc("Time the waits and holds of pthread and std::mutex locks per lock and call site"));
+
+static llvm::cl::opt<bool> InstructionMixProfile(
+    "visual-dump-instruction-mix", llvm::cl::init(false),
+    llvm::cl::desc("Count the executed instructions of every function by opcode class, one counter per block"));
+
+static llvm::cl::opt<bool> LineProfile(
+    "visual-dump-line-profile", llvm::cl::init(false),
+    llvm::cl::desc("Count executed instructions and time per source line from the !dbg locations, needs -g"));
+
+static llvm::cl::opt<unsigned> PromotionThreshold(
+    "visual-dump-icp-threshold", llvm::cl::init(30), llvm::cl::value_desc("percent"),
+    llvm::cl::desc("Share of an indirect call site's calls a target needs to be promoted to a direct call"));
+
 class GraphvizPass : public llvm::FunctionPass {
     using Edge = std::pair<std::string, std::string>;
 
 public:
     GraphvizPass()
         : FunctionPass(id)
-        , dot_builder_("dump.dot") {
+        , dot_builder_("dump.dot")
+        , branch_weights_(profile_emitter_)
+        , indirect_calls_(profile_emitter_)
+        , binary_op_profiler_(profile_emitter_)
+        , coverage_(profile_emitter_)
+        , edge_profiler_(profile_emitter_)
+        , path_profiler_(profile_emitter_)
+        , branch_bias_(profile_emitter_)
+        , loop_trips_(profile_emitter_)
+        , memory_profiler_(profile_emitter_)
+        , heap_profiler_(profile_emitter_)
+        , lock_profiler_(profile_emitter_)
+        , instruction_mix_(profile_emitter_)
+        , line_profiler_(profile_emitter_) {
 
         dot_builder_.BeginGraph("G");
         dot_builder_.AddAttribute("shape=rect", AttributeType::Node);
@@ -34,14 +135,97 @@ public:
         dot_builder_.EndGraph();
     }
 
+    virtual bool doInitialization(llvm::Module& module) {
+        if (!ProfileUse.empty() && !profile_.Load(ProfileUse)) {
+            module.getContext().emitError("visual-dump: cannot read profile '" + ProfileUse + "'");
+        }
+        if (BlockCoverage && ProfileUse.empty()) {
+            coverage_.Begin(module);
+        }
+        return false;
+    }
+
     virtual bool runOnFunction(llvm::Function& func) {
         if (func.hasName()) {
+            /* Taken before the instrumentation changes anything */
+            uint64_t cfg_hash = ProfileEmitter::FunctionHash(func);
             StaticDump(func);
-            DynamicDump(func);
+
+            if (!ProfileUse.empty()) {
+                /* Weights first, promotion adds blocks of its own. Exact branch counts win over edge counts */
+                edge_profiler_.Apply(func, cfg_hash, profile_);
+                branch_weights_.Apply(func, cfg_hash, profile_);
+                indirect_calls_.Promote(func, cfg_hash, profile_, PromotionThreshold);
+                return true;
+            }
+
+            if (LoopTripProfile) {
+                loop_trips_.Begin(func);
+            }
+
+            /* Purity is checked before the other modes add their stores and calls */
+            bool profile_arguments = ValueProfile && ArgumentProfiler::IsCandidate(func);
+
+            /* Before the modes that add loads and stores of their own, it adds no blocks */
+            if (!MemoryProfile.empty()) {
+                memory_profiler_.Instrument(func, MemoryProfile, "ProfileMemoryAccess__");
+            }
+            if (!FalseSharing.empty()) {
+                memory_profiler_.Instrument(func, FalseSharing, "ProfileSharedAccess__");
+            }
+            /* Counts the function as it was, before the inline counters below */
+            if (InstructionMixProfile) {
+                instruction_mix_.Instrument(func, cfg_hash);
+            }
+            /* Same, the counters have no location and count for no line */
+            if (LineProfile) {
+                line_profiler_.Instrument(func, cfg_hash);
+            }
+            /* The bitmap slots were reserved for the blocks as they were at doInitialization */
+            if (BlockCoverage) {
+                coverage_.Instrument(func, cfg_hash);
+            }
+            /* Then the spanning tree, while the static estimates are those of the profile-use compile */
+            if (EdgeProfile) {
+                edge_profiler_.Instrument(func, cfg_hash);
+            }
+            if (PathProfile) {
+                path_profiler_.Instrument(func);
+            }
+            if (profile_arguments) {
+                argument_profiler_.Instrument(func);
+            }
+            if (!BinaryOpProfile.empty()) {
+                binary_op_profiler_.Instrument(func, BinaryOpProfile);
+            }
+            if (BranchBiasProfile) {
+                branch_bias_.Instrument(func, cfg_hash);
+            }
+            if (LoopTripProfile) {
+                loop_trips_.Instrument(func, cfg_hash);
+            }
+            if (HeapProfile) {
+                heap_profiler_.Instrument(func);
+            }
+            if (LockProfile) {
+                lock_profiler_.Instrument(func);
+            }
+            if (ProfileGen) {
+                branch_weights_.Instrument(func, cfg_hash);
+                indirect_calls_.Instrument(func, cfg_hash);
+            }
+            if (LogCalls) {
+                DynamicDump(func);
+            }
         }
         return true;
     }
 
+    virtual bool doFinalization(llvm::Module& module) {
+        profile_emitter_.Finalize(module);
+        return true;
+    }
+
 private:
     void StaticDump(llvm::Function& func) {
         /* Function's address serves us as a unique identifier */
@@ -95,7 +279,7 @@ private:
         std::vector<llvm::Type*> logger_call_param_types = {
             builder.getInt8Ty()->getPointerTo(),
             builder.getInt8Ty()->getPointerTo(),
-            llvm::Type::getInt32Ty(context)
+            builder.getInt64Ty()
         };
         
         llvm::FunctionType* logger_call_func_type =
@@ -103,10 +287,21 @@ private:
         llvm::FunctionCallee logger_call_callee =
             func.getParent()->getOrInsertFunction("LogFunctionCall__", logger_call_func_type);
 
+        /* Prepare LogFuncEntry__ function */
+        std::vector<llvm::Type*> logger_entry_param_types = {
+            builder.getInt8Ty()->getPointerTo(),
+            builder.getInt64Ty()
+        };
+
+        llvm::FunctionType* logger_entry_func_type =
+            llvm::FunctionType::get(ret_type, logger_entry_param_types, false);
+        llvm::FunctionCallee logger_entry_callee =
+            func.getParent()->getOrInsertFunction("LogFuncEntry__", logger_entry_func_type);
+
         /* Prepare LogFuncRet__ function */
         std::vector<llvm::Type*> logger_end_param_types = {
             builder.getInt8Ty()->getPointerTo(),
-            llvm::Type::getInt32Ty(context)
+            builder.getInt64Ty()
         };
         
         llvm::FunctionType* logger_end_func_type =
@@ -114,6 +309,10 @@ private:
         llvm::FunctionCallee logger_end_callee =
             func.getParent()->getOrInsertFunction("LogFuncRet__", logger_end_func_type);
 
+        /* The runtime keys its shadow stack by the name pointer, so all the loggers share one string */
+        builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+        llvm::Value* func_name = builder.CreateGlobalStringPtr(func.getName());
+
         /* Insert loggers for call, binOpt and ret instructions */
         for (auto& block : func) {
             for (auto& instruction : block) {
@@ -126,12 +325,13 @@ private:
                     builder.SetInsertPoint(call);
 
                     /* Insert a call to LogFunctionCall__ function */
+                    /* Calls of the other modes' hooks are not part of the program */
                     llvm::Function* callee = call->getCalledFunction();
-                    if (callee) {
+                    if (callee && !ProfileEmitter::IsHook(callee)) {
                         llvm::Value* callee_name = builder.CreateGlobalStringPtr(callee->getName());
-                        llvm::Value* func_name = builder.CreateGlobalStringPtr(func.getName());
                         llvm::Value* args[] = {func_name, callee_name, value_addr};
                         builder.CreateCall(logger_call_callee, args);
+                        profile_emitter_.DescribeSite(instruction, "call " + callee->getName().str());
                     }
                 }
 
@@ -141,17 +341,42 @@ private:
                     builder.SetInsertPoint(ret);
 
                     /* Insert a call to funcEndLogFunc function */
-                    llvm::Value* func_name = builder.CreateGlobalStringPtr(func.getName());
                     llvm::Value* args[] = {func_name, value_addr};
                     builder.CreateCall(logger_end_callee, args);
+                    profile_emitter_.DescribeSite(instruction, "ret");
                 }
             }
         }
+
+        /* Insert a call to LogFuncEntry__ function, after the loop so it is not logged as a call */
+        builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+        llvm::Value* func_addr =
+            llvm::ConstantInt::get(builder.getInt64Ty(), reinterpret_cast<uint64_t>(&func));
+        llvm::Value* entry_args[] = {func_name, func_addr};
+        builder.CreateCall(logger_entry_callee, entry_args);
+        profile_emitter_.DescribeFunction(func);
     }
 
 private:
     static char id;
     DotBuilder dot_builder_;
+
+    ProfileEmitter profile_emitter_;
+    visual_dump::ProfileReader profile_;
+    BranchWeights branch_weights_;
+    IndirectCalls indirect_calls_;
+    ArgumentProfiler argument_profiler_;
+    BinaryOpProfiler binary_op_profiler_;
+    Coverage coverage_;
+    EdgeProfiler edge_profiler_;
+    PathProfiler path_profiler_;
+    BranchBias branch_bias_;
+    LoopTrips loop_trips_;
+    MemoryProfiler memory_profiler_;
+    HeapProfiler heap_profiler_;
+    LockProfiler lock_profiler_;
+    InstructionMix instruction_mix_;
+    LineProfiler line_profiler_;
 };
 
 } /* namespace */
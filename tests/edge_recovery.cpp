@@ -0,0 +1,37 @@
+/*
+ * Spanning-tree edge profile: a loop around a switch. The weights the
+ * profile-use compile recovers from the edge counters must be those of
+ * the exact branch counts.
+ */
+#include <cstdio>
+
+int classify(int value) {
+    int steps = 0;
+    while (value > 1) {
+        switch (value % 4) {
+        case 0:
+            value /= 4;
+            break;
+        case 1:
+            value -= 1;
+            break;
+        case 2:
+            value /= 2;
+            break;
+        default:
+            value += 1;
+            break;
+        }
+        steps++;
+    }
+    return steps;
+}
+
+int main() {
+    long total = 0;
+    for (int i = 0; i < 10000; i++) {
+        total += classify(i);
+    }
+    printf("%ld\n", total);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Forks while another thread allocates. The thread may hold the heap
+ * profile's lock at the fork, the child takes it on its first allocation
+ * and again when it writes its report at exit.
+ */
+#include <atomic>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+std::atomic<bool> stop{false};
+
+void* Allocate(void*) {
+    while (!stop.load()) {
+        free(malloc(64));
+    }
+    return nullptr;
+}
+
+int main() {
+    pthread_t thread;
+    pthread_create(&thread, nullptr, Allocate, nullptr);
+    int failures = 0;
+    for (int i = 0; i < 50 && failures == 0; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            /* A deadlocked child is killed */
+            alarm(5);
+            free(malloc(64));
+            exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        failures += WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+    }
+    stop.store(true);
+    pthread_join(thread, nullptr);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+/*
+ * RAII locks: the lock_guard and unique_lock acquisitions count at the
+ * user's call sites, not inside the inline std::mutex members they call.
+ */
+#include <mutex>
+#include <thread>
+
+std::mutex counter_mutex;
+long counter = 0;
+
+void AddGuarded(int times) {
+    for (int i = 0; i < times; i++) {
+        std::lock_guard<std::mutex> lock(counter_mutex);
+        counter++;
+    }
+}
+
+/* Unlocked before the destructor, which must not release it again */
+void AddUnique(int times) {
+    for (int i = 0; i < times; i++) {
+        std::unique_lock<std::mutex> lock(counter_mutex);
+        counter++;
+        lock.unlock();
+    }
+}
+
+int main() {
+    std::thread guarded(AddGuarded, 10000);
+    std::thread unique(AddUnique, 10000);
+    guarded.join();
+    unique.join();
+    return counter == 20000 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#!/bin/bash
+
+# Builds the programs of tests/ with the pass, runs them and checks their reports.
+# Usage: CXX=clang++-14 PASS_SO=<pass library> tests/run_tests.sh <runtime objects...>, "make test" does it
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+INC_DIR=$TESTS_DIR/../pass/include
+PASS_SO=$(realpath "$PASS_SO")
+RUNTIME_OBJ=$(realpath "$@")
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+PASS_CXX_FLAGS="-g -O0 -std=c++17 -I$INC_DIR -flegacy-pass-manager -Xclang -load -Xclang $PASS_SO"
+
+# compile <test> <output> <extra flags> <pass flags...>
+compile() {
+    local test=$1 output=$2 extra=$3
+    shift 3
+    $CXX "$TESTS_DIR/$test.cpp" -o "$output" $extra $PASS_CXX_FLAGS $(printf -- "-mllvm %s " "$@")
+}
+
+# build <test> <pass flags...>, then run it in the work directory
+build_and_run() {
+    local test=$1
+    shift
+    compile "$test" "$WORK_DIR/$test.o" -c "$@" &&
+        $CXX "$WORK_DIR/$test.o" $RUNTIME_OBJ -o "$WORK_DIR/$test" -pthread -lrt -ldl &&
+        (cd "$WORK_DIR" && "./$test" > "$test.log")
+}
+
+fail() {
+    echo "[FAIL] $1: $2"
+    return 1
+}
+
+# Profile-use weights from the edge counters alone match those from the exact branch counters
+test_edge_recovery() {
+    build_and_run edge_recovery -visual-dump-log-calls=false -visual-dump-profile-gen -visual-dump-edge-profile ||
+        return 1
+
+    local function=_Z8classifyi
+    grep "^1 " "$WORK_DIR/visual_dump.prof" > "$WORK_DIR/branches.prof"
+    grep "^5 " "$WORK_DIR/visual_dump.prof" > "$WORK_DIR/edges.prof"
+    local branch_counters edge_counters
+    branch_counters=$(awk -v f=$function '$2 == f { print $4 }' "$WORK_DIR/branches.prof")
+    edge_counters=$(awk -v f=$function '$2 == f { print $4 }' "$WORK_DIR/edges.prof")
+    if [ -z "$edge_counters" ] || [ "$edge_counters" -ge "$branch_counters" ]; then
+        fail edge_recovery "expected fewer edge counters than branch counters, got '$edge_counters'"
+        return 1
+    fi
+
+    local profile
+    for profile in branches edges; do
+        compile edge_recovery "$WORK_DIR/$profile.ll" "-S -emit-llvm" \
+            -visual-dump-profile-use="$WORK_DIR/$profile.prof" || return 1
+        grep -o '!{!"\(branch_weights\|function_entry_count\)"[^}]*}' "$WORK_DIR/$profile.ll" \
+            > "$WORK_DIR/$profile.weights"
+    done
+    if [ ! -s "$WORK_DIR/edges.weights" ] || ! diff "$WORK_DIR/branches.weights" "$WORK_DIR/edges.weights"; then
+        fail edge_recovery "recovered weights differ from the exact ones"
+        return 1
+    fi
+}
+
+# Sites of the RAII locks are the user's functions, every acquisition counts once
+test_lock_guard() {
+    build_and_run lock_guard -visual-dump-log-calls=false -visual-dump-lock-profile || return 1
+
+    # "<function> <callee> <acquisitions>" per site
+    awk '/^    node_/ { function_name = $2; callee = $3 } /^        acquisitions/ { print function_name, callee, $2 }' \
+        "$WORK_DIR/locks.txt" > "$WORK_DIR/sites.txt"
+    if ! grep -q "^_Z10AddGuardedi _ZNSt10lock_guard[^ ]* 10000$" "$WORK_DIR/sites.txt" ||
+        ! grep -q "^_Z9AddUniquei _ZNSt11unique_lock[^ ]* 10000$" "$WORK_DIR/sites.txt"; then
+        fail lock_guard "expected 10000 acquisitions at each RAII site"
+        return 1
+    fi
+    if grep -q "^_ZNSt" "$WORK_DIR/sites.txt" || ! grep -q "^lock .* acquisitions 20000 " "$WORK_DIR/locks.txt"; then
+        fail lock_guard "acquisitions counted inside the standard library"
+        return 1
+    fi
+}
+
+# A child forked while another thread allocates neither deadlocks nor crashes
+test_fork_heap() {
+    compile fork_heap "$WORK_DIR/fork_heap.o" -c -visual-dump-log-calls=false -visual-dump-heap-profile &&
+        $CXX "$WORK_DIR/fork_heap.o" $RUNTIME_OBJ -o "$WORK_DIR/fork_heap" -pthread -lrt -ldl || return 1
+    if ! (cd "$WORK_DIR" && ./fork_heap > fork_heap.log); then
+        fail fork_heap "a forked child did not exit normally"
+        return 1
+    fi
+}
+
+# The mutexes of one scoped_lock have no order between them, nested lock_guards do
+test_scoped_lock() {
+    build_and_run scoped_lock -visual-dump-log-calls=false -visual-dump-lock-profile || return 1
+
+    local inversions
+    inversions=$(grep -c "^# order inversion" "$WORK_DIR/locks.txt")
+    if [ "$inversions" -ne 1 ]; then
+        fail scoped_lock "expected the one inversion of the nested lock_guards, got $inversions"
+        return 1
+    fi
+}
+
+TESTS="edge_recovery lock_guard fork_heap scoped_lock"
+
+failed=0
+for test in $TESTS; do
+    rm -rf "${WORK_DIR:?}"/*
+    if "test_$test"; then
+        echo "[PASS] $test"
+    else
+        failed=$((failed + 1))
+    fi
+done
+echo "$failed of $(echo $TESTS | wc -w) tests failed"
+[ $failed -eq 0 ]
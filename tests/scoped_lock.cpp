@@ -0,0 +1,36 @@
+/*
+ * A scoped_lock takes its mutexes together and cannot deadlock on them, so
+ * taking the same two in either order is no order inversion. Nesting two
+ * lock_guards in both orders is one.
+ */
+#include <mutex>
+
+std::mutex first_mutex;
+std::mutex second_mutex;
+std::mutex third_mutex;
+
+void LockForward() {
+    std::scoped_lock lock(first_mutex, second_mutex);
+}
+
+void LockBackward() {
+    std::scoped_lock lock(second_mutex, first_mutex);
+}
+
+void NestForward() {
+    std::lock_guard<std::mutex> outer(first_mutex);
+    std::lock_guard<std::mutex> inner(third_mutex);
+}
+
+void NestBackward() {
+    std::lock_guard<std::mutex> outer(third_mutex);
+    std::lock_guard<std::mutex> inner(first_mutex);
+}
+
+int main() {
+    LockForward();
+    LockBackward();
+    NestForward();
+    NestBackward();
+    return 0;
+}
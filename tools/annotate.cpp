@@ -0,0 +1,228 @@
+/*
+ * Prints annotated source listings, like "perf annotate", of the hottest
+ * functions of the line profile the runtime writes at exit with
+ * -visual-dump-line-profile (lines.txt). Every source line of a function
+ * shows its share of the function's time, its executions and executed
+ * instructions. Functions are ranked by time, by executed instructions
+ * when the run was not timed.
+ *
+ * Usage:
+ *   annotate lines.txt [-n functions] [-C context] [-d source_dir]
+ *
+ *   -n  number of functions, 5 by default
+ *   -C  source lines shown around the first and the last counted line, 2 by default
+ *   -d  where to look for the sources the recorded paths do not lead to, by file name
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct LineCounts {
+    uint64_t executions{0};
+    uint64_t instructions{0};
+    uint64_t time_ns{0};
+};
+
+struct Function {
+    std::string name;
+    uint64_t instructions{0};
+    uint64_t time_ns{0};
+    std::map<std::string, std::map<uint32_t, LineCounts>> files;
+};
+
+class LineProfile {
+public:
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        std::map<std::string, size_t> indices;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            /* The source path is the rest of the line, it may have spaces */
+            std::istringstream stream(line);
+            std::string name;
+            uint32_t line_number = 0;
+            LineCounts counts;
+            if (!(stream >> name >> line_number >> counts.executions >> counts.instructions >> counts.time_ns)) {
+                continue;
+            }
+            std::string source;
+            std::getline(stream >> std::ws, source);
+
+            auto index = indices.emplace(name, functions_.size());
+            if (index.second) {
+                functions_.push_back(Function{name, 0, 0, {}});
+            }
+            Function& function = functions_[index.first->second];
+            function.instructions += counts.instructions;
+            function.time_ns += counts.time_ns;
+            function.files[source][line_number] = counts;
+            timed_ |= counts.time_ns != 0;
+        }
+        return true;
+    }
+
+    /* Hottest first */
+    std::vector<const Function*> Ranked() const {
+        std::vector<const Function*> ranked;
+        uint64_t Function::*weight = timed_ ? &Function::time_ns : &Function::instructions;
+        for (const Function& function : functions_) {
+            ranked.push_back(&function);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [weight](const Function* lhs, const Function* rhs) {
+            return lhs->*weight > rhs->*weight;
+        });
+        return ranked;
+    }
+
+    bool Timed() const {
+        return timed_;
+    }
+
+    uint64_t TotalTime() const {
+        uint64_t total = 0;
+        for (const Function& function : functions_) {
+            total += function.time_ns;
+        }
+        return total;
+    }
+
+    uint64_t TotalInstructions() const {
+        uint64_t total = 0;
+        for (const Function& function : functions_) {
+            total += function.instructions;
+        }
+        return total;
+    }
+
+private:
+    std::vector<Function> functions_;
+    bool timed_{false};
+};
+
+/* Lines of the source, empty if it cannot be found */
+std::vector<std::string> ReadSource(const std::string& path, const std::string& source_dir) {
+    std::ifstream file(path);
+    if (!file.is_open() && !source_dir.empty()) {
+        size_t slash = path.rfind('/');
+        file.open(source_dir + "/" + (slash != std::string::npos ? path.substr(slash + 1) : path));
+    }
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+double Percent(uint64_t count, uint64_t total) {
+    return total != 0 ? 100.0 * static_cast<double>(count) / static_cast<double>(total) : 0.0;
+}
+
+void Annotate(const LineProfile& profile, const Function& function, uint32_t context, const std::string& source_dir) {
+    if (profile.Timed()) {
+        printf("%s: %.1f%% of the time, %.3f ms, %llu instructions\n", function.name.c_str(),
+               Percent(function.time_ns, profile.TotalTime()), static_cast<double>(function.time_ns) / 1e6,
+               static_cast<unsigned long long>(function.instructions));
+    } else {
+        printf("%s: %.1f%% of the instructions, %llu\n", function.name.c_str(),
+               Percent(function.instructions, profile.TotalInstructions()),
+               static_cast<unsigned long long>(function.instructions));
+    }
+
+    for (const auto& file : function.files) {
+        const std::map<uint32_t, LineCounts>& lines = file.second;
+        std::vector<std::string> source = ReadSource(file.first, source_dir);
+        printf("  %s%s\n", file.first.c_str(), source.empty() ? " (source not found)" : "");
+        printf("  %7s %12s %14s %6s\n", profile.Timed() ? "time" : "instr", "executions", "instructions", "line");
+
+        uint32_t first = lines.begin()->first > context ? lines.begin()->first - context : 1;
+        uint32_t last = lines.rbegin()->first + context;
+        if (!source.empty()) {
+            last = std::min<uint32_t>(last, static_cast<uint32_t>(source.size()));
+        }
+        for (uint32_t line = first; line <= last; line++) {
+            auto counts = lines.find(line);
+            bool counted = counts != lines.end();
+            /* Without the source only the counted lines say anything */
+            if (source.empty() && !counted) {
+                continue;
+            }
+
+            if (counted) {
+                double share = profile.Timed() ? Percent(counts->second.time_ns, function.time_ns)
+                                               : Percent(counts->second.instructions, function.instructions);
+                printf("  %6.1f%% %12llu %14llu", share, static_cast<unsigned long long>(counts->second.executions),
+                       static_cast<unsigned long long>(counts->second.instructions));
+            } else {
+                printf("  %7s %12s %14s", "", "", "");
+            }
+            printf(" %6u | %s\n", line, line <= source.size() ? source[line - 1].c_str() : "");
+        }
+    }
+    printf("\n");
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: annotate lines.txt [-n functions] [-C context] [-d source_dir]" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    size_t functions = 5;
+    uint32_t context = 2;
+    std::string source_dir;
+    /* Every option takes a value */
+    if (argc % 2 != 0) {
+        PrintUsage();
+        return 1;
+    }
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            functions = strtoull(argv[i + 1], nullptr, 0);
+        } else if (strcmp(argv[i], "-C") == 0) {
+            context = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 0));
+        } else if (strcmp(argv[i], "-d") == 0) {
+            source_dir = argv[i + 1];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    LineProfile profile;
+    if (!profile.Load(argv[1])) {
+        std::cerr << "Cannot read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<const Function*> ranked = profile.Ranked();
+    for (size_t i = 0; i < ranked.size() && i < functions; i++) {
+        Annotate(profile, *ranked[i], context, source_dir);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Annotates the static dump.dot with the reports the runtime writes. An
+ * overlay file holds one line per node or function cluster:
+ *
+ *   node_<id> <dot attributes>
+ *   cluster_<id> <dot attributes>
+ *
+ * The ids are those of dump.dot, the addresses of the instructions and
+ * functions in the pass. Node attributes are added to the node statement,
+ * cluster attributes at the end of the cluster, so they take precedence
+ * over the label the pass wrote. Lines of several overlays for the same
+ * node are all applied.
+ *
+ * Usage:
+ *   dot_overlay dump.dot overlay... [-o output]
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+class Overlays {
+public:
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t id_end = line.find(' ');
+            if (line.empty() || line[0] == '#' || id_end == std::string::npos) {
+                continue;
+            }
+            std::string& attributes = attributes_[line.substr(0, id_end)];
+            attributes += (attributes.empty() ? "" : ", ") + line.substr(id_end + 1);
+        }
+        return true;
+    }
+
+    const std::string* Find(const std::string& id) const {
+        auto attributes = attributes_.find(id);
+        return attributes != attributes_.end() ? &attributes->second : nullptr;
+    }
+
+private:
+    std::map<std::string, std::string> attributes_;
+};
+
+std::string Trim(const std::string& line, std::string* indent = nullptr) {
+    size_t begin = line.find_first_not_of(" \t");
+    size_t end = line.find_last_not_of(" \t\r");
+    if (indent != nullptr) {
+        *indent = line.substr(0, begin == std::string::npos ? line.size() : begin);
+    }
+    return begin == std::string::npos ? "" : line.substr(begin, end - begin + 1);
+}
+
+/* Follows the layout DotBuilder writes: one statement or attribute list per line */
+void Apply(std::istream& dot, const Overlays& overlays, std::ostream& output) {
+    std::vector<std::string> scopes; /* Cluster of every open brace, empty for other graphs */
+    std::string line;
+    while (std::getline(dot, line)) {
+        std::string indent;
+        std::string statement = Trim(line, &indent);
+
+        if (statement == "}" && !scopes.empty()) {
+            const std::string* attributes = overlays.Find(scopes.back());
+            if (attributes != nullptr) {
+                output << indent << "\tgraph" << std::endl;
+                output << indent << "\t[" << *attributes << "]" << std::endl;
+            }
+            scopes.pop_back();
+            output << line << std::endl;
+            continue;
+        }
+
+        output << line << std::endl;
+        if (!statement.empty() && statement.back() == '{') {
+            const char* prefix = "subgraph ";
+            bool is_cluster = statement.compare(0, strlen(prefix), prefix) == 0;
+            scopes.push_back(is_cluster ? Trim(statement.substr(strlen(prefix), statement.size() - strlen(prefix) - 1))
+                                        : "");
+            continue;
+        }
+
+        /* A node statement, its own attribute list follows on the next line */
+        if (statement.compare(0, 5, "node_") == 0 && statement.find("->") == std::string::npos) {
+            const std::string* attributes = overlays.Find(statement);
+            if (attributes != nullptr) {
+                output << indent << "[" << *attributes << "]" << std::endl;
+            }
+        }
+    }
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: dot_overlay dump.dot overlay... [-o output]" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string output_file;
+    Overlays overlays;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (!overlays.Load(argv[i])) {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    std::ifstream dot(argv[1]);
+    if (!dot.is_open()) {
+        std::cerr << "Cannot read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!output_file.empty()) {
+        file.open(output_file, std::ios::trunc);
+    }
+    Apply(dot, overlays, output_file.empty() ? std::cout : file);
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Builds a linker function order from the dynamic call graph the runtime
+ * writes at exit (callgraph.txt). Functions are grouped with C3 call-chain
+ * clustering (Ottoni & Maher, CGO 2017): every function, hottest first, is
+ * appended to the cluster of its most frequent caller, so hot callers and
+ * callees end up adjacent in .text. Clusters are then sorted by density.
+ *
+ * Usage:
+ *   function_order callgraph.txt [-s sizes.txt] [-p page_size] [-f lld|gold] [-o output]
+ *
+ *   -s  output of "nm -S --defined-only" on the uninstrumented objects or binary being ordered,
+ *       unknown functions get 64 bytes
+ *   -p  maximum cluster size, one page by default
+ *   -f  "lld" prints symbol names for --symbol-ordering-file,
+ *       "gold" prints .text.<name> for --section-ordering-file
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t kDefaultSize = 64;
+
+struct Function {
+    std::string name;
+    uint64_t calls{0};
+    uint64_t self_ns{0};
+    uint64_t size{kDefaultSize};
+    uint32_t cluster{0};
+    uint32_t caller{UINT32_MAX};
+    uint64_t caller_calls{0};
+};
+
+struct Cluster {
+    std::vector<uint32_t> functions;
+    uint64_t size{0};
+    uint64_t weight{0};
+
+    double Density() const {
+        return static_cast<double>(weight) / static_cast<double>(size != 0 ? size : 1);
+    }
+};
+
+class CallGraph {
+public:
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        std::vector<std::pair<std::pair<std::string, std::string>, uint64_t>> edges;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream stream(line);
+            std::string kind;
+            stream >> kind;
+            if (kind == "function") {
+                std::string name;
+                stream >> name;
+                Function& function = Get(name);
+                stream >> function.calls >> function.self_ns;
+            } else if (kind == "edge") {
+                std::string caller, callee;
+                uint64_t calls = 0;
+                stream >> caller >> callee >> calls;
+                edges.emplace_back(std::make_pair(caller, callee), calls);
+            }
+        }
+
+        /* Only the most frequent caller matters for C3, self recursion is ignored */
+        for (const auto& edge : edges) {
+            uint32_t caller = Index(edge.first.first);
+            uint32_t callee_idx = Index(edge.first.second);
+            Function& callee = functions_[callee_idx];
+            if (caller != callee_idx && edge.second > callee.caller_calls) {
+                callee.caller = caller;
+                callee.caller_calls = edge.second;
+            }
+        }
+        return true;
+    }
+
+    bool LoadSizes(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream stream(line);
+            std::string address, size, type, name;
+            if (!(stream >> address >> size >> type >> name) || (type != "T" && type != "t")) {
+                continue;
+            }
+            auto function = index_.find(name);
+            if (function != index_.end()) {
+                functions_[function->second].size = strtoull(size.c_str(), nullptr, 16);
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint32_t> Order(uint64_t max_cluster_size) {
+        /* Hotness is the self time, or the call count when nothing was timed */
+        bool timed = std::any_of(functions_.begin(), functions_.end(),
+                                 [](const Function& function) { return function.self_ns != 0; });
+
+        std::vector<Cluster> clusters(functions_.size());
+        for (uint32_t idx = 0; idx < functions_.size(); idx++) {
+            Function& function = functions_[idx];
+            function.cluster = idx;
+            clusters[idx].functions.push_back(idx);
+            clusters[idx].size = function.size;
+            clusters[idx].weight = timed ? function.self_ns : function.calls;
+        }
+
+        std::vector<uint32_t> by_hotness(functions_.size());
+        for (uint32_t idx = 0; idx < by_hotness.size(); idx++) {
+            by_hotness[idx] = idx;
+        }
+        std::stable_sort(by_hotness.begin(), by_hotness.end(), [&](uint32_t lhs, uint32_t rhs) {
+            return clusters[lhs].weight > clusters[rhs].weight;
+        });
+
+        for (uint32_t idx : by_hotness) {
+            const Function& function = functions_[idx];
+            if (function.caller == UINT32_MAX) {
+                continue;
+            }
+
+            Cluster& callee = clusters[function.cluster];
+            Cluster& caller = clusters[functions_[function.caller].cluster];
+            if (&callee == &caller || caller.size + callee.size > max_cluster_size) {
+                continue;
+            }
+
+            /* Do not drag a hot callee into a much colder cluster */
+            if (caller.Density() * 8 < callee.Density()) {
+                continue;
+            }
+
+            for (uint32_t moved : callee.functions) {
+                functions_[moved].cluster = functions_[function.caller].cluster;
+                caller.functions.push_back(moved);
+            }
+            caller.size += callee.size;
+            caller.weight += callee.weight;
+            callee = Cluster();
+        }
+
+        std::vector<const Cluster*> sorted;
+        for (const Cluster& cluster : clusters) {
+            if (!cluster.functions.empty()) {
+                sorted.push_back(&cluster);
+            }
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster* lhs, const Cluster* rhs) {
+            return lhs->Density() > rhs->Density();
+        });
+
+        std::vector<uint32_t> order;
+        for (const Cluster* cluster : sorted) {
+            order.insert(order.end(), cluster->functions.begin(), cluster->functions.end());
+        }
+        return order;
+    }
+
+    const Function& Get(uint32_t idx) const {
+        return functions_[idx];
+    }
+
+private:
+    uint32_t Index(const std::string& name) {
+        auto function = index_.find(name);
+        if (function != index_.end()) {
+            return function->second;
+        }
+        uint32_t idx = static_cast<uint32_t>(functions_.size());
+        index_.emplace(name, idx);
+        functions_.push_back(Function());
+        functions_.back().name = name;
+        return idx;
+    }
+
+    Function& Get(const std::string& name) {
+        return functions_[Index(name)];
+    }
+
+private:
+    std::vector<Function> functions_;
+    std::map<std::string, uint32_t> index_;
+};
+
+void PrintUsage() {
+    std::cerr << "Usage: function_order callgraph.txt [-s sizes.txt] [-p page_size] [-f lld|gold] [-o output]"
+              << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string sizes_file;
+    std::string format = "lld";
+    std::string output_file;
+    uint64_t page_size = 4096;
+    /* Every option takes a value */
+    if (argc % 2 != 0) {
+        PrintUsage();
+        return 1;
+    }
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-s") == 0) {
+            sizes_file = argv[i + 1];
+        } else if (strcmp(argv[i], "-p") == 0) {
+            page_size = strtoull(argv[i + 1], nullptr, 0);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            format = argv[i + 1];
+        } else if (strcmp(argv[i], "-o") == 0) {
+            output_file = argv[i + 1];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    CallGraph graph;
+    if (!graph.Load(argv[1])) {
+        std::cerr << "Cannot read " << argv[1] << std::endl;
+        return 1;
+    }
+    if (!sizes_file.empty() && !graph.LoadSizes(sizes_file)) {
+        std::cerr << "Cannot read " << sizes_file << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!output_file.empty()) {
+        file.open(output_file, std::ios::trunc);
+    }
+    std::ostream& output = output_file.empty() ? std::cout : file;
+
+    for (uint32_t idx : graph.Order(page_size)) {
+        output << (format == "gold" ? ".text." : "") << graph.Get(idx).name << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Live view of a process running with VISUAL_DUMP_LIVE=1: attaches to its
+ * shared memory segment and redraws the functions by call rate, top-like.
+ * Rates and latencies are those of the last interval, the totals are since
+ * the start. Latency is the mean inclusive time per call.
+ *
+ * Usage:
+ *   live_top <pid> [-i interval_ms] [-n rows] [-s rate|time|latency] [-c refreshes]
+ */
+
+#include <live_stats.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using visual_dump::LiveHeader;
+using visual_dump::LiveSlot;
+
+namespace {
+
+struct Sample {
+    uint64_t calls{0};
+    uint64_t inclusive_ns{0};
+};
+
+struct Row {
+    std::string func;
+    double rate;       /* Calls per second */
+    double latency_us; /* Of the interval, the total mean without calls in it */
+    double time_share; /* Inclusive time per wall time, above 1 with threads in parallel */
+    uint64_t calls;
+};
+
+LiveHeader* Attach(long pid) {
+    std::string name = visual_dump::LiveSegmentName(pid);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info{};
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(LiveHeader)) {
+        memory = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto* header = static_cast<LiveHeader*>(memory);
+    if (header->magic.load(std::memory_order_acquire) != visual_dump::kLiveMagic ||
+        header->version != visual_dump::kLiveVersion ||
+        visual_dump::LiveSegmentSize(header->capacity) > static_cast<size_t>(info.st_size)) {
+        return nullptr;
+    }
+    return header;
+}
+
+std::map<std::string, Sample> Read(LiveHeader* header) {
+    std::map<std::string, Sample> samples;
+    const LiveSlot* slots = visual_dump::LiveSlots(header);
+    uint32_t used = std::min(header->num_slots.load(std::memory_order_acquire), header->capacity);
+    for (uint32_t i = 0; i < used; i++) {
+        Sample sample;
+        while (!visual_dump::ReadSlot(slots[i], sample.calls, sample.inclusive_ns)) {
+        }
+        samples[std::string(slots[i].func, strnlen(slots[i].func, visual_dump::kLiveNameSize))] = sample;
+    }
+    return samples;
+}
+
+void Draw(long pid, const std::vector<Row>& rows, size_t max_rows, double interval_s, uint64_t dropped) {
+    if (isatty(STDOUT_FILENO)) {
+        printf("\033[H\033[J");
+    }
+    printf("pid %ld, %zu functions, %.2f s interval", pid, rows.size(), interval_s);
+    printf(dropped != 0 ? ", %lu calls dropped\n\n" : "\n\n", dropped);
+    printf("%12s %12s %8s %14s  %s\n", "calls/s", "latency us", "time", "calls", "function");
+    for (size_t i = 0; i < rows.size() && i < max_rows; i++) {
+        const Row& row = rows[i];
+        printf("%12.1f %12.3f %7.1f%% %14lu  %s\n", row.rate, row.latency_us, 100.0 * row.time_share, row.calls,
+               row.func.c_str());
+    }
+    fflush(stdout);
+}
+
+void PrintUsage() {
+    fprintf(stderr, "Usage: live_top <pid> [-i interval_ms] [-n rows] [-s rate|time|latency] [-c refreshes]\n");
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    long pid = strtol(argv[1], nullptr, 0);
+    long interval_ms = 1000;
+    size_t max_rows = 30;
+    std::string sort = "rate";
+    long refreshes = 0;
+    /* Every option takes a value */
+    if (argc % 2 != 0) {
+        PrintUsage();
+        return 1;
+    }
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-i") == 0) {
+            interval_ms = std::max(strtol(argv[i + 1], nullptr, 0), 10l);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            max_rows = strtoul(argv[i + 1], nullptr, 0);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            sort = argv[i + 1];
+        } else if (strcmp(argv[i], "-c") == 0) {
+            refreshes = strtol(argv[i + 1], nullptr, 0);
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    LiveHeader* header = Attach(pid);
+    if (header == nullptr) {
+        fprintf(stderr, "No live statistics of %ld, is it running with VISUAL_DUMP_LIVE=1?\n", pid);
+        return 1;
+    }
+
+    std::map<std::string, Sample> previous = Read(header);
+    uint64_t previous_ns = header->published_ns.load(std::memory_order_acquire);
+    for (long refresh = 0; refreshes == 0 || refresh < refreshes; refresh++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        if (kill(static_cast<pid_t>(pid), 0) != 0) {
+            fprintf(stderr, "Process %ld exited\n", pid);
+            return 0;
+        }
+
+        /* Rates are over the runtime's publish instants, not ours */
+        uint64_t published_ns = header->published_ns.load(std::memory_order_acquire);
+        std::map<std::string, Sample> current = Read(header);
+        if (published_ns == previous_ns) {
+            continue;
+        }
+        double interval_s = static_cast<double>(published_ns - previous_ns) / 1e9;
+
+        std::vector<Row> rows;
+        for (const auto& function : current) {
+            const Sample& before = previous[function.first];
+            uint64_t calls = function.second.calls - before.calls;
+            uint64_t inclusive_ns = function.second.inclusive_ns - before.inclusive_ns;
+            double latency_ns = calls != 0 ? static_cast<double>(inclusive_ns) / static_cast<double>(calls)
+                                           : static_cast<double>(function.second.inclusive_ns) /
+                                                 static_cast<double>(std::max<uint64_t>(function.second.calls, 1));
+            rows.push_back(Row{function.first, static_cast<double>(calls) / interval_s, latency_ns / 1e3,
+                               static_cast<double>(inclusive_ns) / 1e9 / interval_s, function.second.calls});
+        }
+        std::stable_sort(rows.begin(), rows.end(), [&sort](const Row& lhs, const Row& rhs) {
+            if (sort == "time") {
+                return lhs.time_share > rhs.time_share;
+            }
+            if (sort == "latency") {
+                return lhs.latency_us > rhs.latency_us;
+            }
+            return lhs.rate > rhs.rate;
+        });
+        Draw(pid, rows, max_rows, interval_s, header->dropped_calls.load(std::memory_order_relaxed));
+
+        previous.swap(current);
+        previous_ns = published_ns;
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Names the ids the hooks print and dump.dot uses from the .visual_dump
+ * section of an instrumented binary, see metadata_section.hpp. Given ids,
+ * prints a line per id. Without ids, copies stdin to stdout and appends
+ * the source location to every "{<id>}" of the trace log and "node_<id>"
+ * or "cluster_<id>" of the reports that it knows.
+ *
+ * Usage:
+ *   symbolize <binary> [-l] [id...]
+ *
+ *   -l  lists every function and site of the section
+ */
+
+#include <metadata_section.hpp>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Symbol {
+    std::string module;
+    std::string function;
+    std::string file;
+    uint32_t line;
+    uint32_t column;
+    std::string text; /* Empty for functions */
+};
+
+class Metadata {
+public:
+    bool Load(const std::string& file_name) {
+        std::ifstream file(file_name, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::string section;
+        if (!FindSection(image, section)) {
+            std::cerr << "No " << visual_dump::kMetadataSection << " section in " << file_name << std::endl;
+            return false;
+        }
+        return Parse(section);
+    }
+
+    /* All the modules that describe the id, ids are only unique within a compiler process */
+    std::vector<const Symbol*> Find(uint64_t id) const {
+        std::vector<const Symbol*> found;
+        auto range = symbols_.equal_range(id);
+        for (auto symbol = range.first; symbol != range.second; ++symbol) {
+            found.push_back(&symbol->second);
+        }
+        return found;
+    }
+
+    const std::multimap<uint64_t, Symbol>& Symbols() const {
+        return symbols_;
+    }
+
+private:
+    /* 64-bit ELF of the host's byte order, the only kind the pass builds here */
+    static bool FindSection(const std::vector<char>& image, std::string& section) {
+        if (image.size() < sizeof(Elf64_Ehdr) || memcmp(image.data(), ELFMAG, SELFMAG) != 0 ||
+            image[EI_CLASS] != ELFCLASS64) {
+            return false;
+        }
+        Elf64_Ehdr header;
+        memcpy(&header, image.data(), sizeof(header));
+        if (header.e_shoff + static_cast<uint64_t>(header.e_shnum) * sizeof(Elf64_Shdr) > image.size() ||
+            header.e_shstrndx >= header.e_shnum) {
+            return false;
+        }
+
+        std::vector<Elf64_Shdr> sections(header.e_shnum);
+        memcpy(sections.data(), image.data() + header.e_shoff, sections.size() * sizeof(Elf64_Shdr));
+        const Elf64_Shdr& names = sections[header.e_shstrndx];
+        for (const Elf64_Shdr& candidate : sections) {
+            if (names.sh_offset + candidate.sh_name >= image.size() || candidate.sh_type == SHT_NOBITS) {
+                continue;
+            }
+            const char* name = image.data() + names.sh_offset + candidate.sh_name;
+            if (strcmp(name, visual_dump::kMetadataSection) == 0 &&
+                candidate.sh_offset + candidate.sh_size <= image.size()) {
+                section.assign(image.data() + candidate.sh_offset, candidate.sh_size);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Parse(const std::string& section) {
+        size_t offset = 0;
+        while (offset + sizeof(visual_dump::MetadataHeader) <= section.size()) {
+            visual_dump::MetadataHeader header;
+            memcpy(&header, section.data() + offset, sizeof(header));
+
+            /* Padding between the records of different objects */
+            if (header.magic != visual_dump::kMetadataMagic) {
+                offset += 8;
+                continue;
+            }
+            if (header.version != visual_dump::kMetadataVersion || offset + header.size > section.size()) {
+                std::cerr << "Unsupported or truncated record at offset " << offset << std::endl;
+                return false;
+            }
+            ParseRecord(section.data() + offset, header);
+            offset += header.size;
+        }
+        return true;
+    }
+
+    void ParseRecord(const char* record, const visual_dump::MetadataHeader& header) {
+        const char* functions = record + sizeof(header);
+        const char* sites = functions + header.num_functions * sizeof(visual_dump::MetadataFunction);
+        const char* strings = sites + header.num_sites * sizeof(visual_dump::MetadataSite);
+        auto string = [strings, &header](uint32_t offset) {
+            return offset < header.strings_size ? std::string(strings + offset) : std::string();
+        };
+
+        std::map<uint64_t, std::string> function_names;
+        for (uint32_t i = 0; i < header.num_functions; i++) {
+            visual_dump::MetadataFunction function;
+            memcpy(&function, functions + i * sizeof(function), sizeof(function));
+            function_names[function.id] = string(function.name);
+            symbols_.emplace(function.id, Symbol{string(header.module), string(function.name), string(function.file),
+                                                 function.line, 0, ""});
+        }
+        for (uint32_t i = 0; i < header.num_sites; i++) {
+            visual_dump::MetadataSite site;
+            memcpy(&site, sites + i * sizeof(site), sizeof(site));
+            symbols_.emplace(site.id, Symbol{string(header.module), function_names[site.function], string(site.file),
+                                             site.line, site.column, string(site.text)});
+        }
+    }
+
+private:
+    std::multimap<uint64_t, Symbol> symbols_;
+};
+
+std::string Describe(const Symbol& symbol) {
+    std::ostringstream description;
+    description << symbol.function;
+    if (!symbol.text.empty()) {
+        description << " " << symbol.text;
+    }
+    if (!symbol.file.empty()) {
+        description << " at " << symbol.file << ":" << symbol.line;
+        if (symbol.column != 0) {
+            description << ":" << symbol.column;
+        }
+    }
+    return description.str();
+}
+
+std::string DescribeAll(const std::vector<const Symbol*>& symbols) {
+    std::string description;
+    for (const Symbol* symbol : symbols) {
+        description += (description.empty() ? "" : " | ") + Describe(*symbol);
+    }
+    return description;
+}
+
+/* Appends " <description>" after every id token of the line that is known */
+std::string Annotate(const Metadata& metadata, const std::string& line) {
+    std::string annotated;
+    size_t position = 0;
+    while (position < line.size()) {
+        size_t digits = line.find_first_of("0123456789", position);
+        if (digits == std::string::npos) {
+            break;
+        }
+        size_t end = digits;
+        while (end < line.size() && isdigit(static_cast<unsigned char>(line[end])) != 0) {
+            end++;
+        }
+        annotated.append(line, position, end - position);
+
+        bool braced = digits > 0 && line[digits - 1] == '{' && end < line.size() && line[end] == '}';
+        bool node = digits >= 5 && line.compare(digits - 5, 5, "node_") == 0;
+        bool cluster = digits >= 8 && line.compare(digits - 8, 8, "cluster_") == 0;
+        std::vector<const Symbol*> symbols;
+        if (braced || node || cluster) {
+            symbols = metadata.Find(strtoull(line.substr(digits, end - digits).c_str(), nullptr, 10));
+        }
+        if (!symbols.empty()) {
+            if (braced) {
+                annotated += '}';
+                end++;
+            }
+            annotated += " <" + DescribeAll(symbols) + ">";
+        }
+        position = end;
+    }
+    if (position < line.size()) {
+        annotated.append(line, position, std::string::npos);
+    }
+    return annotated;
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: symbolize <binary> [-l] [id...]" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    Metadata metadata;
+    if (!metadata.Load(argv[1])) {
+        return 1;
+    }
+
+    if (argc == 2) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::cout << Annotate(metadata, line) << std::endl;
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[2], "-l") == 0) {
+        for (const auto& symbol : metadata.Symbols()) {
+            std::cout << symbol.first << " " << symbol.second.module << " " << Describe(symbol.second) << std::endl;
+        }
+        return 0;
+    }
+
+    int missing = 0;
+    for (int i = 2; i < argc; i++) {
+        std::vector<const Symbol*> symbols = metadata.Find(strtoull(argv[i], nullptr, 0));
+        std::cout << argv[i] << " " << (symbols.empty() ? "?" : DescribeAll(symbols)) << std::endl;
+        missing += symbols.empty() ? 1 : 0;
+    }
+    return missing != 0 ? 1 : 0;
+}